@@ -1,17 +1,78 @@
 #include "yeb.h"
 
-bool is_release = false;
+typedef enum Profile {
+  /// -O1 with debug info and `DEBUG_ASSERT`s.
+  PROFILE_DEBUG,
+  /// -O3 + LTO, runs on any CPU of the target architecture.
+  PROFILE_RELEASE_PORTABLE,
+  /// -O3 + LTO, tuned for and only runs on CPUs like the one building it.
+  PROFILE_RELEASE_NATIVE,
+  /// `PROFILE_RELEASE_NATIVE`, instrumented to write profiles into `bin/pgo/`.
+  PROFILE_PGO_GENERATE,
+  /// `PROFILE_RELEASE_NATIVE`, optimized with the profile merged into `bin/pgo/default.profdata`.
+  PROFILE_PGO_USE,
+} Profile;
+
+Profile profile = PROFILE_DEBUG;
+
+/// Build with `ALLOC_TRACKING`, see `src/alloc_track.h`.
+bool track_alloc = false;
+
+/// Directory for instrumented runs to write profiles into.
+#define PGO_DIR "bin/pgo"
+#define PGO_PROFDATA PGO_DIR "/default.profdata"
+
+#ifdef __APPLE__
+#define LLVM_PROFDATA "xcrun llvm-profdata"
+#else
+#define LLVM_PROFDATA "llvm-profdata"
+#endif
+
+/// Sources shared by every binary, without the extension.
+const char *lib_srcs[] = {"mat",       "nn",          "arena",       "perf_counters", "numa", "graph",
+                          "conv",      "checkpoint",  "train",       "sweep",         "norm", "rnn",
+                          "embedding", "alloc_track", "infer_cache"};
+
+/// Sources with a `main`, each linked with `lib_srcs` into a binary of the same name (except `main`, which is `ml`).
+const char *bin_srcs[] = {"main", "bench", "test"};
 
 void cc(Cmd *cmd) {
   CMD_APPEND(cmd, "clang");
 }
 
+/// Flags shared by compiling and linking, so that LTO and the profile runtime make it to the linker.
+void profile_flags(Cmd *cmd) {
+  switch (profile) {
+  case PROFILE_DEBUG:
+    CMD_APPEND(cmd, "-g -O1");
+    break;
+  case PROFILE_RELEASE_PORTABLE:
+    CMD_APPEND(cmd, "-O3 -flto");
+    break;
+  case PROFILE_RELEASE_NATIVE:
+    CMD_APPEND(cmd, "-O3 -flto -march=native");
+    break;
+  case PROFILE_PGO_GENERATE:
+    CMD_APPEND(cmd, "-O3 -flto -march=native -fprofile-generate=" PGO_DIR);
+    break;
+  case PROFILE_PGO_USE:
+    CMD_APPEND(cmd, "-O3 -flto -march=native -fprofile-use=" PGO_PROFDATA);
+    break;
+  }
+}
+
 void cflags(Cmd *cmd) {
   CMD_APPEND(cmd, "-Wall -Wextra --std=gnu17");
-  if (is_release)
-    CMD_APPEND(cmd, "-O2");
-  else
-    CMD_APPEND(cmd, "-g -O1 -DDEBUG");
+  profile_flags(cmd);
+  if (profile == PROFILE_DEBUG)
+    CMD_APPEND(cmd, "-DDEBUG");
+  if (track_alloc)
+    CMD_APPEND(cmd, "-DALLOC_TRACKING");
+}
+
+void ldflags(Cmd *cmd) {
+  profile_flags(cmd);
+  CMD_APPEND(cmd, "-lm -lpthread");
 }
 
 Cmd mkdir_bin() {
@@ -20,29 +81,137 @@ Cmd mkdir_bin() {
   return cmd;
 }
 
-Cmd build_main() {
+/// "bin/NAME.EXT"
+const char *bin_path(const char *name, const char *ext) {
+  DynString s = dynstring_new();
+  dynstring_append_cstr(&s, "bin/");
+  dynstring_append_cstr(&s, name);
+  dynstring_append_cstr(&s, ext);
+  return s.cstr;
+}
+
+/// Compile `src/NAME.c` into `bin/NAME.o`, unless it's newer than the source, every header it included last time (from
+/// the `-MMD` depfile), and was built with the same command. With `PROFILE_PGO_USE` the profile is a dependency too,
+/// since merging a new one changes the code without changing the command.
+/// Returns whether anything was spawned.
+bool build_object(Jobs *jobs, const char *name) {
   Cmd cmd = {0};
   cc(&cmd);
   cflags(&cmd);
-  CMD_APPEND(&cmd, "src/main.c");
-  CMD_APPEND(&cmd, "-c -o bin/main.o");
-  return cmd;
+  DynString src = dynstring_new();
+  dynstring_append_cstr(&src, "src/");
+  dynstring_append_cstr(&src, name);
+  dynstring_append_cstr(&src, ".c");
+  const char *obj = bin_path(name, ".o");
+  const char *dep = bin_path(name, ".d");
+  CMD_APPEND(&cmd, src.cstr, "-c -o", obj, "-MMD -MF", dep);
+  bool changed = cmd_changed(cmd, bin_path(name, ".o.cmd"));
+  bool stale = changed || needs_rebuild_depfile(obj, dep);
+  if (!stale && profile == PROFILE_PGO_USE) {
+    ConstStrings profdata = {0};
+    da_push(&profdata, PGO_PROFDATA);
+    stale = needs_rebuild(obj, profdata);
+    free(profdata.da_items);
+  }
+  if (!stale)
+    return false;
+  // So that a failed build with new flags doesn't leave an old object looking up to date.
+  remove(obj);
+  jobs_spawn(jobs, cmd);
+  return true;
 }
 
-Cmd link() {
+/// Link `bin/MAIN.o` and the library objects into `bin/OUT`, if any of them changed.
+void link(Jobs *jobs, const char *main, const char *out) {
   Cmd cmd = {0};
   cc(&cmd);
-  CMD_APPEND(&cmd, "bin/main.o");
-  CMD_APPEND(&cmd, "-o bin/ml");
-  return cmd;
+  ConstStrings objs = {0};
+  da_push(&objs, bin_path(main, ".o"));
+  for (size_t i = 0; i < sizeof(lib_srcs) / sizeof(lib_srcs[0]); ++i)
+    da_push(&objs, bin_path(lib_srcs[i], ".o"));
+  DA_FOR(&objs, i, obj, { CMD_APPEND(&cmd, *obj); });
+  const char *out_path = bin_path(out, "");
+  CMD_APPEND(&cmd, "-o", out_path);
+  ldflags(&cmd);
+  bool changed = cmd_changed(cmd, bin_path(out, ".cmd"));
+  if (changed || needs_rebuild(out_path, objs))
+    jobs_spawn(jobs, cmd);
+}
+
+/// Compile and link everything with the current `profile`.
+void build(Jobs *jobs) {
+  execute(mkdir_bin());
+  // Every object is independent, then every binary is.
+  for (size_t i = 0; i < sizeof(lib_srcs) / sizeof(lib_srcs[0]); ++i)
+    build_object(jobs, lib_srcs[i]);
+  for (size_t i = 0; i < sizeof(bin_srcs) / sizeof(bin_srcs[0]); ++i)
+    build_object(jobs, bin_srcs[i]);
+  jobs_wait_all(jobs);
+  for (size_t i = 0; i < sizeof(bin_srcs) / sizeof(bin_srcs[0]); ++i)
+    link(jobs, bin_srcs[i], strcmp(bin_srcs[i], "main") == 0 ? "ml" : bin_srcs[i]);
+  jobs_wait_all(jobs);
 }
 
+/// Build instrumented, train a profile by running the benchmark (forward and training on a large network, i.e.
+/// `mat_mul`, `sigmoid_mat` and `nn_train`), then rebuild with the profile.
+void build_pgo(Jobs *jobs) {
+  Cmd clean = {0};
+  CMD_APPEND(&clean, "rm -rf " PGO_DIR);
+  execute(clean);
+  profile = PROFILE_PGO_GENERATE;
+  build(jobs);
+  Cmd train = {0};
+  CMD_APPEND(&train, "./bin/bench pool");
+  execute(train);
+  Cmd merge = {0};
+  CMD_APPEND(&merge, LLVM_PROFDATA " merge -o " PGO_PROFDATA " " PGO_DIR "/*.profraw");
+  execute(merge);
+  profile = PROFILE_PGO_USE;
+  build(jobs);
+}
+
+/// Options:
+/// --profile=P   debug (default), release-portable, release-native, pgo-generate, pgo-use,
+///               or pgo (pgo-generate, run `bin/bench pool`, merge the profile, then pgo-use).
+/// --release     Same as --profile=release-portable.
+/// --track-alloc Count allocations and print a report at exit, see `src/alloc_track.h`.
+/// -j=N          At most N commands at a time, defaults to the number of CPUs.
+/// --test        Run `bin/test` after building.
 int main(int argc, char **argv) {
   yeb_bootstrap();
   Options opts = parse_argv(argc, argv);
-  is_release = opts_get(opts, "--release").exists;
-  execute(mkdir_bin());
-  execute(build_main());
-  execute(link());
+  Jobs jobs = {0};
+  OptionFlag j = opts_get(opts, "-j");
+  if (j.exists && j.value->ds.cstr != NULL)
+    jobs.max = (size_t)atoi(j.value->ds.cstr);
+  if (opts_get(opts, "--release").exists)
+    profile = PROFILE_RELEASE_PORTABLE;
+  track_alloc = opts_get(opts, "--track-alloc").exists;
+  OptionFlag profile_opt = opts_get(opts, "--profile");
+  if (profile_opt.exists) {
+    const char *name = profile_opt.value->ds.cstr != NULL ? profile_opt.value->ds.cstr : "";
+    if (strcmp(name, "pgo") == 0) {
+      build_pgo(&jobs);
+      return 0;
+    }
+    const char *names[] = {"debug", "release-portable", "release-native", "pgo-generate", "pgo-use"};
+    bool found = false;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+      if (strcmp(name, names[i]) == 0) {
+        profile = (Profile)i;
+        found = true;
+      }
+    }
+    if (!found) {
+      printf("unknown profile `%s`\n", name);
+      return 1;
+    }
+  }
+  build(&jobs);
+  if (opts_get(opts, "--test").exists) {
+    Cmd test = {0};
+    CMD_APPEND(&test, "./bin/test");
+    execute(test);
+  }
   return 0;
 }
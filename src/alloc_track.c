@@ -0,0 +1,200 @@
+#include "alloc_track.h"
+
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define usable_size_(P) malloc_size(P)
+#else
+#include <malloc.h>
+#define usable_size_(P) malloc_usable_size(P)
+#endif
+
+/// Sites shown by `alloc_track_report`, by bytes.
+#define ALLOC_TRACK_REPORT_SITES 10
+
+/// Guards everything below but the thread locals. Allocating is slow anyway, and tracking is for diagnostics.
+static pthread_mutex_t track_mutex = PTHREAD_MUTEX_INITIALIZER;
+static AllocStats track_stats;
+/// Open addressing on `file:line`, at most 3/4 full, the rest goes to `track_other`.
+static AllocSiteStats track_sites[ALLOC_TRACK_MAX_SITES];
+static usize track_site_count;
+static AllocSiteStats track_other = {.file = "(other sites)"};
+
+static _Thread_local const char *pending_file;
+static _Thread_local i32 pending_line;
+static _Thread_local usize step_depth;
+static _Thread_local u64 step_allocs;
+
+/// `__FILE__` is compared by content, every translation unit has its own copy.
+static AllocSiteStats *site_find(const char *file, i32 line, bool insert) {
+  u64 hash = 14695981039346656037ull;
+  for (const char *c = file; *c != '\0'; ++c)
+    hash = (hash ^ (u8)*c) * 1099511628211ull;
+  hash = (hash ^ (u32)line) * 1099511628211ull;
+  for (usize probe = 0; probe < ALLOC_TRACK_MAX_SITES; ++probe) {
+    AllocSiteStats *site = &track_sites[(hash + probe) % ALLOC_TRACK_MAX_SITES];
+    if (site->file == NULL) {
+      if (!insert)
+        return NULL;
+      if (track_site_count >= ALLOC_TRACK_MAX_SITES / 4 * 3)
+        return &track_other;
+      ++track_site_count;
+      *site = (AllocSiteStats){.file = file, .line = line};
+      return site;
+    }
+    if (site->line == line && strcmp(site->file, file) == 0)
+      return site;
+  }
+  return insert ? &track_other : NULL;
+}
+
+/// `p` replaced a block of `old_size` bytes (0 for a new one).
+static void track_alloc(void *p, usize old_size, const char *file, i32 line) {
+  if (file == NULL) {
+    file = pending_file != NULL ? pending_file : "(unknown)";
+    line = pending_file != NULL ? pending_line : 0;
+  }
+  const usize size = usable_size_(p);
+  const bool in_step = step_depth > 0;
+  step_allocs += in_step;
+  pthread_mutex_lock(&track_mutex);
+  track_stats.live_bytes += (i64)size - (i64)old_size;
+  track_stats.peak_bytes = max(track_stats.peak_bytes, track_stats.live_bytes);
+  ++track_stats.allocs;
+  AllocSiteStats *site = site_find(file, line, true);
+  ++site->allocs;
+  site->bytes += size;
+  site->step_allocs += in_step;
+  pthread_mutex_unlock(&track_mutex);
+}
+
+void *alloc_track_malloc(usize len, const char *file, i32 line) {
+  void *p = malloc(len);
+  if (p != NULL)
+    track_alloc(p, 0, file, line);
+  return p;
+}
+
+void *alloc_track_memalign(usize align, usize len, const char *file, i32 line) {
+  void *p = NULL;
+  if (posix_memalign(&p, align, len) != 0)
+    return NULL;
+  track_alloc(p, 0, file, line);
+  return p;
+}
+
+void *alloc_track_realloc(void *p, usize len, const char *file, i32 line) {
+  if (p == NULL)
+    return alloc_track_malloc(len, file, line);
+  const usize old_size = usable_size_(p);
+  void *new_p = realloc(p, len);
+  if (new_p != NULL)
+    track_alloc(new_p, old_size, file, line);
+  return new_p;
+}
+
+void alloc_track_free(void *p) {
+  if (p == NULL)
+    return;
+  const usize size = usable_size_(p);
+  free(p);
+  pthread_mutex_lock(&track_mutex);
+  track_stats.live_bytes -= (i64)size;
+  ++track_stats.frees;
+  pthread_mutex_unlock(&track_mutex);
+}
+
+void alloc_track_set_site(const char *file, i32 line) {
+  pending_file = file;
+  pending_line = line;
+}
+
+AllocStats alloc_track_stats(void) {
+  pthread_mutex_lock(&track_mutex);
+  AllocStats stats = track_stats;
+  pthread_mutex_unlock(&track_mutex);
+  return stats;
+}
+
+AllocSiteStats alloc_track_site_stats(const char *file, i32 line) {
+  pthread_mutex_lock(&track_mutex);
+  AllocSiteStats *site = site_find(file, line, false);
+  AllocSiteStats stats = site != NULL ? *site : (AllocSiteStats){.file = file, .line = line};
+  pthread_mutex_unlock(&track_mutex);
+  return stats;
+}
+
+void alloc_track_step_begin(void) {
+  if (step_depth++ == 0)
+    step_allocs = 0;
+}
+
+void alloc_track_step_end(void) {
+  ASSERT(step_depth > 0);
+  if (--step_depth > 0)
+    return;
+  pthread_mutex_lock(&track_mutex);
+  ++track_stats.steps;
+  track_stats.step_allocs += step_allocs;
+  track_stats.allocating_steps += step_allocs > 0;
+  track_stats.max_step_allocs = max(track_stats.max_step_allocs, step_allocs);
+  pthread_mutex_unlock(&track_mutex);
+}
+
+static f64 kib(i64 bytes) {
+  return (f64)bytes / 1024;
+}
+
+void alloc_track_report(FILE *f) {
+  pthread_mutex_lock(&track_mutex);
+  AllocStats s = track_stats;
+  fprintf(f, "allocations: %" PRIu64 ", frees: %" PRIu64 ", peak: %.1f KiB, live: %.1f KiB\n", s.allocs, s.frees,
+          kib(s.peak_bytes), kib(s.live_bytes));
+  fprintf(f, "training steps: %" PRIu64 ", allocating: %" PRIu64 " (%" PRIu64 " allocations, at most %" PRIu64
+          " in one)\n", s.steps, s.allocating_steps, s.step_allocs, s.max_step_allocs);
+  // Repeated scans, the report can't allocate. Sites are ordered by bytes then index, `prev` is the last one shown.
+  fprintf(f, "top sites by bytes:\n");
+  usize prev = ALLOC_TRACK_MAX_SITES;
+  for (usize k = 0; k < ALLOC_TRACK_REPORT_SITES; ++k) {
+    usize top = ALLOC_TRACK_MAX_SITES;
+    for (usize i = 0; i < ALLOC_TRACK_MAX_SITES; ++i) {
+      const AllocSiteStats *site = &track_sites[i];
+      if (site->file == NULL)
+        continue;
+      if (prev < ALLOC_TRACK_MAX_SITES && (site->bytes > track_sites[prev].bytes ||
+                                           (site->bytes == track_sites[prev].bytes && i <= prev)))
+        continue;
+      if (top == ALLOC_TRACK_MAX_SITES || site->bytes > track_sites[top].bytes)
+        top = i;
+    }
+    if (top == ALLOC_TRACK_MAX_SITES)
+      break;
+    const AllocSiteStats *site = &track_sites[top];
+    fprintf(f, "  %s:%d: %" PRIu64 " allocations, %.1f KiB\n", site->file, site->line, site->allocs,
+            kib((i64)site->bytes));
+    prev = top;
+  }
+  if (track_other.allocs > 0)
+    fprintf(f, "  %s: %" PRIu64 " allocations, %.1f KiB\n", track_other.file, track_other.allocs,
+            kib((i64)track_other.bytes));
+  if (s.step_allocs > 0) {
+    fprintf(f, "allocating inside training steps:\n");
+    for (usize i = 0; i < ALLOC_TRACK_MAX_SITES; ++i) {
+      const AllocSiteStats *site = &track_sites[i];
+      if (site->file != NULL && site->step_allocs > 0)
+        fprintf(f, "  %s:%d: %" PRIu64 " allocations\n", site->file, site->line, site->step_allocs);
+    }
+  }
+  pthread_mutex_unlock(&track_mutex);
+}
+
+#ifdef ALLOC_TRACKING
+static void alloc_track_report_at_exit(void) {
+  alloc_track_report(stderr);
+}
+
+attribute(constructor) static void alloc_track_init(void) {
+  atexit(alloc_track_report_at_exit);
+}
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common.h"
+
+/// Heap accounting, to check memory budgets and catch allocations creeping into hot loops.
+///
+/// Built with `ALLOC_TRACKING` (`./yeb/yeb --track-alloc`), `xalloc`, `xrealloc`, `xfree`, the `da_*` and `ada_*`
+/// macros and `HEAP_ALLOCATOR` go through `alloc_track_malloc` and friends (declared in `common.h`), which record live
+/// and peak bytes and allocations per call site, the line the macro was expanded at. The report is printed to stderr
+/// at exit. Without it they call libc directly, and only what calls these functions explicitly is counted.
+///
+/// Sizes are what the allocator handed out (`malloc_usable_size`), so that frees need no header and memory from libc
+/// itself can be freed either way. Arenas and huge pages are `mmap`ed and not counted.
+///
+/// Training loops bracket every step (one parameter update) with `ALLOC_TRACK_STEP_BEGIN`/`END`. Allocations in
+/// between are counted per step and per call site: once set up, training should have none.
+
+/// Distinct call sites tracked, later ones are counted together.
+#define ALLOC_TRACK_MAX_SITES 1024
+
+typedef struct AllocSiteStats {
+  const char *file;
+  i32 line;
+  /// Allocations and reallocations, and the bytes they handed out.
+  u64 allocs;
+  u64 bytes;
+  /// Allocations inside training steps.
+  u64 step_allocs;
+} AllocSiteStats;
+
+typedef struct AllocStats {
+  /// Bytes allocated now, and the most at any point.
+  i64 live_bytes;
+  i64 peak_bytes;
+  /// Allocations (reallocations included) and frees.
+  u64 allocs;
+  u64 frees;
+  /// Steps ended, allocations inside them, steps with any, and the most in one step.
+  u64 steps;
+  u64 step_allocs;
+  u64 allocating_steps;
+  u64 max_step_allocs;
+} AllocStats;
+
+AllocStats alloc_track_stats(void);
+
+/// Zero if `file:line` never allocated.
+AllocSiteStats alloc_track_site_stats(const char *file, i32 line);
+
+/// Steps are per thread and may nest, only the outermost one counts.
+void alloc_track_step_begin(void);
+void alloc_track_step_end(void);
+
+/// Totals, the sites that allocated the most bytes, and every site that allocated inside steps.
+void alloc_track_report(FILE *f);
+
+#ifdef ALLOC_TRACKING
+#define ALLOC_TRACK_STEP_BEGIN() alloc_track_step_begin()
+#define ALLOC_TRACK_STEP_END() alloc_track_step_end()
+#else
+#define ALLOC_TRACK_STEP_BEGIN() do_nothing()
+#define ALLOC_TRACK_STEP_END() do_nothing()
+#endif
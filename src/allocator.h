@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common.h"
+
+/// A pluggable allocator, for putting buffers into arenas, huge pages, etc.
+typedef struct Allocator {
+  void *ctx;
+  /// `align` is a power of 2. Returns NULL on failure.
+  void *(*alloc)(void *ctx, usize size, usize align);
+  /// Nullable, `alloc` + `memcpy` + `free` is used if absent.
+  /// Returns NULL on failure, in which case `p` is left untouched.
+  void *(*realloc)(void *ctx, void *p, usize old_size, usize new_size, usize align);
+  /// Nullable for allocators that free everything at once (e.g. arenas).
+  void (*free)(void *ctx, void *p, usize size);
+} Allocator;
+
+static inline void *heap_alloc_(void *ctx, usize size, usize align) {
+  (void)ctx;
+  // No call site of its own, allocations are attributed to the one set by `ada_grow_`.
+  if (align <= _Alignof(max_align_t))
+    return site_malloc_(size, NULL, 0);
+#ifdef ALLOC_TRACKING
+  return alloc_track_memalign(align, size, NULL, 0);
+#else
+  void *p = NULL;
+  if (posix_memalign(&p, align, size) != 0)
+    return NULL;
+  return p;
+#endif
+}
+
+static inline void *heap_realloc_(void *ctx, void *p, usize old_size, usize new_size, usize align) {
+  (void)ctx;
+  if (align <= _Alignof(max_align_t))
+    return site_realloc_(p, new_size, NULL, 0);
+  // `realloc` doesn't preserve over-alignment.
+  void *new_p = heap_alloc_(ctx, new_size, align);
+  if (new_p == NULL)
+    return NULL;
+  memcpy(new_p, p, min(old_size, new_size));
+  site_free(p);
+  return new_p;
+}
+
+static inline void heap_free_(void *ctx, void *p, usize size) {
+  (void)ctx;
+  (void)size;
+  site_free(p);
+}
+
+#define HEAP_ALLOCATOR                                                                                                 \
+  ((Allocator){                                                                                                        \
+      .ctx = NULL,                                                                                                     \
+      .alloc = heap_alloc_,                                                                                            \
+      .realloc = heap_realloc_,                                                                                        \
+      .free = heap_free_,                                                                                              \
+  })
+
+/// Allocate or panic.
+static inline void *allocator_alloc(Allocator a, usize size, usize align) {
+  void *p = a.alloc(a.ctx, size, align);
+  ASSERT_PRINTF(p != NULL, "allocation of %zu bytes failed\n", size);
+  return p;
+}
+
+/// Reallocate or panic.
+static inline void *allocator_realloc(Allocator a, void *p, usize old_size, usize new_size, usize align) {
+  if (p == NULL)
+    return allocator_alloc(a, new_size, align);
+  void *new_p;
+  if (a.realloc != NULL) {
+    new_p = a.realloc(a.ctx, p, old_size, new_size, align);
+  } else {
+    new_p = a.alloc(a.ctx, new_size, align);
+    if (new_p != NULL) {
+      memcpy(new_p, p, min(old_size, new_size));
+      if (a.free != NULL)
+        a.free(a.ctx, p, old_size);
+    }
+  }
+  ASSERT_PRINTF(new_p != NULL, "reallocation to %zu bytes failed\n", new_size);
+  return new_p;
+}
+
+static inline void allocator_free(Allocator a, void *p, usize size) {
+  if (p != NULL && a.free != NULL)
+    a.free(a.ctx, p, size);
+}
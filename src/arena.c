@@ -0,0 +1,128 @@
+#include <sys/mman.h>
+
+#include "arena.h"
+
+static usize round_up(usize x, usize to) {
+  return (x + to - 1) / to * to;
+}
+
+/// Map `size` bytes aligned to `align` by over-mapping and trimming the ends.
+static u8 *mmap_aligned(usize size, usize align) {
+  usize len = size + align;
+  u8 *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  u8 *aligned = (u8 *)round_up((usize)p, align);
+  if (aligned != p)
+    munmap(p, aligned - p);
+  usize tail = (p + len) - (aligned + size);
+  if (tail != 0)
+    munmap(aligned + size, tail);
+  return aligned;
+}
+
+static void *arena_alloc_(void *ctx, usize size, usize align) {
+  return arena_alloc(ctx, size, align);
+}
+
+static void *arena_realloc_(void *ctx, void *p, usize old_size, usize new_size, usize align) {
+  Arena *arena = ctx;
+  // The most recent allocation can grow or shrink in place.
+  if ((u8 *)p + old_size == arena->base + arena->used && (usize)p % align == 0) {
+    usize offset = (u8 *)p - arena->base;
+    if (offset + new_size > arena->cap)
+      return NULL;
+    arena->used = offset + new_size;
+    return p;
+  }
+  void *new_p = arena_alloc(arena, new_size, align);
+  if (new_p != NULL)
+    memcpy(new_p, p, min(old_size, new_size));
+  return new_p;
+}
+
+Arena arena_new(usize cap, ArenaPages pages) {
+  cap = round_up(max(cap, (usize)1), HUGE_PAGE_SIZE);
+  u8 *base = NULL;
+#ifdef MAP_HUGETLB
+  if (pages == ARENA_PAGES_HUGETLB) {
+    base = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED) {
+      base = NULL;
+      pages = ARENA_PAGES_TRANSPARENT_HUGE;
+    }
+  }
+#else
+  if (pages == ARENA_PAGES_HUGETLB)
+    pages = ARENA_PAGES_TRANSPARENT_HUGE;
+#endif
+  if (base == NULL) {
+    // Huge page aligned either way, so that THP can back the whole range.
+    base = mmap_aligned(cap, HUGE_PAGE_SIZE);
+    ASSERT_PRINTF(base != NULL, "mmap of %zu bytes failed\n", cap);
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+    if (pages == ARENA_PAGES_TRANSPARENT_HUGE && madvise(base, cap, MADV_HUGEPAGE) != 0)
+      pages = ARENA_PAGES_NORMAL;
+    else if (pages == ARENA_PAGES_NORMAL)
+      madvise(base, cap, MADV_NOHUGEPAGE);
+#else
+    pages = ARENA_PAGES_NORMAL;
+#endif
+  }
+  return (Arena){
+      .base = base,
+      .cap = cap,
+      .used = 0,
+      .pages = pages,
+  };
+}
+
+void arena_free(Arena *arena) {
+  munmap(arena->base, arena->cap);
+  arena->base = NULL;
+  arena->cap = 0;
+  arena->used = 0;
+}
+
+void *arena_alloc(Arena *arena, usize size, usize align) {
+  usize offset = round_up((usize)arena->base + arena->used, align) - (usize)arena->base;
+  if (offset + size > arena->cap)
+    return NULL;
+  arena->used = offset + size;
+  return arena->base + offset;
+}
+
+void arena_reset(Arena *arena) {
+  arena->used = 0;
+}
+
+Allocator arena_allocator(Arena *arena) {
+  return (Allocator){
+      .ctx = arena,
+      .alloc = arena_alloc_,
+      .realloc = arena_realloc_,
+      .free = NULL,
+  };
+}
+
+const DaConfig *arena_da_config(Arena *arena) {
+  arena->da_config = (DaConfig){
+      .allocator = arena_allocator(arena),
+      .init_cap = 0,
+      .growth = 1.5,
+      .align = 64,
+  };
+  return &arena->da_config;
+}
+
+const char *arena_pages_name(ArenaPages pages) {
+  switch (pages) {
+  case ARENA_PAGES_NORMAL:
+    return "normal";
+  case ARENA_PAGES_TRANSPARENT_HUGE:
+    return "THP";
+  case ARENA_PAGES_HUGETLB:
+    return "hugetlb";
+  }
+  __builtin_unreachable();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.h"
+#include "allocator.h"
+#include "da.h"
+
+#define HUGE_PAGE_SIZE ((usize)2 << 20)
+
+typedef enum ArenaPages {
+  /// Regular pages, transparent huge pages explicitly turned off for the mapping.
+  ARENA_PAGES_NORMAL,
+  /// Transparent huge pages through `madvise(MADV_HUGEPAGE)`.
+  ARENA_PAGES_TRANSPARENT_HUGE,
+  /// Explicit huge pages through `MAP_HUGETLB`, needs pages reserved in `/proc/sys/vm/nr_hugepages`.
+  ARENA_PAGES_HUGETLB,
+} ArenaPages;
+
+/// Bump allocator over one `mmap`ed region.
+/// The region is reserved up front and committed by the OS on first touch, so a generous `cap` only costs address
+/// space.
+typedef struct Arena {
+  u8 *base;
+  /// In bytes.
+  usize cap;
+  usize used;
+  /// What the arena actually got, may be less than what was asked for.
+  ArenaPages pages;
+  /// Config for `AdaF32` and friends allocating from this arena, see `arena_da_config`.
+  DaConfig da_config;
+} Arena;
+
+/// Map an arena of at least `cap` bytes, trying for `pages` and falling back to smaller pages if that fails:
+/// `MAP_HUGETLB` -> `MADV_HUGEPAGE` -> regular pages.
+/// The arena must not be moved after creation if `arena_da_config` or `arena_allocator` is used, as they point to it.
+Arena arena_new(usize cap, ArenaPages pages);
+
+void arena_free(Arena *arena);
+
+/// Returns NULL if the arena is full.
+void *arena_alloc(Arena *arena, usize size, usize align);
+
+/// Forget every allocation, keeping the mapping.
+void arena_reset(Arena *arena);
+
+/// Allocations are bumped, frees are no-ops, reallocating the most recent allocation grows it in place.
+Allocator arena_allocator(Arena *arena);
+
+/// Cache line aligned, exact-sized arrays in `arena`, e.g. for `nn_new_in`.
+const DaConfig *arena_da_config(Arena *arena);
+
+const char *arena_pages_name(ArenaPages pages);
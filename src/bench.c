@@ -0,0 +1,647 @@
+#include "common.h"
+#include "nn.h"
+#include "arena.h"
+#include "parallel.h"
+#include "perf_counters.h"
+#include "numa.h"
+#include "graph.h"
+#include "conv.h"
+#include "train.h"
+#include "sweep.h"
+#include "rnn.h"
+#include "embedding.h"
+#include "infer_cache.h"
+
+/// Where the parameter pool and training scratch of a benchmark run live.
+typedef enum PoolPlacement {
+  POOL_HEAP,
+  POOL_ARENA_NORMAL,
+  POOL_ARENA_THP,
+  POOL_ARENA_HUGETLB,
+} PoolPlacement;
+
+static const char *pool_placement_name(PoolPlacement placement) {
+  switch (placement) {
+  case POOL_HEAP:
+    return "heap";
+  case POOL_ARENA_NORMAL:
+    return "arena(normal)";
+  case POOL_ARENA_THP:
+    return "arena(THP)";
+  case POOL_ARENA_HUGETLB:
+    return "arena(hugetlb)";
+  }
+  __builtin_unreachable();
+}
+
+static void print_sample(const char *workload, const char *placement, const char *pages, usize iters,
+                         PerfSample sample) {
+  printf("%-8s %-18s %-8s %9.3fms/iter", workload, placement, pages, sample.seconds * 1e3 / (f64)iters);
+  for (usize e = 0; e < PERF_EVENT_COUNT_; ++e) {
+    if (sample.values[e] == PERF_COUNTER_UNAVAILABLE)
+      printf("  %s=n/a", perf_event_name((PerfEvent)e));
+    else
+      printf("  %s=%.0f/iter", perf_event_name((PerfEvent)e), (f64)sample.values[e] / (f64)iters);
+  }
+  printf("\n");
+}
+
+/// Deep and wide enough that the weights span far more pages than the dTLB covers.
+static usize layers[] = {1024, 2048, 2048, 2048, 1024};
+
+static void bench_placement(PoolPlacement placement, PerfCounters *counters, usize forward_iters, usize train_iters,
+                            usize batch) {
+  usize params = 0;
+  usize widest = 0;
+  for (usize i = 1; i < ARR_LEN(layers); ++i) {
+    params += layers[i - 1] * layers[i] + 2 * layers[i];
+    widest = max(widest, layers[i]);
+  }
+  // Parameters, gradients and activations, with plenty of slack.
+  usize arena_bytes = sizeof(f32) * (2 * params + (ARR_LEN(layers) + 4) * widest * batch) + (16 << 20);
+
+  Arena arena = {0};
+  const DaConfig *config = &DA_CONFIG_CACHE_ALIGNED;
+  const char *pages = "-";
+  if (placement != POOL_HEAP) {
+    ArenaPages requested = placement == POOL_ARENA_NORMAL ? ARENA_PAGES_NORMAL
+                           : placement == POOL_ARENA_THP  ? ARENA_PAGES_TRANSPARENT_HUGE
+                                                          : ARENA_PAGES_HUGETLB;
+    arena = arena_new(arena_bytes, requested);
+    config = arena_da_config(&arena);
+    pages = arena_pages_name(arena.pages);
+  }
+
+  NN nn = nn_new_in(layers, ARR_LEN(layers), config);
+  nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+
+  const usize stride = nn_input_count(nn) + nn_output_count(nn);
+  f32 *data = xalloc(f32, stride * batch);
+  rng_fill_uniform((Rng){.seed = 2, .stream = 0}, data, 0, stride * batch, 0, 1);
+
+  // Warm up, so that page faults aren't counted.
+  nn_forward(nn, data);
+  perf_counters_start(counters);
+  for (usize i = 0; i < forward_iters; ++i)
+    nn_forward(nn, &data[(i % batch) * stride]);
+  print_sample("forward", pool_placement_name(placement), pages, forward_iters, perf_counters_stop(counters));
+
+  TrainingContext ctx = training_context_new(nn, LOSS_MSE, batch, 0);
+  nn_train(&nn, &ctx, data, stride * batch, 1e-3);
+  perf_counters_start(counters);
+  for (usize i = 0; i < train_iters; ++i)
+    nn_train(&nn, &ctx, data, stride * batch, 1e-3);
+  print_sample("train", pool_placement_name(placement), pages, train_iters, perf_counters_stop(counters));
+
+  training_context_free(ctx);
+  xfree(data);
+  nn_free(nn);
+  if (placement != POOL_HEAP)
+    arena_free(&arena);
+}
+
+static void bench_numa_config(const char *name, NN nn, NumaOptions options, PerfCounters *counters, const f32 *inputs,
+                              usize n, f32 *outputs, usize iters) {
+  NumaInference *inference = numa_inference_new(nn, options);
+  numa_inference_forward(inference, inputs, n, outputs);
+  perf_counters_start(counters);
+  for (usize i = 0; i < iters; ++i)
+    numa_inference_forward(inference, inputs, n, outputs);
+  PerfSample sample = perf_counters_stop(counters);
+  char pages[32];
+  snprintf(pages, sizeof(pages), "%zut/%zun", inference->worker_count, inference->topology.node_count);
+  print_sample("numa", name, pages, iters * n, sample);
+  numa_inference_free(inference);
+}
+
+/// Throughput of single-sample inference over every CPU, with the weights in one allocation versus one replica per
+/// NUMA node. Per-iteration numbers are per request.
+static void bench_numa(PerfCounters *counters, usize iters) {
+  static usize numa_layers[] = {1024, 2048, 2048, 1024};
+  NN nn = nn_new(numa_layers, ARR_LEN(numa_layers));
+  nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+  const usize n = 16 * cpu_count();
+  f32 *inputs = xalloc(f32, n * nn_input_count(nn));
+  f32 *outputs = xalloc(f32, n * nn_output_count(nn));
+  rng_fill_uniform((Rng){.seed = 3, .stream = 0}, inputs, 0, n * nn_input_count(nn), 0, 1);
+
+  bench_numa_config("shared", nn, (NumaOptions){.pin = false, .replicate = false}, counters, inputs, n, outputs, iters);
+  bench_numa_config("shared+pinned", nn, (NumaOptions){.pin = true, .replicate = false}, counters, inputs, n, outputs,
+                    iters);
+  bench_numa_config("replicated+pinned", nn, (NumaOptions){.pin = true, .replicate = true}, counters, inputs, n,
+                    outputs, iters);
+
+  xfree(inputs);
+  xfree(outputs);
+  nn_free(nn);
+}
+
+/// Single-sample forward through a deep, narrow network, with one activation buffer per layer versus two shared ones.
+static void bench_activations(PerfCounters *counters, usize iters) {
+  usize deep_layers[65];
+  for (usize i = 0; i < ARR_LEN(deep_layers); ++i)
+    deep_layers[i] = 256;
+  f32 input[256];
+  rng_fill_uniform((Rng){.seed = 5, .stream = 0}, input, 0, ARR_LEN(input), 0, 1);
+  const NNActivations layouts[] = {NN_ACTIVATIONS_PER_LAYER, NN_ACTIVATIONS_PING_PONG};
+  const char *names[] = {"per-layer", "ping-pong"};
+  for (usize i = 0; i < ARR_LEN(layouts); ++i) {
+    NN nn = nn_new_with(deep_layers, ARR_LEN(deep_layers), &DA_CONFIG_CACHE_ALIGNED,
+                        (NNOptions){.activations = layouts[i]});
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+    usize activation_floats = nn.pool.da_len;
+    for (usize l = 0; l < nn_layer_count(nn); ++l)
+      activation_floats -= da_get(&nn.ws, l)->rows * da_get(&nn.ws, l)->cols + da_get(&nn.bs, l)->rows;
+    char pages[32];
+    snprintf(pages, sizeof(pages), "%zuKiB", activation_floats * sizeof(f32) / 1024);
+    nn_forward(nn, input);
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      nn_forward(nn, input);
+    print_sample("forward", names[i], pages, iters, perf_counters_stop(counters));
+    nn_free(nn);
+  }
+}
+
+/// Batched forward through a residual MLP built as a `Graph`, and how much activation memory the plan saves over
+/// giving every tensor its own buffer.
+static void bench_graph(PerfCounters *counters, usize iters) {
+  const usize width = 1024;
+  const usize blocks = 8;
+  const usize batch = 64;
+  Graph graph = graph_new();
+  GraphTensor x = graph_input(&graph, width);
+  GraphTensor h = x;
+  for (usize i = 0; i < blocks; ++i) {
+    GraphTensor a = graph_activation(&graph, graph_dense(&graph, h, width), ACTIVATION_SIGMOID);
+    h = graph_add(&graph, graph_dropout(&graph, a, 0.1f), h);
+  }
+  h = graph_activation(&graph, graph_dense(&graph, graph_concat(&graph, h, x), width), ACTIVATION_SOFTMAX);
+  graph_init_weights(&graph, WEIGHT_INIT_XAVIER_UNIFORM, 1);
+  graph_plan(&graph, h, batch);
+
+  f32 *input = xalloc(f32, width * batch);
+  rng_fill_uniform((Rng){.seed = 4, .stream = 0}, input, 0, width * batch, 0, 1);
+  const f32 *const inputs[] = {input};
+  graph_forward(&graph, inputs, batch);
+  perf_counters_start(counters);
+  for (usize i = 0; i < iters; ++i)
+    graph_forward(&graph, inputs, batch);
+  print_sample("graph", "residual", "-", iters, perf_counters_stop(counters));
+  printf("graph    %zu ops, activations %.2fMiB planned vs. %.2fMiB unplanned\n", graph.plan.order_len,
+         (f64)graph.plan.activation_floats * sizeof(f32) / (1 << 20),
+         (f64)graph.plan.unplanned_floats * sizeof(f32) / (1 << 20));
+  xfree(input);
+  graph_free(graph);
+}
+
+/// Forward and backward of a 3x3 convolution with both algorithms, against the dense layer mapping the same image to an
+/// output of the same size.
+static void bench_conv(PerfCounters *counters, usize iters) {
+  const Conv2d conv = {
+      .in_channels = 8,
+      .in_height = 16,
+      .in_width = 16,
+      .out_channels = 8,
+      .kernel = 3,
+      .stride = 1,
+      .padding = 1,
+  };
+  const usize n = 8;
+  const usize in_len = conv2d_in_len(conv);
+  const usize out_len = conv2d_out_len(conv);
+  // Weights of both the convolution and the dense layer, then their gradients.
+  const usize dense_len = in_len * out_len + out_len;
+  f32 *params = xalloc(f32, 2 * dense_len);
+  f32 *x = xalloc(f32, n * in_len);
+  f32 *y = xalloc(f32, n * out_len);
+  f32 *dx = xalloc(f32, n * in_len);
+  f32 *scratch = xalloc(f32, conv2d_scratch_len(conv, CONV2D_IM2COL));
+  rng_fill_uniform((Rng){.seed = 6, .stream = 0}, params, 0, 2 * dense_len, -0.1f, 0.1f);
+  rng_fill_uniform((Rng){.seed = 6, .stream = 1}, x, 0, n * in_len, 0, 1);
+
+  ConstMat w = {.values = params, .cols = conv.in_channels * 9, .rows = conv.out_channels};
+  ConstMat b = {.values = &params[conv2d_weight_len(conv)], .cols = 1, .rows = conv.out_channels};
+  Mat dw = {.values = &params[dense_len], .cols = w.cols, .rows = w.rows};
+  Mat db = {.values = &params[dense_len + conv2d_weight_len(conv)], .cols = 1, .rows = b.rows};
+  const Conv2dAlgo algos[] = {CONV2D_IM2COL, CONV2D_DIRECT_3X3};
+  const char *names[] = {"im2col", "direct3x3"};
+  for (usize i = 0; i < ARR_LEN(algos); ++i) {
+    conv2d_forward(conv, algos[i], w, b, x, y, n, scratch);
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      conv2d_forward(conv, algos[i], w, b, x, y, n, scratch);
+    print_sample("conv-fwd", names[i], "-", iters, perf_counters_stop(counters));
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      conv2d_backward(conv, algos[i], w, x, y, dx, dw, db, n, scratch);
+    print_sample("conv-bwd", names[i], "-", iters, perf_counters_stop(counters));
+  }
+
+  // The dense layer takes one sample per column.
+  Mat dense_w = {.values = params, .cols = in_len, .rows = out_len};
+  Mat dense_b = {.values = &params[in_len * out_len], .cols = 1, .rows = out_len};
+  Mat dense_dw = {.values = &params[dense_len], .cols = in_len, .rows = out_len};
+  ConstMat dense_x = {.values = x, .cols = n, .rows = in_len};
+  Mat dense_y = {.values = y, .cols = n, .rows = out_len};
+  Mat dense_dx = {.values = dx, .cols = n, .rows = in_len};
+  perf_counters_start(counters);
+  for (usize j = 0; j < iters; ++j) {
+    mat_mul(dense_y, mat_as_const(dense_w), dense_x);
+    mat_add_col(dense_y, mat_as_const(dense_b));
+  }
+  print_sample("conv-fwd", "dense", "-", iters, perf_counters_stop(counters));
+  perf_counters_start(counters);
+  for (usize j = 0; j < iters; ++j) {
+    mat_mul_add_rhs_t(dense_dw, mat_as_const(dense_y), dense_x);
+    mat_mul_lhs_t(dense_dx, mat_as_const(dense_w), mat_as_const(dense_y));
+  }
+  print_sample("conv-bwd", "dense", "-", iters, perf_counters_stop(counters));
+
+  xfree(params);
+  xfree(x);
+  xfree(y);
+  xfree(dx);
+  xfree(scratch);
+}
+
+/// Single-sample forward and batched training per `NNPoolLayout`, on a network small enough to stay in cache (where
+/// activations sharing lines with parameters would show) and one that streams its weights from memory.
+/// Layer sizes aren't multiples of 16, so unpadded matrices start mid cache line.
+static void bench_layout(PerfCounters *counters, usize iters) {
+  static usize small_layers[] = {50, 100, 100, 100, 100, 10};
+  static usize large_layers[] = {1000, 1500, 1500, 10};
+  struct {
+    const char *name;
+    usize *layers;
+    usize layers_count;
+    usize forward_iters;
+    usize train_iters;
+  } networks[] = {
+      {"small", small_layers, ARR_LEN(small_layers), 20000 * iters, 200 * iters},
+      {"large", large_layers, ARR_LEN(large_layers), 50 * iters, iters},
+  };
+  const NNPoolLayout layouts[] = {NN_POOL_INTERLEAVED, NN_POOL_SEPARATE, NN_POOL_SEPARATE_PADDED};
+  const char *names[] = {"interleaved", "separate", "separate+padded"};
+  const usize batch = 64;
+  for (usize n = 0; n < ARR_LEN(networks); ++n) {
+    for (usize i = 0; i < ARR_LEN(layouts); ++i) {
+      NN nn = nn_new_with(networks[n].layers, networks[n].layers_count, &DA_CONFIG_CACHE_ALIGNED,
+                          (NNOptions){.pool_layout = layouts[i]});
+      nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+      usize stride = nn_input_count(nn) + nn_output_count(nn);
+      f32 *data = xalloc(f32, stride * batch);
+      rng_fill_uniform((Rng){.seed = 6, .stream = 0}, data, 0, stride * batch, 0, 1);
+
+      nn_forward(nn, data);
+      perf_counters_start(counters);
+      for (usize j = 0; j < networks[n].forward_iters; ++j)
+        nn_forward(nn, &data[(j % batch) * stride]);
+      print_sample("forward", names[i], networks[n].name, networks[n].forward_iters, perf_counters_stop(counters));
+
+      TrainingContext ctx = training_context_new(nn, LOSS_MSE, batch, 0);
+      nn_train(&nn, &ctx, data, stride * batch, 1e-3);
+      perf_counters_start(counters);
+      for (usize j = 0; j < networks[n].train_iters; ++j)
+        nn_train(&nn, &ctx, data, stride * batch, 1e-3);
+      print_sample("train", names[i], networks[n].name, networks[n].train_iters, perf_counters_stop(counters));
+
+      training_context_free(ctx);
+      xfree(data);
+      nn_free(nn);
+    }
+  }
+}
+
+/// Validation loss against wall clock, training on a wide input with ~1% non-zero features: synchronous full-batch
+/// rounds through `nn_train` versus Hogwild with one thread per CPU (and one thread, i.e. plain minibatch SGD).
+/// One sync round and one Hogwild epoch both go over the training set once.
+static void bench_hogwild(usize epochs) {
+  const usize inputs = 2000;
+  const usize nonzero = 20;
+  const usize n = 4096;
+  const usize n_validation = 1024;
+  const usize stride = inputs + 1;
+  usize layers[] = {inputs, 32, 1};
+  // Targets come from a random linear teacher over the sparse features.
+  f32 *teacher = xalloc(f32, inputs);
+  rng_fill_normal((Rng){.seed = 7, .stream = 0}, teacher, 0, inputs, 0, 1);
+  f32 *data = xalloc(f32, (n + n_validation) * stride);
+  memset(data, 0, (n + n_validation) * stride * sizeof(f32));
+  Rng rng = {.seed = 7, .stream = 1};
+  for (usize s = 0; s < n + n_validation; ++s) {
+    f32 *sample = &data[s * stride];
+    f32 z = 0;
+    for (usize k = 0; k < nonzero; ++k) {
+      usize j = min((usize)(rng_f32_at(rng, s * nonzero + k) * (f32)inputs), inputs - 1);
+      sample[j] = 1;
+      z += teacher[j];
+    }
+    sample[inputs] = 1 / (1 + expf(-z / sqrtf((f32)nonzero)));
+  }
+  const f32 *validation = &data[n * stride];
+
+  struct {
+    const char *name;
+    usize n_threads;
+  } modes[] = {{"sync", 0}, {"hogwild-1t", 1}, {"hogwild", cpu_count()}};
+  // With a single CPU the last mode is the same as the one before.
+  usize n_modes = cpu_count() > 1 ? ARR_LEN(modes) : ARR_LEN(modes) - 1;
+  for (usize m = 0; m < n_modes; ++m) {
+    NN nn = nn_new(layers, ARR_LEN(layers));
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+    TrainingContext ctx = training_context_new(nn, LOSS_MSE, 256, 0);
+    char name[32];
+    if (m == ARR_LEN(modes) - 1)
+      snprintf(name, sizeof(name), "%s-%zut", modes[m].name, modes[m].n_threads);
+    else
+      snprintf(name, sizeof(name), "%s", modes[m].name);
+    f64 seconds = 0;
+    for (usize epoch = 0; epoch < epochs; ++epoch) {
+      f64 start = now_seconds();
+      if (modes[m].n_threads == 0)
+        nn_train(&nn, &ctx, data, n * stride, 1);
+      else
+        nn_train_hogwild(&nn, LOSS_MSE, data, n * stride,
+                         (HogwildConfig){
+                             .n_threads = modes[m].n_threads,
+                             .batch = 16,
+                             .rate = 0.5f,
+                             .epochs = 1,
+                             .seed = epoch,
+                         });
+      seconds += now_seconds() - start;
+      printf("%-8s %-18s epoch %-3zu %9.3fs  validation loss: %.06f\n", "converge", name, epoch + 1, seconds,
+             nn_evaluate(nn, &ctx, validation, n_validation * stride));
+    }
+    training_context_free(ctx);
+    nn_free(nn);
+  }
+  xfree(teacher);
+  xfree(data);
+}
+
+/// A learning-rate sweep over 256 models of the same topology: one `Sweep` versus one `nn_train` loop per model, and a
+/// single model for scale.
+static void bench_sweep(PerfCounters *counters, usize rounds) {
+  static usize tiny_layers[] = {1, 1};
+  static usize small_layers[] = {4, 16, 1};
+  struct {
+    const char *name;
+    usize *layers;
+    usize layers_count;
+  } networks[] = {{"{1,1}", tiny_layers, ARR_LEN(tiny_layers)}, {"{4,16,1}", small_layers, ARR_LEN(small_layers)}};
+  const usize models = 256;
+  const usize n = 16;
+  for (usize i = 0; i < ARR_LEN(networks); ++i) {
+    usize *layers = networks[i].layers;
+    usize layers_count = networks[i].layers_count;
+    usize stride = layers[0] + layers[layers_count - 1];
+    f32 *data = xalloc(f32, n * stride);
+    rng_fill_uniform((Rng){.seed = 8, .stream = 0}, data, 0, n * stride, 0, 1);
+    u64 *seeds = xalloc(u64, models);
+    for (usize k = 0; k < models; ++k)
+      seeds[k] = k;
+
+    for (usize count = 1; count <= models; count += models - 1) {
+      perf_counters_start(counters);
+      for (usize k = 0; k < count; ++k) {
+        NN nn = nn_new(layers, layers_count);
+        nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, seeds[k], 1);
+        TrainingContext ctx = training_context_new(nn, LOSS_MSE, n, 0);
+        for (usize r = 0; r < rounds; ++r)
+          nn_train(&nn, &ctx, data, n * stride, (f32)(k + 1) / (f32)models);
+        training_context_free(ctx);
+        nn_free(nn);
+      }
+      char name[32];
+      snprintf(name, sizeof(name), "nn_train x%zu", count);
+      print_sample("sweep", name, networks[i].name, rounds, perf_counters_stop(counters));
+    }
+
+    perf_counters_start(counters);
+    Sweep sweep = sweep_new(layers, layers_count, models, LOSS_MSE);
+    sweep_init_weights(&sweep, WEIGHT_INIT_XAVIER_UNIFORM, seeds);
+    for (usize k = 0; k < models; ++k)
+      sweep.rates[k] = (f32)(k + 1) / (f32)models;
+    for (usize r = 0; r < rounds; ++r)
+      sweep_train(&sweep, data, n * stride, NULL);
+    sweep_free(sweep);
+    char name[32];
+    snprintf(name, sizeof(name), "Sweep x%zu", models);
+    print_sample("sweep", name, networks[i].name, rounds, perf_counters_stop(counters));
+    xfree(seeds);
+    xfree(data);
+  }
+}
+
+/// Single-sample inference with normalized hidden layers, and with the batch norm folded into the weights.
+static void bench_norm(PerfCounters *counters, usize iters) {
+  usize norm_layers[] = {256, 512, 512, 512, 512, 512, 512, 10};
+  f32 input[256];
+  rng_fill_uniform((Rng){.seed = 7, .stream = 0}, input, 0, ARR_LEN(input), 0, 1);
+  const NNNorm norms[] = {NN_NORM_NONE, NN_NORM_LAYER, NN_NORM_BATCH};
+  const char *names[] = {"none", "layer norm", "batch norm"};
+  for (usize i = 0; i <= ARR_LEN(norms); ++i) {
+    NN nn = nn_new_with(norm_layers, ARR_LEN(norm_layers), &DA_CONFIG_CACHE_ALIGNED,
+                        (NNOptions){.norm = norms[min(i, ARR_LEN(norms) - 1)]});
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+    const char *name = i < ARR_LEN(norms) ? names[i] : "batch norm folded";
+    if (i == ARR_LEN(norms)) {
+      NN folded = nn_fold_batch_norm(nn, &DA_CONFIG_CACHE_ALIGNED);
+      nn_free(nn);
+      nn = folded;
+    }
+    nn_forward(nn, input);
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      nn_forward(nn, input);
+    print_sample("forward", name, "", iters, perf_counters_stop(counters));
+    nn_free(nn);
+  }
+}
+
+/// Time per timestep of a batch of sequences through an LSTM and a GRU, inference and truncated BPTT training.
+static void bench_rnn(PerfCounters *counters, usize iters) {
+  const usize inputs = 64, hidden = 256, outputs = 16, batch = 32, steps = 64, bptt = 16;
+  f32 *x = xalloc(f32, steps * inputs * batch);
+  f32 *y = xalloc(f32, steps * outputs * batch);
+  f32 *out = xalloc(f32, steps * outputs * batch);
+  rng_fill_uniform((Rng){.seed = 8, .stream = 0}, x, 0, steps * inputs * batch, -1, 1);
+  rng_fill_uniform((Rng){.seed = 8, .stream = 1}, y, 0, steps * outputs * batch, 0, 1);
+  const RnnCell cells[] = {RNN_LSTM, RNN_GRU};
+  const char *names[] = {"lstm", "gru"};
+  for (usize i = 0; i < ARR_LEN(cells); ++i) {
+    Rnn rnn = rnn_new(cells[i], inputs, hidden, outputs, LOSS_MSE);
+    rnn_init_weights(&rnn, 1);
+    RnnContext ctx = rnn_context_new(rnn, batch, bptt);
+    char shape[32];
+    snprintf(shape, sizeof(shape), "%zux%zu", hidden, batch);
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      rnn_forward(rnn, &ctx, x, out, steps);
+    print_sample("forward", names[i], shape, iters * steps, perf_counters_stop(counters));
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      rnn_train(&rnn, &ctx, x, y, steps, 0.1f);
+    print_sample("train", names[i], shape, iters * steps, perf_counters_stop(counters));
+    rnn_context_free(ctx);
+    rnn_free(rnn);
+  }
+  xfree(x);
+  xfree(y);
+  xfree(out);
+}
+
+/// Lookups and training steps on a table much larger than the caches: gathering with and without prefetching, and
+/// updating only the touched rows versus a dense gradient over the whole table.
+static void bench_embedding(PerfCounters *counters, usize iters) {
+  const usize rows = 1 << 21, dim = 32, fields = 8, batch = 256, steps = 16;
+  Embedding emb = embedding_new_in(rows, dim, &DA_CONFIG_CACHE_ALIGNED);
+  embedding_init_weights(&emb, 1);
+  usize layers[] = {fields * dim, 64, 1};
+  NN nn = nn_new(layers, ARR_LEN(layers));
+  nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+  const usize samples = batch * steps;
+  u32 *ids = xalloc(u32, samples * fields);
+  for (usize i = 0; i < samples * fields; ++i)
+    ids[i] = (u32)(rng_f32_at((Rng){.seed = 9, .stream = 0}, i) * (f32)rows) % rows;
+  f32 *targets = xalloc(f32, samples);
+  rng_fill_uniform((Rng){.seed = 9, .stream = 1}, targets, 0, samples, 0, 1);
+  f32 *dst = xalloc(f32, samples * fields * dim);
+  char shape[32];
+  snprintf(shape, sizeof(shape), "%zuMiB", rows * dim * sizeof(f32) >> 20);
+
+  perf_counters_start(counters);
+  for (usize j = 0; j < iters; ++j)
+    for (usize i = 0; i < samples * fields; ++i)
+      memcpy(&dst[i * dim], &emb.table.da_items[(usize)ids[i] * dim], dim * sizeof(f32));
+  print_sample("gather", "plain", shape, iters, perf_counters_stop(counters));
+  perf_counters_start(counters);
+  for (usize j = 0; j < iters; ++j)
+    embedding_gather(emb, ids, samples, fields, dst, fields * dim);
+  print_sample("gather", "prefetch", shape, iters, perf_counters_stop(counters));
+
+  TrainingContext ctx = training_context_new(nn, LOSS_MSE, batch, 0);
+  EmbeddingGrad grad = embedding_grad_new(emb, batch * fields);
+  perf_counters_start(counters);
+  for (usize j = 0; j < iters; ++j)
+    embedding_nn_train(&emb, &grad, &nn, &ctx, ids, fields, targets, samples, 0.01f);
+  print_sample("train", "sparse rows", shape, iters * steps, perf_counters_stop(counters));
+  // What a dense gradient costs on top of the same steps: zeroing a table-sized gradient and sweeping it into the
+  // table every step.
+  f32 *dense = xalloc(f32, rows * dim);
+  perf_counters_start(counters);
+  for (usize j = 0; j < iters * steps; ++j) {
+    memset(dense, 0, rows * dim * sizeof(f32));
+    for (usize i = 0; i < rows * dim; ++i)
+      emb.table.da_items[i] -= 0.01f * dense[i];
+  }
+  print_sample("train", "+dense table", shape, iters * steps, perf_counters_stop(counters));
+  xfree(dense);
+  embedding_grad_free(grad);
+  training_context_free(ctx);
+  xfree(dst);
+  xfree(targets);
+  xfree(ids);
+  nn_free(nn);
+  embedding_free(emb);
+}
+
+/// Single-sample inference on queries drawn from a pool of distinct inputs, Zipf-distributed like repeated production
+/// queries, and on queries that never repeat where the cache is pure overhead. Plain `nn_forward` versus through an
+/// `InferCache` with room for a quarter of the pool.
+static void bench_infer_cache(PerfCounters *counters, usize iters) {
+  usize cache_layers[] = {128, 512, 512, 10};
+  const usize inputs = cache_layers[0];
+  const usize distinct = 4096, queries = 4096;
+  NN nn = nn_new(cache_layers, ARR_LEN(cache_layers));
+  nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, cpu_count());
+  f32 *pool = xalloc(f32, distinct * inputs);
+  rng_fill_uniform((Rng){.seed = 10, .stream = 0}, pool, 0, distinct * inputs, -1, 1);
+  // Zipf(1) by inverse CDF.
+  f64 *cdf = xalloc(f64, distinct);
+  f64 total = 0;
+  for (usize k = 0; k < distinct; ++k)
+    cdf[k] = total += 1 / (f64)(k + 1);
+  usize *zipf = xalloc(usize, queries);
+  usize *unique = xalloc(usize, queries);
+  for (usize q = 0; q < queries; ++q) {
+    f64 u = rng_f32_at((Rng){.seed = 10, .stream = 1}, q) * total;
+    usize lo = 0, hi = distinct - 1;
+    while (lo < hi) {
+      usize mid = (lo + hi) / 2;
+      if (cdf[mid] < u)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    zipf[q] = lo;
+    unique[q] = q % distinct;
+  }
+  struct {
+    const char *name;
+    const usize *order;
+  } workloads[] = {{"zipf", zipf}, {"unique", unique}};
+  for (usize w = 0; w < ARR_LEN(workloads); ++w) {
+    const usize *order = workloads[w].order;
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      for (usize q = 0; q < queries; ++q)
+        nn_forward(nn, &pool[order[q] * inputs]);
+    print_sample("forward", "plain", workloads[w].name, iters * queries, perf_counters_stop(counters));
+    InferCache cache = infer_cache_new(inputs, cache_layers[ARR_LEN(cache_layers) - 1], distinct / 4);
+    perf_counters_start(counters);
+    for (usize j = 0; j < iters; ++j)
+      for (usize q = 0; q < queries; ++q)
+        nn_forward_cached(nn, &cache, &pool[order[q] * inputs]);
+    print_sample("forward", "cached", workloads[w].name, iters * queries, perf_counters_stop(counters));
+    InferCacheStats stats = cache.stats;
+    printf("%-8s %-18s %-8s hit rate %.1f%%, %.3fus/hit, %.3fus/miss, %" PRIu64 " evictions\n", "", "", "",
+           100 * infer_cache_hit_rate(stats), stats.hits > 0 ? stats.hit_seconds * 1e6 / (f64)stats.hits : 0,
+           stats.lookups > stats.hits ? stats.miss_seconds * 1e6 / (f64)(stats.lookups - stats.hits) : 0,
+           stats.evictions);
+    infer_cache_free(cache);
+  }
+  xfree(unique);
+  xfree(zipf);
+  xfree(cdf);
+  xfree(pool);
+  nn_free(nn);
+}
+
+/// Usage: bench [all|pool|numa|graph|activations|conv|layout|hogwild|sweep|norm|rnn|embedding|cache]
+/// [iteration scale, default 1]
+int main(int argc, char **argv) {
+  const char *which = argc > 1 ? argv[1] : "all";
+  usize scale = argc > 2 ? (usize)max(atoi(argv[2]), 1) : 1;
+  bool all = strcmp(which, "all") == 0;
+  PerfCounters counters = perf_counters_open();
+  if (all || strcmp(which, "pool") == 0)
+    for (PoolPlacement p = POOL_HEAP; p <= POOL_ARENA_HUGETLB; ++p)
+      bench_placement(p, &counters, 20 * scale, 2 * scale, 16);
+  if (all || strcmp(which, "numa") == 0)
+    bench_numa(&counters, 2 * scale);
+  if (all || strcmp(which, "graph") == 0)
+    bench_graph(&counters, 2 * scale);
+  if (all || strcmp(which, "activations") == 0)
+    bench_activations(&counters, 200 * scale);
+  if (all || strcmp(which, "conv") == 0)
+    bench_conv(&counters, 5 * scale);
+  if (all || strcmp(which, "layout") == 0)
+    bench_layout(&counters, scale);
+  if (all || strcmp(which, "hogwild") == 0)
+    bench_hogwild(8 * scale);
+  if (all || strcmp(which, "sweep") == 0)
+    bench_sweep(&counters, 1000 * scale);
+  if (all || strcmp(which, "norm") == 0)
+    bench_norm(&counters, 2000 * scale);
+  if (all || strcmp(which, "rnn") == 0)
+    bench_rnn(&counters, 4 * scale);
+  if (all || strcmp(which, "embedding") == 0)
+    bench_embedding(&counters, 4 * scale);
+  if (all || strcmp(which, "cache") == 0)
+    bench_infer_cache(&counters, 4 * scale);
+  perf_counters_close(&counters);
+  return 0;
+}
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC 0x4B434C4Du // "MLCK"
+#define CHECKPOINT_VERSION 3u
+
+/// File layout, all in native byte order:
+/// u32 magic, u32 version, u64 step, u64 layers_count, u64 layers[layers_count], u32 output_activation,
+/// u32 activations, u32 pool_layout, u32 norm, u64 pool_len, f32 pool[pool_len].
+typedef struct CheckpointHeader {
+  u32 magic;
+  u32 version;
+  u64 step;
+  u64 layers_count;
+} CheckpointHeader;
+
+static char *str_dup(const char *s) {
+  usize len = strlen(s) + 1;
+  char *copy = xalloc(char, len);
+  memcpy(copy, s, len);
+  return copy;
+}
+
+static bool write_all(int fd, const void *p, usize len) {
+  const u8 *bytes = p;
+  while (len > 0) {
+    ssize_t n = write(fd, bytes, len);
+    if (n < 0)
+      return false;
+    bytes += n;
+    len -= (usize)n;
+  }
+  return true;
+}
+
+/// fsync the directory containing `path`, so that a rename into it is durable.
+static bool fsync_parent_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir = slash == NULL ? str_dup(".") : str_dup(path);
+  if (slash != NULL)
+    dir[slash == path ? 1 : slash - path] = '\0';
+  int fd = open(dir, O_RDONLY);
+  xfree(dir);
+  if (fd < 0)
+    return false;
+  bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+static bool checkpoint_write(CheckpointWriter *writer, const f32 *pool, u64 step) {
+  CheckpointHeader header = {
+      .magic = CHECKPOINT_MAGIC,
+      .version = CHECKPOINT_VERSION,
+      .step = step,
+      .layers_count = writer->layers_count,
+  };
+  u32 output_activation = writer->output_activation;
+  u32 activations = writer->options.activations;
+  u32 pool_layout = writer->options.pool_layout;
+  u32 norm = writer->options.norm;
+  u64 pool_len = writer->pool_len;
+  int fd = open(writer->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0 && write_all(fd, &header, sizeof(header));
+  for (usize i = 0; ok && i < writer->layers_count; ++i) {
+    u64 layer = writer->layers[i];
+    ok = write_all(fd, &layer, sizeof(layer));
+  }
+  ok = ok && write_all(fd, &output_activation, sizeof(output_activation));
+  ok = ok && write_all(fd, &activations, sizeof(activations));
+  ok = ok && write_all(fd, &pool_layout, sizeof(pool_layout));
+  ok = ok && write_all(fd, &norm, sizeof(norm));
+  ok = ok && write_all(fd, &pool_len, sizeof(pool_len));
+  ok = ok && write_all(fd, pool, writer->pool_len * sizeof(f32));
+  ok = ok && fsync(fd) == 0;
+  ok = (fd < 0 || close(fd) == 0) && ok;
+  ok = ok && rename(writer->tmp_path, writer->path) == 0;
+  ok = ok && fsync_parent_dir(writer->path);
+  if (!ok)
+    printf("checkpoint: writing step %llu to %s failed: %s\n", (unsigned long long)step, writer->path,
+           strerror(errno));
+  return ok;
+}
+
+static void *checkpoint_writer_main(void *writer_) {
+  CheckpointWriter *writer = writer_;
+  pthread_mutex_lock(&writer->mutex);
+  for (;;) {
+    while (writer->pending < 0 && !writer->quit)
+      pthread_cond_wait(&writer->cond, &writer->mutex);
+    if (writer->pending < 0)
+      break;
+    i32 i = writer->pending;
+    writer->writing = i;
+    writer->pending = -1;
+    pthread_mutex_unlock(&writer->mutex);
+    bool ok = checkpoint_write(writer, writer->buffers[i], writer->steps[i]);
+    pthread_mutex_lock(&writer->mutex);
+    writer->writing = -1;
+    if (ok)
+      ++writer->written;
+    else
+      ++writer->failed;
+    pthread_cond_broadcast(&writer->cond);
+  }
+  pthread_mutex_unlock(&writer->mutex);
+  return NULL;
+}
+
+CheckpointWriter *checkpoint_writer_new(NN nn, const char *path) {
+  CheckpointWriter *writer = xalloc(CheckpointWriter, 1);
+  *writer = (CheckpointWriter){
+      .path = str_dup(path),
+      .tmp_path = xalloc(char, strlen(path) + 5),
+      .layers_count = nn_layer_count(nn) + 1,
+      .output_activation = nn.output_activation,
+      .options = nn_options(nn),
+      .pool_len = nn.pool.da_len,
+      .pending = -1,
+      .writing = -1,
+  };
+  sprintf(writer->tmp_path, "%s.tmp", path);
+  writer->layers = xalloc(usize, writer->layers_count);
+  writer->layers[0] = nn_input_count(nn);
+  for (usize l = 0; l < nn_layer_count(nn); ++l)
+    writer->layers[l + 1] = nn_neuron_count_in_layer(nn, l);
+  for (usize i = 0; i < 2; ++i)
+    writer->buffers[i] = xalloc(f32, writer->pool_len);
+  pthread_mutex_init(&writer->mutex, NULL);
+  pthread_cond_init(&writer->cond, NULL);
+  ASSERT(pthread_create(&writer->thread, NULL, checkpoint_writer_main, writer) == 0);
+  return writer;
+}
+
+void checkpoint_writer_submit(CheckpointWriter *writer, NN nn, u64 step) {
+  ASSERT_PRINTF(nn.pool.da_len == writer->pool_len, "checkpointing a network of a different topology\n");
+  pthread_mutex_lock(&writer->mutex);
+  // The thread only ever holds the buffer it's writing, the other one is free or holds a stale pending snapshot.
+  i32 i = writer->writing == 0 ? 1 : 0;
+  memcpy(writer->buffers[i], nn.pool.da_items, writer->pool_len * sizeof(f32));
+  writer->steps[i] = step;
+  writer->pending = i;
+  pthread_cond_broadcast(&writer->cond);
+  pthread_mutex_unlock(&writer->mutex);
+}
+
+bool checkpoint_writer_flush(CheckpointWriter *writer) {
+  pthread_mutex_lock(&writer->mutex);
+  while (writer->pending >= 0 || writer->writing >= 0)
+    pthread_cond_wait(&writer->cond, &writer->mutex);
+  bool ok = writer->failed == 0;
+  pthread_mutex_unlock(&writer->mutex);
+  return ok;
+}
+
+bool checkpoint_writer_free(CheckpointWriter *writer) {
+  bool ok = checkpoint_writer_flush(writer);
+  pthread_mutex_lock(&writer->mutex);
+  writer->quit = true;
+  pthread_cond_broadcast(&writer->cond);
+  pthread_mutex_unlock(&writer->mutex);
+  pthread_join(writer->thread, NULL);
+  pthread_mutex_destroy(&writer->mutex);
+  pthread_cond_destroy(&writer->cond);
+  xfree(writer->buffers[0]);
+  xfree(writer->buffers[1]);
+  xfree(writer->layers);
+  xfree(writer->path);
+  xfree(writer->tmp_path);
+  xfree(writer);
+  return ok;
+}
+
+NN checkpoint_load(const char *path, const DaConfig *pool_config, u64 *step) {
+  FILE *f = fopen(path, "rb");
+  ASSERT_PRINTF(f != NULL, "cannot open checkpoint %s: %s\n", path, strerror(errno));
+  CheckpointHeader header;
+  ASSERT_PRINTF(fread(&header, sizeof(header), 1, f) == 1 && header.magic == CHECKPOINT_MAGIC,
+                "%s is not a checkpoint\n", path);
+  ASSERT_PRINTF(header.version == CHECKPOINT_VERSION, "checkpoint %s has version %u, expected %u\n", path,
+                header.version, CHECKPOINT_VERSION);
+  ASSERT_PRINTF(header.layers_count > 1 && header.layers_count < (1 << 20), "checkpoint %s is malformed\n", path);
+  usize *layers = xalloc(usize, header.layers_count);
+  for (usize i = 0; i < header.layers_count; ++i) {
+    u64 layer;
+    ASSERT_PRINTF(fread(&layer, sizeof(layer), 1, f) == 1, "checkpoint %s is truncated\n", path);
+    layers[i] = layer;
+  }
+  u32 output_activation, activations, pool_layout, norm;
+  u64 pool_len;
+  ASSERT_PRINTF(fread(&output_activation, sizeof(output_activation), 1, f) == 1 &&
+                    fread(&activations, sizeof(activations), 1, f) == 1 &&
+                    fread(&pool_layout, sizeof(pool_layout), 1, f) == 1 && fread(&norm, sizeof(norm), 1, f) == 1 &&
+                    fread(&pool_len, sizeof(pool_len), 1, f) == 1,
+                "checkpoint %s is truncated\n", path);
+  ASSERT_PRINTF(output_activation <= ACTIVATION_SOFTMAX && activations <= NN_ACTIVATIONS_PING_PONG &&
+                    pool_layout <= NN_POOL_SEPARATE_PADDED && norm <= NN_NORM_LAYER,
+                "checkpoint %s is malformed\n", path);
+  NNOptions options = {
+      .activations = (NNActivations)activations,
+      .pool_layout = (NNPoolLayout)pool_layout,
+      .norm = (NNNorm)norm,
+  };
+  NN nn = nn_new_with(layers, header.layers_count, pool_config, options);
+  xfree(layers);
+  nn.output_activation = (Activation)output_activation;
+  ASSERT_PRINTF(pool_len == nn.pool.da_len, "checkpoint %s is malformed\n", path);
+  ASSERT_PRINTF(fread(nn.pool.da_items, sizeof(f32), pool_len, f) == pool_len, "checkpoint %s is truncated\n", path);
+  fclose(f);
+  if (step != NULL)
+    *step = header.step;
+  return nn;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+#include "nn.h"
+
+/// Writes snapshots of a network to disk on a background thread.
+///
+/// `checkpoint_writer_submit` copies `NN.pool` into whichever of the two snapshot buffers the thread isn't writing
+/// and returns, so the training thread pays one memcpy per checkpoint no matter how slow the disk is. If the thread is
+/// still busy with an older snapshot, a newer submission replaces a snapshot that hasn't been picked up yet, so the
+/// newest one always makes it to disk and the one in flight is never torn.
+///
+/// Every write goes to `<path>.tmp`, is fsynced, then renamed over `path`, so `path` is always either the previous
+/// checkpoint or the new one, never a partial file.
+typedef struct CheckpointWriter {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  char *path;
+  char *tmp_path;
+  /// Topology of the network, written with every snapshot. `layers` includes the input layer, like `nn_new`.
+  usize *layers;
+  usize layers_count;
+  Activation output_activation;
+  NNOptions options;
+  /// Two snapshots of `NN.pool`, `pool_len` floats each.
+  f32 *buffers[2];
+  usize pool_len;
+  /// Step each buffer was taken at.
+  u64 steps[2];
+  /// Index of the buffer waiting to be written, or -1.
+  i32 pending;
+  /// Index of the buffer being written, or -1.
+  i32 writing;
+  usize written;
+  usize failed;
+  bool quit;
+} CheckpointWriter;
+
+/// Only the topology of `nn` is kept, snapshots are taken from whatever network is passed to
+/// `checkpoint_writer_submit`, which must have the same topology.
+CheckpointWriter *checkpoint_writer_new(NN nn, const char *path);
+
+/// Snapshot `nn` (taken at training step `step`) and queue it for writing. Never waits for the disk.
+void checkpoint_writer_submit(CheckpointWriter *writer, NN nn, u64 step);
+
+/// Wait until every submitted snapshot is on disk.
+/// Returns false if any write failed since the writer was created.
+bool checkpoint_writer_flush(CheckpointWriter *writer);
+
+/// Flushes, then stops the thread.
+/// Returns false if any write failed.
+bool checkpoint_writer_free(CheckpointWriter *writer);
+
+/// Load a checkpoint written by a `CheckpointWriter`, with the pool allocated through `pool_config`.
+/// `step` (nullable) receives the step the snapshot was taken at.
+/// Panics if the file is missing or malformed.
+NN checkpoint_load(const char *path, const DaConfig *pool_config, u64 *step);
@@ -150,8 +150,33 @@ attribute(noinline) static inline void print_stacktrace() {
     exit(1);                                                                                                           \
   })
 
-attribute(always_inline) static inline void *xalloc_(usize len) {
-  void *p = malloc(len);
+/// Heap accounting, see `alloc_track.h`. Always available, but only called by the macros below (and so by `xalloc`,
+/// the `da_*` and `ada_*` macros and `HEAP_ALLOCATOR`) when built with `ALLOC_TRACKING`.
+void *alloc_track_malloc(usize len, const char *file, i32 line);
+void *alloc_track_memalign(usize align, usize len, const char *file, i32 line);
+void *alloc_track_realloc(void *p, usize len, const char *file, i32 line);
+void alloc_track_free(void *p);
+/// Call site of this thread's next allocations made without one (`file == NULL`), NULL to clear it.
+void alloc_track_set_site(const char *file, i32 line);
+
+#ifdef ALLOC_TRACKING
+#define site_malloc_(LEN, FILE, LINE) alloc_track_malloc((LEN), (FILE), (LINE))
+#define site_realloc_(P, LEN, FILE, LINE) alloc_track_realloc((P), (LEN), (FILE), (LINE))
+#define site_free(P) alloc_track_free(P)
+#define ALLOC_TRACK_SITE(FILE, LINE) alloc_track_set_site((FILE), (LINE))
+#else
+#define site_malloc_(LEN, FILE, LINE) ((void)(FILE), (void)(LINE), malloc(LEN))
+#define site_realloc_(P, LEN, FILE, LINE) ((void)(FILE), (void)(LINE), realloc((P), (LEN)))
+#define site_free(P) free(P)
+#define ALLOC_TRACK_SITE(FILE, LINE) ((void)(FILE), (void)(LINE))
+#endif
+
+/// `malloc` and `realloc` attributed to the line they are expanded at.
+#define site_malloc(LEN) site_malloc_((LEN), __FILE__, __LINE__)
+#define site_realloc(P, LEN) site_realloc_((P), (LEN), __FILE__, __LINE__)
+
+attribute(always_inline) static inline void *xalloc_(usize len, const char *file, i32 line) {
+  void *p = site_malloc_(len, file, line);
   if (unlikely(p == NULL)) {
     printf("malloc failed\n");
     exit(1);
@@ -159,9 +184,9 @@ attribute(always_inline) static inline void *xalloc_(usize len) {
   return p;
 }
 
-attribute(always_inline) static inline void *xrealloc_(void *p, usize len) {
+attribute(always_inline) static inline void *xrealloc_(void *p, usize len, const char *file, i32 line) {
   DEBUG_ASSERT(p != NULL);
-  p = realloc(p, len);
+  p = site_realloc_(p, len, file, line);
   ASSERT(p != NULL);
   if (unlikely(p == NULL)) {
     printf("realloc failed\n");
@@ -171,9 +196,9 @@ attribute(always_inline) static inline void *xrealloc_(void *p, usize len) {
 }
 
 attribute(always_inline) static inline void xfree(void *p) {
-  free(p);
+  site_free(p);
 }
 
-#define xalloc(TY, COUNT) ((TY *)xalloc_(sizeof(TY) * (COUNT)))
-#define xrealloc(P, TY, COUNT) ((TY *)xrealloc_((P), sizeof(TY) * (COUNT)))
+#define xalloc(TY, COUNT) ((TY *)xalloc_(sizeof(TY) * (COUNT), __FILE__, __LINE__))
+#define xrealloc(P, TY, COUNT) ((TY *)xrealloc_((P), sizeof(TY) * (COUNT), __FILE__, __LINE__))
 #define PUT_ON_HEAP(X) ((typeof(X) *)memcpy(xalloc(typeof(X), 1), REF_RVALUE(X), sizeof(X)))
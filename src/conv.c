@@ -0,0 +1,268 @@
+#include "conv.h"
+
+usize conv2d_out_height(Conv2d conv) {
+  return (conv.in_height + 2 * conv.padding - conv.kernel) / conv.stride + 1;
+}
+
+usize conv2d_out_width(Conv2d conv) {
+  return (conv.in_width + 2 * conv.padding - conv.kernel) / conv.stride + 1;
+}
+
+usize conv2d_in_len(Conv2d conv) {
+  return conv.in_channels * conv.in_height * conv.in_width;
+}
+
+usize conv2d_out_len(Conv2d conv) {
+  return conv.out_channels * conv2d_out_height(conv) * conv2d_out_width(conv);
+}
+
+usize conv2d_weight_len(Conv2d conv) {
+  return conv.out_channels * conv.in_channels * conv.kernel * conv.kernel;
+}
+
+Conv2dAlgo conv2d_select(Conv2d conv) {
+  // im2col copies every input element `kernel^2` times before the GEMM, which for 3x3 filters costs more than the
+  // direct kernel saves by not being a GEMM.
+  if (conv.kernel == 3 && conv.stride == 1)
+    return CONV2D_DIRECT_3X3;
+  return CONV2D_IM2COL;
+}
+
+usize conv2d_scratch_len(Conv2d conv, Conv2dAlgo algo) {
+  if (algo == CONV2D_AUTO)
+    algo = conv2d_select(conv);
+  if (algo == CONV2D_DIRECT_3X3)
+    return 0;
+  return conv.in_channels * conv.kernel * conv.kernel * conv2d_out_height(conv) * conv2d_out_width(conv);
+}
+
+static void conv2d_check(Conv2d conv, Conv2dAlgo algo, ConstMat w) {
+  ASSERT(conv.kernel > 0 && conv.stride > 0);
+  ASSERT_PRINTF(conv.in_height + 2 * conv.padding >= conv.kernel && conv.in_width + 2 * conv.padding >= conv.kernel,
+                "%zux%zu kernel on a %zux%zu input with %zu padding\n", conv.kernel, conv.kernel, conv.in_height,
+                conv.in_width, conv.padding);
+  ASSERT(algo != CONV2D_DIRECT_3X3 || (conv.kernel == 3 && conv.stride == 1));
+  ASSERT(w.rows == conv.out_channels);
+  ASSERT(w.cols == conv.in_channels * conv.kernel * conv.kernel);
+}
+
+/// Output columns `ox` whose input column `ox * stride + kx - padding` is inside the image, `lo..hi`.
+static void conv2d_valid_cols(Conv2d conv, usize kx, usize *lo, usize *hi) {
+  const usize ow = conv2d_out_width(conv);
+  // ox * stride >= padding - kx
+  *lo = conv.padding > kx ? (conv.padding - kx + conv.stride - 1) / conv.stride : 0;
+  // ox * stride < in_width + padding - kx
+  *hi = conv.in_width + conv.padding > kx ? min((conv.in_width + conv.padding - kx + conv.stride - 1) / conv.stride, ow)
+                                          : 0;
+  *lo = min(*lo, *hi);
+}
+
+/// Unfold `x` (one image) into `col`, a `(in_channels * kernel * kernel x out_height * out_width)` matrix whose
+/// column `p` is the input patch under output pixel `p`.
+static void im2col(Conv2d conv, const f32 *x, f32 *col) {
+  const usize k = conv.kernel;
+  const usize oh = conv2d_out_height(conv);
+  const usize ow = conv2d_out_width(conv);
+  for (usize c = 0; c < conv.in_channels; ++c) {
+    const f32 *plane = &x[c * conv.in_height * conv.in_width];
+    for (usize ky = 0; ky < k; ++ky) {
+      for (usize kx = 0; kx < k; ++kx) {
+        f32 *row = &col[((c * k + ky) * k + kx) * oh * ow];
+        usize lo, hi;
+        conv2d_valid_cols(conv, kx, &lo, &hi);
+        for (usize oy = 0; oy < oh; ++oy) {
+          f32 *dst = &row[oy * ow];
+          isize iy = (isize)(oy * conv.stride + ky) - (isize)conv.padding;
+          if (iy < 0 || iy >= (isize)conv.in_height) {
+            memset(dst, 0, ow * sizeof(f32));
+            continue;
+          }
+          const f32 *src = &plane[(usize)iy * conv.in_width];
+          for (usize ox = 0; ox < lo; ++ox)
+            dst[ox] = 0;
+          for (usize ox = lo; ox < hi; ++ox)
+            dst[ox] = src[ox * conv.stride + kx - conv.padding];
+          for (usize ox = hi; ox < ow; ++ox)
+            dst[ox] = 0;
+        }
+      }
+    }
+  }
+}
+
+/// Adjoint of `im2col`: add every element of `col` back onto the input pixel it was copied from.
+static void col2im_add(Conv2d conv, const f32 *col, f32 *dx) {
+  const usize k = conv.kernel;
+  const usize oh = conv2d_out_height(conv);
+  const usize ow = conv2d_out_width(conv);
+  for (usize c = 0; c < conv.in_channels; ++c) {
+    f32 *plane = &dx[c * conv.in_height * conv.in_width];
+    for (usize ky = 0; ky < k; ++ky) {
+      for (usize kx = 0; kx < k; ++kx) {
+        const f32 *row = &col[((c * k + ky) * k + kx) * oh * ow];
+        usize lo, hi;
+        conv2d_valid_cols(conv, kx, &lo, &hi);
+        for (usize oy = 0; oy < oh; ++oy) {
+          isize iy = (isize)(oy * conv.stride + ky) - (isize)conv.padding;
+          if (iy < 0 || iy >= (isize)conv.in_height)
+            continue;
+          f32 *dst = &plane[(usize)iy * conv.in_width];
+          for (usize ox = lo; ox < hi; ++ox)
+            dst[ox * conv.stride + kx - conv.padding] += row[oy * ow + ox];
+        }
+      }
+    }
+  }
+}
+
+/// One image. For every output row, the 9 taps of every input channel are contiguous multiply-adds of a shifted input
+/// row into the output row, which stays in L1 and vectorizes without gathers.
+static void conv2d_direct_3x3_forward(Conv2d conv, ConstMat w, ConstMat b, const f32 *x, f32 *y) {
+  const usize oh = conv2d_out_height(conv);
+  const usize ow = conv2d_out_width(conv);
+  usize lo[3], hi[3];
+  for (usize kx = 0; kx < 3; ++kx)
+    conv2d_valid_cols(conv, kx, &lo[kx], &hi[kx]);
+  for (usize oc = 0; oc < conv.out_channels; ++oc) {
+    f32 *out = &y[oc * oh * ow];
+    for (usize i = 0; i < oh * ow; ++i)
+      out[i] = b.values[oc];
+    for (usize ic = 0; ic < conv.in_channels; ++ic) {
+      const f32 *in = &x[ic * conv.in_height * conv.in_width];
+      const f32 *f = &w.values[(oc * conv.in_channels + ic) * 9];
+      for (usize oy = 0; oy < oh; ++oy) {
+        f32 *dst = &out[oy * ow];
+        for (usize ky = 0; ky < 3; ++ky) {
+          isize iy = (isize)(oy + ky) - (isize)conv.padding;
+          if (iy < 0 || iy >= (isize)conv.in_height)
+            continue;
+          const f32 *src = &in[(usize)iy * conv.in_width];
+          for (usize kx = 0; kx < 3; ++kx) {
+            const f32 wv = f[ky * 3 + kx];
+            for (usize ox = lo[kx]; ox < hi[kx]; ++ox)
+              dst[ox] += wv * src[ox + kx - conv.padding];
+          }
+        }
+      }
+    }
+  }
+}
+
+/// Dot product in 8 independent lanes, so that it vectorizes without reassociating float adds behind the compiler's
+/// back.
+static f32 dot_f32(const f32 *a, const f32 *b, usize len) {
+  f32 lanes[8] = {0};
+  usize i = 0;
+  for (; i + 8 <= len; i += 8)
+    for (usize j = 0; j < 8; ++j)
+      lanes[j] += a[i + j] * b[i + j];
+  f32 sum = 0;
+  for (; i < len; ++i)
+    sum += a[i] * b[i];
+  for (usize j = 0; j < 8; ++j)
+    sum += lanes[j];
+  return sum;
+}
+
+/// One image, walking the same rows as `conv2d_direct_3x3_forward`: weight gradients are dot products of output
+/// gradient rows with shifted input rows, input gradients are the forward pass with the roles of `x` and `y` swapped.
+static void conv2d_direct_3x3_backward(Conv2d conv, ConstMat w, const f32 *x, const f32 *dy, f32 *dx, Mat dw,
+                                       Mat db) {
+  const usize oh = conv2d_out_height(conv);
+  const usize ow = conv2d_out_width(conv);
+  usize lo[3], hi[3];
+  for (usize kx = 0; kx < 3; ++kx)
+    conv2d_valid_cols(conv, kx, &lo[kx], &hi[kx]);
+  for (usize oc = 0; oc < conv.out_channels; ++oc) {
+    const f32 *grad = &dy[oc * oh * ow];
+    f32 sum = 0;
+    for (usize i = 0; i < oh * ow; ++i)
+      sum += grad[i];
+    db.values[oc] += sum;
+    for (usize ic = 0; ic < conv.in_channels; ++ic) {
+      const f32 *in = &x[ic * conv.in_height * conv.in_width];
+      f32 *in_grad = dx != NULL ? &dx[ic * conv.in_height * conv.in_width] : NULL;
+      const f32 *f = &w.values[(oc * conv.in_channels + ic) * 9];
+      f32 *df = &dw.values[(oc * conv.in_channels + ic) * 9];
+      for (usize oy = 0; oy < oh; ++oy) {
+        const f32 *g = &grad[oy * ow];
+        for (usize ky = 0; ky < 3; ++ky) {
+          isize iy = (isize)(oy + ky) - (isize)conv.padding;
+          if (iy < 0 || iy >= (isize)conv.in_height)
+            continue;
+          for (usize kx = 0; kx < 3; ++kx) {
+            // `lo` keeps `lo + kx - padding` from going negative.
+            const f32 *s = &in[(usize)iy * conv.in_width + lo[kx] + kx - conv.padding];
+            df[ky * 3 + kx] += dot_f32(&g[lo[kx]], s, hi[kx] - lo[kx]);
+            if (in_grad != NULL) {
+              const f32 wv = f[ky * 3 + kx];
+              f32 *d = &in_grad[(usize)iy * conv.in_width];
+              for (usize ox = lo[kx]; ox < hi[kx]; ++ox)
+                d[ox + kx - conv.padding] += wv * g[ox];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void conv2d_forward(Conv2d conv, Conv2dAlgo algo, ConstMat w, ConstMat b, const f32 *x, f32 *y, usize n,
+                    f32 *scratch) {
+  if (algo == CONV2D_AUTO)
+    algo = conv2d_select(conv);
+  conv2d_check(conv, algo, w);
+  const usize in_len = conv2d_in_len(conv);
+  const usize out_len = conv2d_out_len(conv);
+  const usize pixels = conv2d_out_height(conv) * conv2d_out_width(conv);
+  for (usize i = 0; i < n; ++i) {
+    switch (algo) {
+    case CONV2D_AUTO:
+      break;
+    case CONV2D_IM2COL: {
+      im2col(conv, &x[i * in_len], scratch);
+      Mat out = {.values = &y[i * out_len], .cols = pixels, .rows = conv.out_channels};
+      ConstMat col = {.values = scratch, .cols = pixels, .rows = w.cols};
+      mat_mul(out, w, col);
+      mat_add_col(out, b);
+    } break;
+    case CONV2D_DIRECT_3X3:
+      conv2d_direct_3x3_forward(conv, w, b, &x[i * in_len], &y[i * out_len]);
+      break;
+    }
+  }
+}
+
+void conv2d_backward(Conv2d conv, Conv2dAlgo algo, ConstMat w, const f32 *x, const f32 *dy, f32 *dx, Mat dw, Mat db,
+                     usize n, f32 *scratch) {
+  if (algo == CONV2D_AUTO)
+    algo = conv2d_select(conv);
+  conv2d_check(conv, algo, w);
+  const usize in_len = conv2d_in_len(conv);
+  const usize out_len = conv2d_out_len(conv);
+  const usize pixels = conv2d_out_height(conv) * conv2d_out_width(conv);
+  if (dx != NULL)
+    memset(dx, 0, n * in_len * sizeof(f32));
+  for (usize i = 0; i < n; ++i) {
+    switch (algo) {
+    case CONV2D_AUTO:
+      break;
+    case CONV2D_IM2COL: {
+      ConstMat grad = {.values = &dy[i * out_len], .cols = pixels, .rows = conv.out_channels};
+      Mat col = {.values = scratch, .cols = pixels, .rows = w.cols};
+      im2col(conv, &x[i * in_len], scratch);
+      mat_mul_add_rhs_t(dw, grad, mat_as_const(col));
+      mat_add_row_sums(db, grad);
+      if (dx != NULL) {
+        // The patches aren't needed anymore, reuse their memory for the gradient w.r.t. them.
+        mat_mul_lhs_t(col, w, grad);
+        col2im_add(conv, scratch, &dx[i * in_len]);
+      }
+    } break;
+    case CONV2D_DIRECT_3X3:
+      conv2d_direct_3x3_backward(conv, w, &x[i * in_len], &dy[i * out_len], dx != NULL ? &dx[i * in_len] : NULL, dw,
+                                 db);
+      break;
+    }
+  }
+}
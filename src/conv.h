@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+#include "mat.h"
+
+/// Shape of a 2D convolution over `(channels x height x width)` images.
+/// A batch of `n` images is `n` images back to back, every image channel by channel, every channel row by row.
+///
+/// Weights are a row-major `(out_channels x in_channels * kernel * kernel)` matrix, i.e. every output channel's
+/// filter is `(in_channels x kernel x kernel)`. Biases are `(out_channels x 1)`, one per output channel.
+typedef struct Conv2d {
+  usize in_channels;
+  usize in_height;
+  usize in_width;
+  usize out_channels;
+  /// Filters are `kernel x kernel`.
+  usize kernel;
+  usize stride;
+  /// Zeros added on every side of the input.
+  usize padding;
+} Conv2d;
+
+typedef enum Conv2dAlgo {
+  /// `conv2d_select`.
+  CONV2D_AUTO,
+  /// Unfold the input patches into a matrix and do the convolution as one `mat_mul`.
+  /// Works for any shape, costs `conv2d_scratch_len` floats of scratch.
+  CONV2D_IM2COL,
+  /// Accumulate shifted input rows straight into the output, no scratch.
+  /// Only for 3x3 filters with stride 1.
+  CONV2D_DIRECT_3X3,
+} Conv2dAlgo;
+
+usize conv2d_out_height(Conv2d conv);
+usize conv2d_out_width(Conv2d conv);
+
+/// Floats per input image.
+usize conv2d_in_len(Conv2d conv);
+
+/// Floats per output image.
+usize conv2d_out_len(Conv2d conv);
+
+/// Number of weights, `out_channels * in_channels * kernel * kernel`.
+usize conv2d_weight_len(Conv2d conv);
+
+/// The direct kernel for 3x3 stride 1 filters, im2col for everything else.
+Conv2dAlgo conv2d_select(Conv2d conv);
+
+/// Floats of scratch `conv2d_forward` and `conv2d_backward` need with `algo`.
+usize conv2d_scratch_len(Conv2d conv, Conv2dAlgo algo);
+
+/// `y = conv(x, w) + b` for `n` images.
+/// SAFETY: `y` must not overlap with `x`, `scratch` must be `conv2d_scratch_len` floats.
+void conv2d_forward(Conv2d conv, Conv2dAlgo algo, ConstMat w, ConstMat b, const f32 *x, f32 *y, usize n,
+                    f32 *scratch);
+
+/// Backward pass of `conv2d_forward` for `n` images, given `dy`, the gradient w.r.t. `y`.
+/// Gradients w.r.t. the weights and biases are accumulated into `dw` and `db`, the gradient w.r.t. `x` is written into
+/// `dx` (NULL if not needed, e.g. for the first layer).
+/// SAFETY: `scratch` must be `conv2d_scratch_len` floats.
+void conv2d_backward(Conv2d conv, Conv2dAlgo algo, ConstMat w, const f32 *x, const f32 *dy, f32 *dx, Mat dw, Mat db,
+                     usize n, f32 *scratch);
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "common.h"
+#include "allocator.h"
 
+#ifndef DA_INIT_CAP
 #define DA_INIT_CAP 256
+#endif
 
 #define da_get(DA, IDX) (&(DA)->da_items[(IDX)])
 
@@ -20,11 +23,11 @@
     ++DA_->da_len;                                                                                                     \
     if (DA_->da_items == NULL) {                                                                                       \
       DA_->da_cap = DA_INIT_CAP;                                                                                       \
-      DA_->da_items = malloc(sizeof(DA_->da_items[0]) * DA_INIT_CAP);                                                  \
+      DA_->da_items = site_malloc(sizeof(DA_->da_items[0]) * DA_INIT_CAP);                                             \
       assert(DA_->da_items != NULL);                                                                                   \
     } else if (DA_->da_len > DA_->da_cap) {                                                                            \
       DA_->da_cap *= 2;                                                                                                \
-      DA_->da_items = realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                                  \
+      DA_->da_items = site_realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                             \
       assert(DA_->da_items != NULL);                                                                                   \
     }                                                                                                                  \
     DA_->da_items[DA_->da_len - 1] = (ITEM);                                                                           \
@@ -38,12 +41,12 @@
     DA_->da_len += N_;                                                                                                 \
     if (DA_->da_items == NULL) {                                                                                       \
       DA_->da_cap = DA_INIT_CAP > N_ ? DA_INIT_CAP : N_;                                                               \
-      DA_->da_items = malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                                  \
+      DA_->da_items = site_malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                             \
       assert(DA_->da_items != NULL);                                                                                   \
     } else if (DA_->da_len > DA_->da_cap) {                                                                            \
       DA_->da_cap *= 2;                                                                                                \
       DA_->da_cap = DA_->da_cap > DA_->da_len ? DA_->da_cap : DA_->da_len;                                             \
-      DA_->da_items = realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                                  \
+      DA_->da_items = site_realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                             \
       assert(DA_->da_items != NULL);                                                                                   \
     }                                                                                                                  \
     memcpy(&DA_->da_items[I_], (ITEMS), sizeof(DA_->da_items[0]) * N_);                                                \
@@ -58,12 +61,12 @@
     DA_->da_len += N_;                                                                                                 \
     if (DA_->da_items == NULL) {                                                                                       \
       DA_->da_cap = DA_INIT_CAP > N_ ? DA_INIT_CAP : N_;                                                               \
-      DA_->da_items = malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                                  \
+      DA_->da_items = site_malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                             \
       assert(DA_->da_items != NULL);                                                                                   \
     } else if (DA_->da_len > DA_->da_cap) {                                                                            \
       DA_->da_cap *= 2;                                                                                                \
       DA_->da_cap = DA_->da_cap > DA_->da_len ? DA_->da_cap : DA_->da_len;                                             \
-      DA_->da_items = realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                                  \
+      DA_->da_items = site_realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                             \
       assert(DA_->da_items != NULL);                                                                                   \
     }                                                                                                                  \
     memset(&DA_->da_items[I_], 0, sizeof(DA_->da_items[0]) * N_);                                                      \
@@ -82,11 +85,11 @@
     size_t N_ = (N);                                                                                                   \
     if (DA_->da_items == NULL) {                                                                                       \
       DA_->da_cap = N_;                                                                                                \
-      DA_->da_items = malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                                  \
+      DA_->da_items = site_malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                             \
       assert(DA_->da_items != NULL);                                                                                   \
     } else if (DA_->da_len + N_ > DA_->da_cap) {                                                                       \
       DA_->da_cap = DA_->da_len + N_;                                                                                  \
-      DA_->da_items = realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                                  \
+      DA_->da_items = site_realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                             \
       assert(DA_->da_items != NULL);                                                                                   \
     }                                                                                                                  \
   })
@@ -98,12 +101,12 @@
     size_t NEW_LEN = DA_->da_len + N;                                                                                  \
     if (DA_->da_items == NULL) {                                                                                       \
       DA_->da_cap = DA_INIT_CAP > N_ ? DA_INIT_CAP : N_;                                                               \
-      DA_->da_items = malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                                  \
+      DA_->da_items = site_malloc(sizeof(DA_->da_items[0]) * DA_->da_cap);                                             \
       assert(DA_->da_items != NULL);                                                                                   \
     } else if (NEW_LEN > DA_->da_cap) {                                                                                \
       DA_->da_cap *= 2;                                                                                                \
       DA_->da_cap = DA_->da_cap > NEW_LEN ? DA_->da_cap : NEW_LEN;                                                     \
-      DA_->da_items = realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                                  \
+      DA_->da_items = site_realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                             \
       assert(DA_->da_items != NULL);                                                                                   \
     }                                                                                                                  \
   })
@@ -115,11 +118,11 @@
     ++DA_->da_len;                                                                                                     \
     if (DA_->da_items == NULL) {                                                                                       \
       DA_->da_cap = DA_INIT_CAP;                                                                                       \
-      DA_->da_items = malloc(sizeof(DA_->da_items[0]) * DA_INIT_CAP);                                                  \
+      DA_->da_items = site_malloc(sizeof(DA_->da_items[0]) * DA_INIT_CAP);                                             \
       assert(DA_->da_items != NULL);                                                                                   \
     } else if (DA_->da_len > DA_->da_cap) {                                                                            \
       DA_->da_cap *= 2;                                                                                                \
-      DA_->da_items = realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                                  \
+      DA_->da_items = site_realloc(DA_->da_items, sizeof(DA_->da_items[0]) * DA_->da_cap);                             \
       assert(DA_->da_items != NULL);                                                                                   \
     }                                                                                                                  \
     memmove(&DA_->da_items[I_ + 1], &DA_->da_items[I_], (DA_->da_len - I_ - 1) * sizeof(DA_->da_items[0]));            \
@@ -141,7 +144,7 @@
     memmove(&DA_->da_items[I_], &DA_->da_items[I_ + 1], (DA_->da_len - I_) * sizeof(DA_->da_items[0]));                \
   })
 
-#define da_free(DA) free((DA).da_items)
+#define da_free(DA) site_free((DA).da_items)
 
 #define DA_FOR(ARR, IDX, ITEM, BLOCK)                                                                                  \
   ({                                                                                                                   \
@@ -169,3 +172,121 @@
     T *values;                                                                                                         \
     usize len;                                                                                                         \
   } Const##NAME;
+
+/// Configuration of an allocator-aware dynamic array (see `DECL_ADA_STRUCT`).
+/// Arrays keep a pointer to their config, so it must outlive them.
+typedef struct DaConfig {
+  Allocator allocator;
+  /// Capacity of the first allocation, unless more is asked for at once.
+  usize init_cap;
+  /// Capacity is multiplied by this when growing, must be > 1.
+  f32 growth;
+  /// Alignment of the storage in bytes, power of 2. 0 means alignment of the item type.
+  usize align;
+} DaConfig;
+
+/// Used for allocator-aware arrays with `da_config == NULL`, behaves like the plain `da_*` family.
+static const DaConfig DA_CONFIG_DEFAULT = {
+    .allocator = HEAP_ALLOCATOR,
+    .init_cap = DA_INIT_CAP,
+    .growth = 2,
+    .align = 0,
+};
+
+/// Cache line aligned, no over-allocation.
+/// For buffers that are sized once up front, like `NN.pool`.
+static const DaConfig DA_CONFIG_CACHE_ALIGNED = {
+    .allocator = HEAP_ALLOCATOR,
+    .init_cap = 0,
+    .growth = 1.5,
+    .align = 64,
+};
+
+/// Make room for at least `needed` items, returns the new items pointer.
+/// With `exact`, capacity is set to exactly `needed` instead of following the growth policy.
+/// `file` and `line` are the call site, for `ALLOC_TRACKING`.
+static inline void *ada_grow_(const DaConfig *config, void *items, usize item_size, usize item_align, usize *cap,
+                              usize needed, bool exact, const char *file, i32 line) {
+  if (items != NULL && needed <= *cap)
+    return items;
+  if (config == NULL)
+    config = &DA_CONFIG_DEFAULT;
+  usize align = max(config->align, item_align);
+  usize new_cap;
+  if (exact)
+    new_cap = needed;
+  else if (items == NULL)
+    new_cap = max(config->init_cap, needed);
+  else
+    new_cap = max(max((usize)((f32)*cap * config->growth), *cap + 1), needed);
+  new_cap = max(new_cap, (usize)1);
+  ALLOC_TRACK_SITE(file, line);
+  items = allocator_realloc(config->allocator, items, *cap * item_size, new_cap * item_size, align);
+  ALLOC_TRACK_SITE(NULL, 0);
+  *cap = new_cap;
+  return items;
+}
+
+#define ada_grow_to_(DA_, NEEDED, EXACT)                                                                               \
+  (DA_->da_items = ada_grow_(DA_->da_config, DA_->da_items, sizeof(DA_->da_items[0]),                                  \
+                             _Alignof(typeof(DA_->da_items[0])), &DA_->da_cap, (NEEDED), (EXACT), __FILE__, __LINE__))
+
+/// Allocator-aware counterpart of `da_reserve_exact`.
+#define ada_reserve_exact(DA, N)                                                                                       \
+  ({                                                                                                                   \
+    __auto_type DA_ = (DA);                                                                                            \
+    ada_grow_to_(DA_, DA_->da_len + (N), true);                                                                        \
+  })
+
+/// Allocator-aware counterpart of `da_reserve`.
+#define ada_reserve(DA, N)                                                                                             \
+  ({                                                                                                                   \
+    __auto_type DA_ = (DA);                                                                                            \
+    ada_grow_to_(DA_, DA_->da_len + (N), false);                                                                       \
+  })
+
+/// Allocator-aware counterpart of `da_push`.
+#define ada_push(DA, ITEM)                                                                                             \
+  ({                                                                                                                   \
+    __auto_type DA_ = (DA);                                                                                            \
+    ada_grow_to_(DA_, DA_->da_len + 1, false);                                                                         \
+    DA_->da_items[DA_->da_len++] = (ITEM);                                                                             \
+  })
+
+/// Allocator-aware counterpart of `da_append`.
+#define ada_append(DA, ITEMS, N)                                                                                       \
+  ({                                                                                                                   \
+    __auto_type DA_ = (DA);                                                                                            \
+    size_t N_ = (N);                                                                                                   \
+    ada_grow_to_(DA_, DA_->da_len + N_, false);                                                                        \
+    memcpy(&DA_->da_items[DA_->da_len], (ITEMS), sizeof(DA_->da_items[0]) * N_);                                       \
+    DA_->da_len += N_;                                                                                                 \
+  })
+
+/// Allocator-aware counterpart of `da_append_zeros`.
+#define ada_append_zeros(DA, N)                                                                                        \
+  ({                                                                                                                   \
+    __auto_type DA_ = (DA);                                                                                            \
+    size_t N_ = (N);                                                                                                   \
+    ada_grow_to_(DA_, DA_->da_len + N_, false);                                                                        \
+    memset(&DA_->da_items[DA_->da_len], 0, sizeof(DA_->da_items[0]) * N_);                                             \
+    DA_->da_len += N_;                                                                                                 \
+  })
+
+/// Allocator-aware counterpart of `da_free`.
+#define ada_free(DA)                                                                                                   \
+  ({                                                                                                                   \
+    __auto_type DA_ = (DA);                                                                                            \
+    allocator_free((DA_.da_config != NULL ? DA_.da_config : &DA_CONFIG_DEFAULT)->allocator, DA_.da_items,              \
+                   DA_.da_cap * sizeof(DA_.da_items[0]));                                                              \
+  })
+
+/// Dynamic array that allocates through `da_config` (NULL for `DA_CONFIG_DEFAULT`).
+/// Use the `ada_*` macros to grow and free it, everything else from the `da_*` family works as usual.
+#define DECL_ADA_STRUCT(T, NAME)                                                                                       \
+  typedef struct NAME {                                                                                                \
+    T *da_items;                                                                                                       \
+    usize da_len;                                                                                                      \
+    usize da_cap;                                                                                                      \
+    const DaConfig *da_config;                                                                                         \
+  } NAME;
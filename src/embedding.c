@@ -0,0 +1,146 @@
+#include "embedding.h"
+#include "alloc_track.h"
+
+/// Prefetch every cache line of `row`.
+static inline void embedding_prefetch_row(const f32 *row, usize dim, int rw) {
+  for (usize i = 0; i < dim; i += 64 / sizeof(f32)) {
+    if (rw)
+      __builtin_prefetch(&row[i], 1);
+    else
+      __builtin_prefetch(&row[i], 0);
+  }
+}
+
+Embedding embedding_new_in(usize rows, usize dim, const DaConfig *pool_config) {
+  ASSERT(rows > 0 && dim > 0);
+  ASSERT_PRINTF(rows <= EMBEDDING_NO_SLOT, "%zu rows don't fit u32 ids\n", rows);
+  Embedding emb = {
+      .rows = rows,
+      .dim = dim,
+      .table = {.da_config = pool_config},
+  };
+  ada_reserve_exact(&emb.table, rows * dim);
+  ada_append_zeros(&emb.table, rows * dim);
+  return emb;
+}
+
+void embedding_free(Embedding emb) {
+  ada_free(emb.table);
+}
+
+void embedding_init_weights(Embedding *emb, u64 seed) {
+  rng_fill_normal((Rng){.seed = seed, .stream = 0}, emb->table.da_items, 0, emb->rows * emb->dim, 0,
+                  1 / sqrtf((f32)emb->dim));
+}
+
+void embedding_gather(Embedding emb, const u32 *ids, usize samples, usize fields, f32 *dst, usize dst_stride) {
+  const usize dim = emb.dim;
+  const usize count = samples * fields;
+  const f32 *table = emb.table.da_items;
+  for (usize i = 0; i < min(count, (usize)EMBEDDING_PREFETCH_DISTANCE); ++i)
+    embedding_prefetch_row(&table[(usize)ids[i] * dim], dim, 0);
+  for (usize i = 0; i < count; ++i) {
+    if (i + EMBEDDING_PREFETCH_DISTANCE < count)
+      embedding_prefetch_row(&table[(usize)ids[i + EMBEDDING_PREFETCH_DISTANCE] * dim], dim, 0);
+    DEBUG_ASSERT(ids[i] < emb.rows);
+    usize s = i / fields;
+    usize f = i % fields;
+    memcpy(&dst[s * dst_stride + f * dim], &table[(usize)ids[i] * dim], dim * sizeof(f32));
+  }
+}
+
+EmbeddingGrad embedding_grad_new(Embedding emb, usize capacity) {
+  ASSERT(capacity > 0);
+  EmbeddingGrad grad = {
+      .slots = xalloc(u32, emb.rows),
+      .touched = xalloc(u32, capacity),
+      .capacity = capacity,
+      .grads = xalloc(f32, capacity * emb.dim),
+  };
+  // Once, after which only touched slots are ever cleared.
+  memset(grad.slots, 0xFF, emb.rows * sizeof(u32));
+  return grad;
+}
+
+void embedding_grad_free(EmbeddingGrad grad) {
+  xfree(grad.slots);
+  xfree(grad.touched);
+  xfree(grad.grads);
+}
+
+void embedding_grad_add(Embedding emb, EmbeddingGrad *grad, u32 row, const f32 *g, usize g_stride) {
+  DEBUG_ASSERT(row < emb.rows);
+  const usize dim = emb.dim;
+  u32 slot = grad->slots[row];
+  if (slot == EMBEDDING_NO_SLOT) {
+    ASSERT_PRINTF(grad->touched_len < grad->capacity, "more than %zu distinct embedding rows in a step\n",
+                  grad->capacity);
+    slot = (u32)grad->touched_len++;
+    grad->slots[row] = slot;
+    grad->touched[slot] = row;
+    f32 *restrict dst = &grad->grads[slot * dim];
+    for (usize i = 0; i < dim; ++i)
+      dst[i] = g[i * g_stride];
+    return;
+  }
+  f32 *restrict dst = &grad->grads[(usize)slot * dim];
+  for (usize i = 0; i < dim; ++i)
+    dst[i] += g[i * g_stride];
+}
+
+void embedding_apply(Embedding *emb, EmbeddingGrad *grad, f32 rate) {
+  const usize dim = emb->dim;
+  f32 *table = emb->table.da_items;
+  const usize n = grad->touched_len;
+  for (usize i = 0; i < min(n, (usize)EMBEDDING_PREFETCH_DISTANCE); ++i)
+    embedding_prefetch_row(&table[(usize)grad->touched[i] * dim], dim, 1);
+  for (usize i = 0; i < n; ++i) {
+    if (i + EMBEDDING_PREFETCH_DISTANCE < n)
+      embedding_prefetch_row(&table[(usize)grad->touched[i + EMBEDDING_PREFETCH_DISTANCE] * dim], dim, 1);
+    u32 row = grad->touched[i];
+    f32 *restrict dst = &table[(usize)row * dim];
+    const f32 *restrict g = &grad->grads[i * dim];
+    for (usize j = 0; j < dim; ++j)
+      dst[j] -= rate * g[j];
+    grad->slots[row] = EMBEDDING_NO_SLOT;
+  }
+  grad->touched_len = 0;
+}
+
+f32 embedding_nn_train(Embedding *emb, EmbeddingGrad *grad, NN *nn, TrainingContext *ctx, const u32 *ids, usize fields,
+                       const f32 *data, usize samples, f32 rate) {
+  const usize dim = emb->dim;
+  const usize embedded = fields * dim;
+  ASSERT(samples > 0);
+  ASSERT(nn_input_count(*nn) >= embedded);
+  ASSERT(grad->capacity >= ctx->batch * fields);
+  const usize data_stride = nn_input_count(*nn) - embedded + nn_output_count(*nn);
+  const usize stride = embedded + data_stride;
+  // One step's samples laid out like for `nn_train`, the embedded inputs first.
+  f32 *batch_data = xalloc(f32, ctx->batch * stride);
+  const bool input_grad = ctx->input_grad;
+  ctx->input_grad = true;
+
+  f32 loss = 0;
+  for (usize begin = 0; begin < samples; begin += ctx->batch) {
+    ALLOC_TRACK_STEP_BEGIN();
+    usize batch = min(ctx->batch, samples - begin);
+    const u32 *batch_ids = &ids[begin * fields];
+    embedding_gather(*emb, batch_ids, batch, fields, batch_data, stride);
+    for (usize s = 0; s < batch; ++s)
+      memcpy(&batch_data[s * stride + embedded], &data[(begin + s) * data_stride], data_stride * sizeof(f32));
+    training_context_load_batch(ctx, *nn, batch_data, NULL, 0, batch);
+    training_context_zero_grads(ctx);
+    loss += nn_backprop_batch(*nn, ctx, batch, 1 / (f32)batch);
+    // Input `f * dim + i` of sample `s` is at `dx[(f * dim + i) * batch + s]`.
+    for (usize s = 0; s < batch; ++s)
+      for (usize f = 0; f < fields; ++f)
+        embedding_grad_add(*emb, grad, batch_ids[s * fields + f], &ctx->dx.values[f * dim * batch + s], batch);
+    nn_apply_grads(nn, ctx, rate);
+    embedding_apply(emb, grad, rate);
+    ALLOC_TRACK_STEP_END();
+  }
+  ctx->input_grad = input_grad;
+  xfree(batch_data);
+  return loss / samples;
+}
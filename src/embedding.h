@@ -0,0 +1,70 @@
+#pragma once
+
+#include "common.h"
+#include "mat.h"
+#include "nn.h"
+
+/// Rows fetched ahead by `embedding_gather` and `embedding_apply`, in rows.
+#define EMBEDDING_PREFETCH_DISTANCE 8
+
+/// Marks rows without a slot in `EmbeddingGrad.slots`.
+#define EMBEDDING_NO_SLOT UINT32_MAX
+
+/// A `(rows x dim)` table of learned vectors for categorical features, row `id` being the vector of category `id`.
+///
+/// Lookups touch a handful of rows at random out of a table that can be far larger than the caches, so they are
+/// latency-bound: `embedding_gather` prefetches the rows a few lookups ahead to keep several misses in flight.
+typedef struct Embedding {
+  usize rows;
+  usize dim;
+  AdaF32 table;
+} Embedding;
+
+/// Gradient of an `Embedding`, kept only for the rows a training step touched.
+///
+/// Every touched row gets a slot, in the order they are first touched, and `slots` maps rows to their slot. Only the
+/// touched rows are updated and their slots cleared, so a step costs the rows it touches, never the size of the table.
+typedef struct EmbeddingGrad {
+  /// `rows` entries, `EMBEDDING_NO_SLOT` for untouched rows.
+  u32 *slots;
+  /// Rows with a slot, `touched_len` of them, slot `i` belongs to `touched[i]`.
+  u32 *touched;
+  usize touched_len;
+  /// Maximum number of distinct rows per step.
+  usize capacity;
+  /// `(capacity x dim)`, gradient of slot `i` at `[i * dim]`.
+  f32 *grads;
+} EmbeddingGrad;
+
+/// `pool_config` decides where the table is allocated, must outlive it. Rows start at zero, see
+/// `embedding_init_weights`.
+Embedding embedding_new_in(usize rows, usize dim, const DaConfig *pool_config);
+
+void embedding_free(Embedding emb);
+
+/// N(0, 1 / dim) entries.
+void embedding_init_weights(Embedding *emb, u64 seed);
+
+/// Copy the rows of `ids[s * fields + f]` for every sample `s < samples` and field `f < fields` to
+/// `dst[s * dst_stride + f * dim]`, i.e. every sample's vectors concatenated.
+void embedding_gather(Embedding emb, const u32 *ids, usize samples, usize fields, f32 *dst, usize dst_stride);
+
+/// Up to `capacity` distinct rows per step.
+EmbeddingGrad embedding_grad_new(Embedding emb, usize capacity);
+
+void embedding_grad_free(EmbeddingGrad grad);
+
+/// Add `g[i * g_stride]` for `i < dim` to the gradient of row `row`.
+void embedding_grad_add(Embedding emb, EmbeddingGrad *grad, u32 row, const f32 *g, usize g_stride);
+
+/// Subtract `rate` times the gradient from every touched row, and clear the gradient.
+void embedding_apply(Embedding *emb, EmbeddingGrad *grad, f32 rate);
+
+/// One epoch of minibatch SGD, `ctx->batch` samples per step, of `emb` feeding `nn`.
+/// Sample `s`'s inputs to `nn` are the rows of its `fields` ids (`ids[s * fields..]`) concatenated, then its dense
+/// features: `data` holds every sample's dense features followed by its expected outputs, like for `nn_train` but
+/// without the embedded inputs.
+/// Every step updates `nn` and the rows the step touched. `grad` needs a capacity of `ctx->batch * fields`.
+/// Returns the mean loss per sample, every step measured before its update.
+f32 embedding_nn_train(Embedding *emb, EmbeddingGrad *grad, NN *nn, TrainingContext *ctx, const u32 *ids, usize fields,
+                       const f32 *data, usize samples, f32 rate);
@@ -0,0 +1,550 @@
+#include "graph.h"
+
+Graph graph_new() {
+  return (Graph){
+      .params = {.da_config = &DA_CONFIG_CACHE_ALIGNED},
+      .grads = {.da_config = &DA_CONFIG_CACHE_ALIGNED},
+  };
+}
+
+static void graph_plan_free(GraphPlan plan) {
+  xfree(plan.order);
+  xfree(plan.values);
+  ada_free(plan.activations);
+  xfree(plan.grads);
+  ada_free(plan.grad_memory);
+  xfree(plan.grad_fresh);
+  ada_free(plan.scratch);
+}
+
+void graph_free(Graph graph) {
+  da_free(graph.ops);
+  ada_free(graph.params);
+  ada_free(graph.grads);
+  graph_plan_free(graph.plan);
+}
+
+static GraphTensor graph_push(Graph *graph, GraphOp op) {
+  for (usize i = 0; i < op.input_count; ++i)
+    ASSERT_PRINTF(op.inputs[i] < graph->ops.da_len, "tensor %zu does not exist\n", op.inputs[i]);
+  da_push(&graph->ops, op);
+  return graph->ops.da_len - 1;
+}
+
+GraphTensor graph_input(Graph *graph, usize rows) {
+  usize input_index = 0;
+  for (usize i = 0; i < graph->ops.da_len; ++i)
+    if (da_get(&graph->ops, i)->kind == GRAPH_OP_INPUT)
+      ++input_index;
+  return graph_push(graph, (GraphOp){
+                               .kind = GRAPH_OP_INPUT,
+                               .rows = rows,
+                               .input_index = input_index,
+                           });
+}
+
+GraphTensor graph_dense(Graph *graph, GraphTensor x, usize rows) {
+  usize cols = graph_tensor_rows(graph, x);
+  usize w_offset = graph->params.da_len;
+  ada_append_zeros(&graph->params, rows * cols + rows);
+  return graph_push(graph, (GraphOp){
+                               .kind = GRAPH_OP_DENSE,
+                               .inputs = {x},
+                               .input_count = 1,
+                               .rows = rows,
+                               .w_offset = w_offset,
+                               .b_offset = w_offset + rows * cols,
+                           });
+}
+
+GraphTensor graph_activation(Graph *graph, GraphTensor x, Activation activation) {
+  return graph_push(graph, (GraphOp){
+                               .kind = GRAPH_OP_ACTIVATION,
+                               .inputs = {x},
+                               .input_count = 1,
+                               .rows = graph_tensor_rows(graph, x),
+                               .activation = activation,
+                           });
+}
+
+GraphTensor graph_dropout(Graph *graph, GraphTensor x, f32 rate) {
+  ASSERT(rate >= 0 && rate < 1);
+  return graph_push(graph, (GraphOp){
+                               .kind = GRAPH_OP_DROPOUT,
+                               .inputs = {x},
+                               .input_count = 1,
+                               .rows = graph_tensor_rows(graph, x),
+                               .dropout_rate = rate,
+                           });
+}
+
+GraphTensor graph_add(Graph *graph, GraphTensor a, GraphTensor b) {
+  ASSERT_PRINTF(graph_tensor_rows(graph, a) == graph_tensor_rows(graph, b), "adding tensors of %zu and %zu rows\n",
+                graph_tensor_rows(graph, a), graph_tensor_rows(graph, b));
+  return graph_push(graph, (GraphOp){
+                               .kind = GRAPH_OP_ADD,
+                               .inputs = {a, b},
+                               .input_count = 2,
+                               .rows = graph_tensor_rows(graph, a),
+                           });
+}
+
+GraphTensor graph_concat(Graph *graph, GraphTensor a, GraphTensor b) {
+  return graph_push(graph, (GraphOp){
+                               .kind = GRAPH_OP_CONCAT,
+                               .inputs = {a, b},
+                               .input_count = 2,
+                               .rows = graph_tensor_rows(graph, a) + graph_tensor_rows(graph, b),
+                           });
+}
+
+usize graph_tensor_rows(const Graph *graph, GraphTensor t) {
+  ASSERT_PRINTF(t < graph->ops.da_len, "tensor %zu does not exist\n", t);
+  return da_get(&graph->ops, t)->rows;
+}
+
+/// The weights (or biases) of dense op `t` in `pool`, `Graph.params` or `Graph.grads`.
+static Mat graph_dense_mat(const Graph *graph, const AdaF32 *pool, GraphTensor t, bool bias) {
+  const GraphOp *op = da_get(&graph->ops, t);
+  DEBUG_ASSERT(op->kind == GRAPH_OP_DENSE);
+  return (Mat){
+      .values = da_get(pool, bias ? op->b_offset : op->w_offset),
+      .cols = bias ? 1 : graph_tensor_rows(graph, op->inputs[0]),
+      .rows = op->rows,
+  };
+}
+
+Mat graph_dense_w(const Graph *graph, GraphTensor t) {
+  return graph_dense_mat(graph, &graph->params, t, false);
+}
+
+Mat graph_dense_b(const Graph *graph, GraphTensor t) {
+  return graph_dense_mat(graph, &graph->params, t, true);
+}
+
+Mat graph_dense_dw(const Graph *graph, GraphTensor t) {
+  return graph_dense_mat(graph, &graph->grads, t, false);
+}
+
+Mat graph_dense_db(const Graph *graph, GraphTensor t) {
+  return graph_dense_mat(graph, &graph->grads, t, true);
+}
+
+void graph_init_weights(Graph *graph, WeightInit init, u64 seed) {
+  for (usize t = 0; t < graph->ops.da_len; ++t) {
+    if (da_get(&graph->ops, t)->kind != GRAPH_OP_DENSE)
+      continue;
+    Mat w = graph_dense_w(graph, t);
+    Mat b = graph_dense_b(graph, t);
+    weight_init_fill(init, (Rng){.seed = seed, .stream = t}, w.values, 0, w.rows * w.cols, w.cols, w.rows);
+    memset(b.values, 0, b.rows * sizeof(f32));
+  }
+}
+
+/// Post-order DFS, so every op lands after the ops it reads.
+static void graph_visit(const Graph *graph, GraphTensor t, bool *visited, usize *order, usize *order_len) {
+  if (visited[t])
+    return;
+  visited[t] = true;
+  const GraphOp *op = da_get(&graph->ops, t);
+  for (usize i = 0; i < op->input_count; ++i)
+    graph_visit(graph, op->inputs[i], visited, order, order_len);
+  order[(*order_len)++] = t;
+}
+
+/// A piece of activation memory, shared by an op and the elementwise ops writing into it in place.
+typedef struct GraphBuffer {
+  /// In floats.
+  usize size;
+  usize offset;
+  /// Live from the step of the first op writing it to the last step reading it, inclusive.
+  usize first_step;
+  usize last_step;
+} GraphBuffer;
+
+static bool graph_buffers_overlap(const GraphBuffer *a, const GraphBuffer *b) {
+  bool in_time = a->first_step <= b->last_step && b->first_step <= a->last_step;
+  bool in_memory = a->offset < b->offset + b->size && b->offset < a->offset + a->size;
+  return in_time && in_memory;
+}
+
+static int graph_buffer_cmp_size_desc(const void *a_, const void *b_) {
+  const GraphBuffer *a = *(GraphBuffer *const *)a_;
+  const GraphBuffer *b = *(GraphBuffer *const *)b_;
+  if (a->size != b->size)
+    return a->size < b->size ? 1 : -1;
+  return a->first_step < b->first_step ? -1 : a->first_step > b->first_step;
+}
+
+/// Greedy placement, biggest buffers first, each at the lowest offset clear of every live buffer placed before it.
+/// Returns the floats it takes to hold them all.
+static usize graph_place_buffers(GraphBuffer *buffers, usize count) {
+  GraphBuffer **by_size = xalloc(GraphBuffer *, count);
+  for (usize i = 0; i < count; ++i)
+    by_size[i] = &buffers[i];
+  qsort(by_size, count, sizeof(GraphBuffer *), graph_buffer_cmp_size_desc);
+  usize floats = 0;
+  for (usize i = 0; i < count; ++i) {
+    GraphBuffer *buffer = by_size[i];
+    buffer->offset = 0;
+    for (usize j = 0; j < i; ++j) {
+      if (graph_buffers_overlap(buffer, by_size[j])) {
+        buffer->offset = by_size[j]->offset + by_size[j]->size;
+        j = (usize)-1;
+      }
+    }
+    floats = max(floats, buffer->offset + buffer->size);
+  }
+  xfree(by_size);
+  return floats;
+}
+
+/// 64 byte aligned, so that every tensor starts on its own cache line.
+static usize graph_buffer_size(usize rows, usize batch) {
+  return (rows * batch + 15) / 16 * 16;
+}
+
+/// Gradients of every op but the inputs and the output, over the backward pass: step `s` of the forward pass is step
+/// `order_len - 1 - s` of the backward one.
+static void graph_plan_grads(const Graph *graph, GraphPlan *plan, const usize *last_read) {
+  const usize op_count = graph->ops.da_len;
+  plan->grads = xalloc(f32 *, op_count);
+  memset(plan->grads, 0, op_count * sizeof(f32 *));
+  plan->grad_fresh = xalloc(bool, op_count);
+  GraphBuffer *buffers = xalloc(GraphBuffer, plan->order_len);
+  usize *buffer_of = xalloc(usize, op_count);
+  usize buffer_count = 0;
+  usize max_rows = 0;
+  for (usize s = 0; s < plan->order_len; ++s) {
+    usize t = plan->order[s];
+    const GraphOp *op = da_get(&graph->ops, t);
+    max_rows = max(max_rows, op->rows);
+    if (op->kind == GRAPH_OP_INPUT || t == plan->output)
+      continue;
+    buffer_of[t] = buffer_count;
+    buffers[buffer_count++] = (GraphBuffer){
+        .size = graph_buffer_size(op->rows, plan->batch),
+        .first_step = plan->order_len - 1 - last_read[t],
+        .last_step = plan->order_len - 1 - s,
+    };
+  }
+  plan->grad_floats = graph_place_buffers(buffers, buffer_count);
+  plan->grad_memory.da_config = &DA_CONFIG_CACHE_ALIGNED;
+  ada_reserve_exact(&plan->grad_memory, plan->grad_floats);
+  ada_append_zeros(&plan->grad_memory, plan->grad_floats);
+  for (usize s = 0; s < plan->order_len; ++s) {
+    usize t = plan->order[s];
+    if (da_get(&graph->ops, t)->kind != GRAPH_OP_INPUT && t != plan->output)
+      plan->grads[t] = da_get(&plan->grad_memory, buffers[buffer_of[t]].offset);
+  }
+  xfree(buffers);
+  xfree(buffer_of);
+
+  const usize scratch_len = graph_buffer_size(max_rows, plan->batch) + plan->batch;
+  plan->scratch.da_config = &DA_CONFIG_CACHE_ALIGNED;
+  ada_reserve_exact(&plan->scratch, scratch_len);
+  ada_append_zeros(&plan->scratch, scratch_len);
+}
+
+static void graph_plan_(Graph *graph, GraphTensor output, usize batch, bool training, u64 dropout_seed) {
+  ASSERT(batch > 0);
+  ASSERT_PRINTF(output < graph->ops.da_len, "tensor %zu does not exist\n", output);
+  graph_plan_free(graph->plan);
+  const usize op_count = graph->ops.da_len;
+  GraphPlan plan = {
+      .batch = batch,
+      .output = output,
+      .order = xalloc(usize, op_count),
+      .values = xalloc(f32 *, op_count),
+      .activations = {.da_config = &DA_CONFIG_CACHE_ALIGNED},
+      .training = training,
+      .dropout_seed = dropout_seed,
+  };
+  memset(plan.values, 0, op_count * sizeof(f32 *));
+
+  bool *visited = xalloc(bool, op_count);
+  memset(visited, 0, op_count * sizeof(bool));
+  graph_visit(graph, output, visited, plan.order, &plan.order_len);
+  xfree(visited);
+
+  // Last step reading every op's output, the output itself has to survive past the last step.
+  usize *last_read = xalloc(usize, op_count);
+  for (usize s = 0; s < plan.order_len; ++s) {
+    usize t = plan.order[s];
+    last_read[t] = t == output ? plan.order_len : s;
+    const GraphOp *op = da_get(&graph->ops, t);
+    for (usize i = 0; i < op->input_count; ++i)
+      last_read[op->inputs[i]] = max(last_read[op->inputs[i]], s);
+  }
+  if (training) {
+    graph_plan_grads(graph, &plan, last_read);
+    ada_append_zeros(&graph->grads, graph->params.da_len - graph->grads.da_len);
+    // What the backward pass reads survives the forward pass, and nothing runs in place on it.
+    for (usize s = 0; s < plan.order_len; ++s) {
+      usize t = plan.order[s];
+      const GraphOp *op = da_get(&graph->ops, t);
+      if (op->kind == GRAPH_OP_DENSE)
+        last_read[op->inputs[0]] = plan.order_len;
+      else if (op->kind == GRAPH_OP_ACTIVATION)
+        last_read[t] = plan.order_len;
+    }
+  }
+
+  // Inputs live in the caller's memory and get no buffer.
+  GraphBuffer *buffers = xalloc(GraphBuffer, plan.order_len);
+  usize buffer_count = 0;
+  usize *buffer_of = xalloc(usize, op_count);
+  for (usize s = 0; s < plan.order_len; ++s) {
+    usize t = plan.order[s];
+    const GraphOp *op = da_get(&graph->ops, t);
+    if (op->kind == GRAPH_OP_INPUT)
+      continue;
+    usize size = graph_buffer_size(op->rows, batch);
+    plan.unplanned_floats += size;
+    bool elementwise = op->kind == GRAPH_OP_ACTIVATION || op->kind == GRAPH_OP_DROPOUT || op->kind == GRAPH_OP_ADD;
+    bool in_place = false;
+    for (usize i = 0; elementwise && !in_place && i < op->input_count; ++i) {
+      if (da_get(&graph->ops, op->inputs[i])->kind == GRAPH_OP_INPUT)
+        continue;
+      GraphBuffer *buffer = &buffers[buffer_of[op->inputs[i]]];
+      // Only if nothing reads the input after this op, which also rules out the output.
+      if (buffer->last_step == s) {
+        buffer_of[t] = buffer_of[op->inputs[i]];
+        buffer->last_step = last_read[t];
+        in_place = true;
+      }
+    }
+    if (!in_place) {
+      buffer_of[t] = buffer_count;
+      buffers[buffer_count++] = (GraphBuffer){
+          .size = size,
+          .first_step = s,
+          .last_step = last_read[t],
+      };
+    }
+  }
+  plan.activation_floats = graph_place_buffers(buffers, buffer_count);
+
+  ada_reserve_exact(&plan.activations, plan.activation_floats);
+  ada_append_zeros(&plan.activations, plan.activation_floats);
+  for (usize s = 0; s < plan.order_len; ++s) {
+    usize t = plan.order[s];
+    if (da_get(&graph->ops, t)->kind != GRAPH_OP_INPUT)
+      plan.values[t] = da_get(&plan.activations, buffers[buffer_of[t]].offset);
+  }
+  xfree(buffers);
+  xfree(buffer_of);
+  xfree(last_read);
+  graph->plan = plan;
+}
+
+void graph_plan(Graph *graph, GraphTensor output, usize batch) {
+  graph_plan_(graph, output, batch, false, 0);
+}
+
+void graph_plan_training(Graph *graph, GraphTensor output, usize batch, u64 dropout_seed) {
+  graph_plan_(graph, output, batch, true, dropout_seed);
+}
+
+static ConstMat graph_tensor_mat(const Graph *graph, GraphTensor t, usize n) {
+  return (ConstMat){
+      .values = graph->plan.values[t],
+      .cols = n,
+      .rows = da_get(&graph->ops, t)->rows,
+  };
+}
+
+/// Copy `src` into `dest` unless the op is running in place.
+static void graph_copy(Mat dest, ConstMat src) {
+  if (dest.values != src.values)
+    memcpy(dest.values, src.values, src.rows * src.cols * sizeof(f32));
+}
+
+/// Uniforms in [0, 1) for the mask of dropout op `t` in the current forward pass, `rows * n` of them.
+static void graph_dropout_uniforms(const Graph *graph, GraphTensor t, usize n, f32 *dst) {
+  const GraphPlan *plan = &graph->plan;
+  const usize rows = da_get(&graph->ops, t)->rows;
+  // Every forward pass gets its own range of the op's stream, as if it were a full batch.
+  const usize begin = (plan->forward_count - 1) * rows * plan->batch;
+  rng_fill_uniform((Rng){.seed = plan->dropout_seed, .stream = t}, dst, begin, begin + rows * n, 0, 1);
+}
+
+const f32 *graph_forward(Graph *graph, const f32 *const *inputs, usize n) {
+  GraphPlan *plan = &graph->plan;
+  ASSERT_PRINTF(plan->order != NULL, "graph_forward before graph_plan\n");
+  ASSERT_PRINTF(n <= plan->batch, "%zu samples in a plan for batches of %zu\n", n, plan->batch);
+  plan->n = n;
+  plan->forward_count += plan->training;
+  for (usize s = 0; s < plan->order_len; ++s) {
+    usize t = plan->order[s];
+    const GraphOp *op = da_get(&graph->ops, t);
+    if (op->kind == GRAPH_OP_INPUT) {
+      ASSERT_PRINTF(inputs[op->input_index] != NULL, "input %zu is needed\n", op->input_index);
+      plan->values[t] = (f32 *)inputs[op->input_index];
+      continue;
+    }
+    Mat out = {
+        .values = plan->values[t],
+        .cols = n,
+        .rows = op->rows,
+    };
+    ConstMat a = graph_tensor_mat(graph, op->inputs[0], n);
+    switch (op->kind) {
+    case GRAPH_OP_INPUT:
+      break;
+    case GRAPH_OP_DENSE:
+      mat_mul(out, mat_as_const(graph_dense_w(graph, t)), a);
+      mat_add_col(out, mat_as_const(graph_dense_b(graph, t)));
+      break;
+    case GRAPH_OP_ACTIVATION:
+      graph_copy(out, a);
+      if (op->activation == ACTIVATION_SOFTMAX)
+        softmax_mat(out);
+      else
+        sigmoid_mat(out);
+      break;
+    case GRAPH_OP_DROPOUT:
+      if (plan->training && op->dropout_rate > 0) {
+        f32 *uniforms = da_get(&plan->scratch, 0);
+        graph_dropout_uniforms(graph, t, n, uniforms);
+        const f32 scale = 1 / (1 - op->dropout_rate);
+        for (usize i = 0; i < op->rows * n; ++i)
+          out.values[i] = uniforms[i] >= op->dropout_rate ? a.values[i] * scale : 0;
+      } else {
+        graph_copy(out, a);
+      }
+      break;
+    case GRAPH_OP_ADD: {
+      ConstMat b = graph_tensor_mat(graph, op->inputs[1], n);
+      // In place on either side, addition commutes.
+      if (out.values == b.values) {
+        mat_add(out, a);
+      } else {
+        graph_copy(out, a);
+        mat_add(out, b);
+      }
+    } break;
+    case GRAPH_OP_CONCAT: {
+      ConstMat b = graph_tensor_mat(graph, op->inputs[1], n);
+      // Row-major with one sample per column, so stacking features is two contiguous copies.
+      memcpy(out.values, a.values, a.rows * n * sizeof(f32));
+      memcpy(&out.values[a.rows * n], b.values, b.rows * n * sizeof(f32));
+    } break;
+    }
+  }
+  return plan->values[plan->output];
+}
+
+void graph_zero_grads(Graph *graph) {
+  memset(graph->grads.da_items, 0, graph->grads.da_len * sizeof(f32));
+}
+
+/// Where the next contribution to the gradient of `t` goes: the gradient itself if it's the first one, the scratch
+/// memory otherwise, added in by `graph_grad_end`.
+static Mat graph_grad_begin(Graph *graph, GraphTensor t, usize n) {
+  GraphPlan *plan = &graph->plan;
+  return (Mat){
+      .values = plan->grad_fresh[t] ? plan->grads[t] : da_get(&plan->scratch, 0),
+      .cols = n,
+      .rows = da_get(&graph->ops, t)->rows,
+  };
+}
+
+static void graph_grad_end(Graph *graph, GraphTensor t, Mat contribution) {
+  GraphPlan *plan = &graph->plan;
+  if (!plan->grad_fresh[t])
+    mat_add((Mat){.values = plan->grads[t], .cols = contribution.cols, .rows = contribution.rows},
+            mat_as_const(contribution));
+  plan->grad_fresh[t] = false;
+}
+
+void graph_backward(Graph *graph, const f32 *output_grad, usize n) {
+  GraphPlan *plan = &graph->plan;
+  ASSERT_PRINTF(plan->training, "graph_backward needs a plan from graph_plan_training\n");
+  ASSERT_PRINTF(plan->forward_count > 0 && n == plan->n, "graph_backward on %zu samples, graph_forward ran on %zu\n", n,
+                plan->n);
+  plan->grads[plan->output] = (f32 *)output_grad;
+  memset(plan->grad_fresh, true, graph->ops.da_len * sizeof(bool));
+  f32 *sample_sums = da_get(&plan->scratch, plan->scratch.da_len - plan->batch);
+  for (usize s = plan->order_len - 1; s != SIZE_MAX; --s) {
+    usize t = plan->order[s];
+    const GraphOp *op = da_get(&graph->ops, t);
+    if (op->kind == GRAPH_OP_INPUT)
+      continue;
+    ConstMat g = {.values = plan->grads[t], .cols = n, .rows = op->rows};
+    GraphTensor x = op->inputs[0];
+    // Inputs get no gradients.
+    bool x_grad = da_get(&graph->ops, x)->kind != GRAPH_OP_INPUT;
+    switch (op->kind) {
+    case GRAPH_OP_INPUT:
+      break;
+    case GRAPH_OP_DENSE: {
+      ConstMat w = mat_as_const(graph_dense_w(graph, t));
+      mat_mul_add_rhs_t(graph_dense_dw(graph, t), g, graph_tensor_mat(graph, x, n));
+      mat_add_row_sums(graph_dense_db(graph, t), g);
+      if (x_grad) {
+        Mat dx = graph_grad_begin(graph, x, n);
+        mat_mul_lhs_t(dx, w, g);
+        graph_grad_end(graph, x, dx);
+      }
+    } break;
+    case GRAPH_OP_ACTIVATION: {
+      if (!x_grad)
+        break;
+      const f32 *y = plan->values[t];
+      Mat dx = graph_grad_begin(graph, x, n);
+      if (op->activation == ACTIVATION_SOFTMAX) {
+        // dL/dz = y (dL/dy - sum over the sample's features of y dL/dy).
+        memset(sample_sums, 0, n * sizeof(f32));
+        for (usize r = 0; r < op->rows; ++r)
+          for (usize c = 0; c < n; ++c)
+            sample_sums[c] += y[r * n + c] * g.values[r * n + c];
+        for (usize r = 0; r < op->rows; ++r)
+          for (usize c = 0; c < n; ++c)
+            dx.values[r * n + c] = y[r * n + c] * (g.values[r * n + c] - sample_sums[c]);
+      } else {
+        for (usize i = 0; i < op->rows * n; ++i)
+          dx.values[i] = g.values[i] * y[i] * (1 - y[i]);
+      }
+      graph_grad_end(graph, x, dx);
+    } break;
+    case GRAPH_OP_DROPOUT: {
+      if (!x_grad)
+        break;
+      Mat dx = graph_grad_begin(graph, x, n);
+      if (op->dropout_rate > 0) {
+        // The same mask as the forward pass, drawn again into `dx` first.
+        graph_dropout_uniforms(graph, t, n, dx.values);
+        const f32 scale = 1 / (1 - op->dropout_rate);
+        for (usize i = 0; i < op->rows * n; ++i)
+          dx.values[i] = dx.values[i] >= op->dropout_rate ? g.values[i] * scale : 0;
+      } else {
+        memcpy(dx.values, g.values, op->rows * n * sizeof(f32));
+      }
+      graph_grad_end(graph, x, dx);
+    } break;
+    case GRAPH_OP_ADD:
+    case GRAPH_OP_CONCAT: {
+      // Add passes the gradient to both inputs, concat splits it between them.
+      usize offset = 0;
+      for (usize i = 0; i < 2; ++i) {
+        GraphTensor input = op->inputs[i];
+        usize rows = da_get(&graph->ops, input)->rows;
+        if (da_get(&graph->ops, input)->kind != GRAPH_OP_INPUT) {
+          Mat dx = graph_grad_begin(graph, input, n);
+          memcpy(dx.values, &g.values[offset], rows * n * sizeof(f32));
+          graph_grad_end(graph, input, dx);
+        }
+        offset += op->kind == GRAPH_OP_CONCAT ? rows * n : 0;
+      }
+    } break;
+    }
+  }
+  plan->grads[plan->output] = NULL;
+}
+
+void graph_apply_grads(Graph *graph, f32 rate) {
+  DEBUG_ASSERT(graph->grads.da_len == graph->params.da_len);
+  for (usize i = 0; i < graph->params.da_len; ++i)
+    graph->params.da_items[i] -= rate * graph->grads.da_items[i];
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "common.h"
+#include "da.h"
+#include "mat.h"
+#include "nn.h"
+
+/// Ops of a `Graph`.
+/// Tensors are row-major `(features x samples)` matrices, one sample per column, like the batch matrices in `nn_train`.
+typedef enum GraphOpKind {
+  /// Data passed into `graph_forward`.
+  GRAPH_OP_INPUT,
+  /// `w * x + b`.
+  GRAPH_OP_DENSE,
+  GRAPH_OP_ACTIVATION,
+  /// In plans made by `graph_plan_training`, zeroes each element with probability `dropout_rate` and scales the others
+  /// by `1 / (1 - dropout_rate)`. The identity at inference.
+  GRAPH_OP_DROPOUT,
+  /// Elementwise sum of two tensors of the same shape, e.g. a residual connection.
+  GRAPH_OP_ADD,
+  /// Features of the first tensor followed by features of the second.
+  GRAPH_OP_CONCAT,
+} GraphOpKind;
+
+/// Index of an op in `Graph.ops`, every op produces exactly one tensor.
+typedef usize GraphTensor;
+
+typedef struct GraphOp {
+  GraphOpKind kind;
+  GraphTensor inputs[2];
+  usize input_count;
+  /// Number of features of the output.
+  usize rows;
+  /// Dense: offsets into `Graph.params` of the `(rows x input rows)` weights and the `(rows x 1)` biases.
+  usize w_offset;
+  usize b_offset;
+  /// Input: position among the inputs of the graph.
+  usize input_index;
+  /// Activation.
+  Activation activation;
+  /// Dropout.
+  f32 dropout_rate;
+} GraphOp;
+
+DECL_DA_STRUCT(GraphOp, DynArrayGraphOp);
+
+/// The result of `graph_plan` or `graph_plan_training`.
+///
+/// Ops run in topological order, ops the output doesn't depend on are left out.
+/// Activations of every op share one allocation: tensors whose lifetimes (from the op producing them to the last op
+/// reading them) don't overlap get the same memory, and elementwise ops (activation, dropout, add) write straight into
+/// an input that isn't read again afterwards.
+///
+/// For training, the tensors the backward pass reads (inputs of dense ops, outputs of activations) live until the end,
+/// and gradients get a second allocation, shared the same way over the backward pass: the gradient of a tensor lives
+/// from the last op reading it to the op producing it.
+typedef struct GraphPlan {
+  /// Maximum number of samples per `graph_forward`.
+  usize batch;
+  GraphTensor output;
+  /// Op indices in execution order.
+  usize *order;
+  usize order_len;
+  /// Per op, where its output lives, NULL for ops not in the plan. Inputs point to the caller's data during
+  /// `graph_forward`.
+  f32 **values;
+  /// Every activation of the plan, `activation_floats` long.
+  AdaF32 activations;
+  usize activation_floats;
+  /// Floats it'd take to give every tensor in the plan its own memory.
+  usize unplanned_floats;
+  /// Made by `graph_plan_training`.
+  bool training;
+  /// Every training `graph_forward` draws new dropout masks from `(dropout_seed, op, forward_count)`, which
+  /// `graph_backward` draws again rather than storing them.
+  u64 dropout_seed;
+  u64 forward_count;
+  /// Samples of the last `graph_forward`.
+  usize n;
+  /// Training only, like `values`: per op, the gradient of the loss with respect to its output, NULL for inputs.
+  /// The output's points to the caller's data during `graph_backward`.
+  f32 **grads;
+  AdaF32 grad_memory;
+  usize grad_floats;
+  /// Per op, whether no gradient was added to it yet in the current `graph_backward`.
+  bool *grad_fresh;
+  /// Training only: dropout uniforms or a gradient contribution (`batch` times the most rows of an op), then `batch`
+  /// per-sample sums.
+  AdaF32 scratch;
+} GraphPlan;
+
+/// A directed acyclic graph of ops, for models that aren't a plain stack of dense layers (residual connections,
+/// concatenated branches). `NN` keeps the fixed dense-layer loop it was tuned for, with its own training loop.
+/// An op can only take tensors of ops added before it, so the graph can't have cycles.
+///
+/// Weights come from `graph_init_weights`, `graph_dense_w` and `graph_dense_b`, or training: plan with
+/// `graph_plan_training`, then per batch `graph_zero_grads`, `graph_forward`, `graph_backward` with the gradient of the
+/// loss with respect to the output (e.g. the `delta` of `loss_fused` on a dense output), and `graph_apply_grads`.
+typedef struct Graph {
+  DynArrayGraphOp ops;
+  /// Weights and biases of every dense op.
+  AdaF32 params;
+  /// Gradients of `params`, in the same layout. Allocated by `graph_plan_training`.
+  AdaF32 grads;
+  GraphPlan plan;
+} Graph;
+
+Graph graph_new();
+
+void graph_free(Graph graph);
+
+/// An input of `rows` features.
+/// Inputs are numbered in the order they are added, see `graph_forward`.
+GraphTensor graph_input(Graph *graph, usize rows);
+
+/// Weights start out zero, see `graph_init_weights`.
+GraphTensor graph_dense(Graph *graph, GraphTensor x, usize rows);
+
+GraphTensor graph_activation(Graph *graph, GraphTensor x, Activation activation);
+
+/// Arguments: 0 <= rate < 1
+GraphTensor graph_dropout(Graph *graph, GraphTensor x, f32 rate);
+
+GraphTensor graph_add(Graph *graph, GraphTensor a, GraphTensor b);
+
+GraphTensor graph_concat(Graph *graph, GraphTensor a, GraphTensor b);
+
+/// Number of features of tensor `t`.
+usize graph_tensor_rows(const Graph *graph, GraphTensor t);
+
+/// `(rows x input rows)` weights and `(rows x 1)` biases of dense op `t`.
+/// Points into `Graph.params`, invalidated by adding another dense op.
+Mat graph_dense_w(const Graph *graph, GraphTensor t);
+Mat graph_dense_b(const Graph *graph, GraphTensor t);
+
+/// Their gradients, same shapes, once `graph_plan_training` allocated them.
+Mat graph_dense_dw(const Graph *graph, GraphTensor t);
+Mat graph_dense_db(const Graph *graph, GraphTensor t);
+
+/// Initialize the weights of every dense op with `init` and zero the biases.
+/// Each dense op draws from its own stream, so adding ops doesn't change the weights of the existing ones.
+void graph_init_weights(Graph *graph, WeightInit init, u64 seed);
+
+/// Plan the execution of everything `output` depends on, for batches of up to `batch` samples.
+/// Replaces the previous plan. Adding ops afterwards needs planning again.
+void graph_plan(Graph *graph, GraphTensor output, usize batch);
+
+/// `graph_plan` for training: keeps what `graph_backward` needs, plans the gradients, and turns dropout on with masks
+/// drawn from `dropout_seed`.
+void graph_plan_training(Graph *graph, GraphTensor output, usize batch, u64 dropout_seed);
+
+/// Run the plan on `n` (<= `batch`) samples.
+/// `inputs[i]` is a `(rows x n)` matrix for the `i`th `graph_input`, inputs the plan doesn't use can be NULL.
+/// Returns the `(output rows x n)` output, valid until the next `graph_forward`.
+/// With a training plan, the inputs must stay untouched until `graph_backward`.
+const f32 *graph_forward(Graph *graph, const f32 *const *inputs, usize n);
+
+/// Zero the gradients of every dense op.
+void graph_zero_grads(Graph *graph);
+
+/// Backpropagate the `(output rows x n)` gradient of the loss with respect to the output of the last `graph_forward`
+/// (on the same `n` samples), adding the gradients of the weights and biases to `Graph.grads`.
+/// Needs a plan from `graph_plan_training`. Inputs get no gradients.
+void graph_backward(Graph *graph, const f32 *output_grad, usize n);
+
+/// Gradient descent step: subtract `rate` times `Graph.grads` from `Graph.params`.
+void graph_apply_grads(Graph *graph, f32 rate);
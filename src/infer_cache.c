@@ -0,0 +1,132 @@
+#include "infer_cache.h"
+#include "perf_counters.h"
+
+#define INFER_CACHE_HASH_LANES 8
+
+InferCache infer_cache_new(usize inputs, usize outputs, usize capacity) {
+  ASSERT(inputs > 0 && outputs > 0);
+  usize buckets = 1;
+  while (buckets * INFER_CACHE_WAYS < capacity)
+    buckets *= 2;
+  const usize slots = buckets * INFER_CACHE_WAYS;
+  InferCache cache = {
+      .inputs = inputs,
+      .outputs = outputs,
+      .buckets = buckets,
+      .tags = xalloc(u64, slots),
+      .referenced = xalloc(u8, slots),
+      .keys = xalloc(f32, slots * inputs),
+      .values = xalloc(f32, slots * outputs),
+      .hands = xalloc(u8, buckets),
+  };
+  infer_cache_clear(&cache);
+  return cache;
+}
+
+void infer_cache_free(InferCache cache) {
+  xfree(cache.tags);
+  xfree(cache.referenced);
+  xfree(cache.keys);
+  xfree(cache.values);
+  xfree(cache.hands);
+}
+
+void infer_cache_clear(InferCache *cache) {
+  const usize slots = cache->buckets * INFER_CACHE_WAYS;
+  memset(cache->tags, 0, slots * sizeof(u64));
+  memset(cache->referenced, 0, slots);
+  memset(cache->hands, 0, cache->buckets);
+}
+
+u64 infer_cache_hash(const f32 *x, usize len) {
+  // Multiply-xorshift per 32-bit lane, which vectorizes (unlike 64-bit multiplies on x86 before AVX-512), folded into
+  // 64 bits at the end.
+  u32 lanes[INFER_CACHE_HASH_LANES];
+  for (usize j = 0; j < INFER_CACHE_HASH_LANES; ++j)
+    lanes[j] = 0x9E3779B9u * (u32)(j + 1);
+  const usize full = len / INFER_CACHE_HASH_LANES;
+  for (usize i = 0; i < full; ++i) {
+    u32 block[INFER_CACHE_HASH_LANES];
+    memcpy(block, &x[i * INFER_CACHE_HASH_LANES], sizeof(block));
+    for (usize j = 0; j < INFER_CACHE_HASH_LANES; ++j) {
+      u32 h = (lanes[j] ^ block[j]) * 0x85EBCA6Bu;
+      lanes[j] = h ^ (h >> 15);
+    }
+  }
+  for (usize j = 0; j < len % INFER_CACHE_HASH_LANES; ++j) {
+    u32 bits;
+    memcpy(&bits, &x[full * INFER_CACHE_HASH_LANES + j], sizeof(bits));
+    u32 h = (lanes[j] ^ bits) * 0x85EBCA6Bu;
+    lanes[j] = h ^ (h >> 15);
+  }
+  u64 hash = len;
+  for (usize j = 0; j < INFER_CACHE_HASH_LANES; ++j) {
+    hash = (hash ^ lanes[j]) * 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 32;
+  }
+  // splitmix64's finalizer, the low bits pick the bucket.
+  hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+  hash ^= hash >> 31;
+  return hash != INFER_CACHE_EMPTY ? hash : 1;
+}
+
+const f32 *infer_cache_lookup(InferCache *cache, const f32 *input, u64 hash) {
+  const usize first = (hash & (cache->buckets - 1)) * INFER_CACHE_WAYS;
+  for (usize slot = first; slot < first + INFER_CACHE_WAYS; ++slot) {
+    // Buckets fill in order and entries are only ever replaced, so nothing is past an empty slot.
+    if (cache->tags[slot] == INFER_CACHE_EMPTY)
+      return NULL;
+    if (cache->tags[slot] == hash &&
+        memcmp(&cache->keys[slot * cache->inputs], input, cache->inputs * sizeof(f32)) == 0) {
+      cache->referenced[slot] = 1;
+      return &cache->values[slot * cache->outputs];
+    }
+  }
+  return NULL;
+}
+
+const f32 *infer_cache_insert(InferCache *cache, const f32 *input, u64 hash, const f32 *output) {
+  const usize bucket = hash & (cache->buckets - 1);
+  const usize first = bucket * INFER_CACHE_WAYS;
+  usize slot = first;
+  while (slot < first + INFER_CACHE_WAYS && cache->tags[slot] != INFER_CACHE_EMPTY)
+    ++slot;
+  if (slot == first + INFER_CACHE_WAYS) {
+    // CLOCK, stops within two turns since every slot passed gets its bit cleared.
+    usize hand = cache->hands[bucket];
+    while (cache->referenced[first + hand]) {
+      cache->referenced[first + hand] = 0;
+      hand = (hand + 1) % INFER_CACHE_WAYS;
+    }
+    slot = first + hand;
+    cache->hands[bucket] = (u8)((hand + 1) % INFER_CACHE_WAYS);
+    ++cache->stats.evictions;
+  }
+  cache->tags[slot] = hash;
+  cache->referenced[slot] = 0;
+  memcpy(&cache->keys[slot * cache->inputs], input, cache->inputs * sizeof(f32));
+  f32 *values = &cache->values[slot * cache->outputs];
+  memcpy(values, output, cache->outputs * sizeof(f32));
+  return values;
+}
+
+const f32 *nn_forward_cached(NN nn, InferCache *cache, const f32 *input) {
+  DEBUG_ASSERT(cache->inputs == nn_input_count(nn) && cache->outputs == nn_output_count(nn));
+  const f64 start = now_seconds();
+  const u64 hash = infer_cache_hash(input, cache->inputs);
+  ++cache->stats.lookups;
+  const f32 *output = infer_cache_lookup(cache, input, hash);
+  if (output != NULL) {
+    ++cache->stats.hits;
+    cache->stats.hit_seconds += now_seconds() - start;
+    return output;
+  }
+  output = infer_cache_insert(cache, input, hash, nn_forward(nn, input));
+  cache->stats.miss_seconds += now_seconds() - start;
+  return output;
+}
+
+f64 infer_cache_hit_rate(InferCacheStats stats) {
+  return stats.lookups > 0 ? (f64)stats.hits / (f64)stats.lookups : 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+#include "nn.h"
+
+/// Slots per bucket, the longest probe of a lookup.
+#define INFER_CACHE_WAYS 8
+
+/// Marks empty slots in `InferCache.tags`, hashes are never 0.
+#define INFER_CACHE_EMPTY 0
+
+typedef struct InferCacheStats {
+  u64 lookups;
+  u64 hits;
+  /// Entries replaced to make room.
+  u64 evictions;
+  /// Wall clock spent in `nn_forward_cached`, on hits and on misses (the forward pass included).
+  f64 hit_seconds;
+  f64 miss_seconds;
+} InferCacheStats;
+
+/// Memoized outputs of a network for recently seen inputs, for inference on inputs that repeat exactly.
+///
+/// A fixed-size open-addressing table keyed by the input's bits: an input hashes to a bucket of `INFER_CACHE_WAYS`
+/// slots and is looked for there only, so a probe is bounded and the tags of a bucket share a cache line. Hashes only
+/// pick slots, a hit compares the whole input, so a collision costs a miss and never a wrong output.
+///
+/// Full buckets evict with CLOCK: a hit sets its slot's referenced bit, and the bucket's hand skips slots with the bit
+/// set (clearing it) and replaces the first without. Entries never hit again since they were inserted go first.
+///
+/// Outputs are only valid for the weights they were computed with: `infer_cache_clear` after changing them. Not thread
+/// safe, like `nn_forward`: one cache per thread.
+typedef struct InferCache {
+  usize inputs;
+  usize outputs;
+  /// Power of 2.
+  usize buckets;
+  /// Per slot (`buckets * INFER_CACHE_WAYS`): input hash or `INFER_CACHE_EMPTY`, referenced bit, input and outputs.
+  u64 *tags;
+  u8 *referenced;
+  f32 *keys;
+  f32 *values;
+  /// Per bucket, the slot CLOCK looks at first.
+  u8 *hands;
+  InferCacheStats stats;
+} InferCache;
+
+/// Room for at least `capacity` entries of `inputs` floats mapping to `outputs` floats.
+InferCache infer_cache_new(usize inputs, usize outputs, usize capacity);
+
+void infer_cache_free(InferCache cache);
+
+/// Drop every entry, e.g. after the weights changed. Stats are kept.
+void infer_cache_clear(InferCache *cache);
+
+/// Hash of the bits of `x[0..len]`, never `INFER_CACHE_EMPTY`. Reads 8 floats at a time into independent lanes.
+u64 infer_cache_hash(const f32 *x, usize len);
+
+/// Cached outputs for `input` (`hash` being `infer_cache_hash` of it), or NULL.
+/// Valid until the next `infer_cache_insert` or `infer_cache_clear`.
+const f32 *infer_cache_lookup(InferCache *cache, const f32 *input, u64 hash);
+
+/// Store `output` for `input`, evicting an entry if its bucket is full, and return the copy in the cache.
+/// `input` must not be in the cache already.
+const f32 *infer_cache_insert(InferCache *cache, const f32 *input, u64 hash, const f32 *output);
+
+/// `nn_forward` through `cache`: the cached outputs if `input` was seen, otherwise runs the network and caches them.
+/// Returns a reference into the cache, valid until the next call on `cache`.
+const f32 *nn_forward_cached(NN nn, InferCache *cache, const f32 *input);
+
+/// `hits / lookups`, 0 before any lookup.
+f64 infer_cache_hit_rate(InferCacheStats stats);
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "common.h"
+#include "mat.h"
+
+/// Loss functions, each fused with the activation of the output layer.
+///
+/// The fused kernels take the pre-activations `z` of the output layer as a row-major `(outputs x samples)` matrix (one
+/// sample per column, like the batch matrices in `nn_train`), and in one go:
+/// - overwrite `z` with the output activations,
+/// - write `delta = grad_scale * dL/dz`, already through the activation,
+/// - return the loss summed over the batch.
+/// Going straight to dL/dz skips the separate activation-derivative pass over the output layer, and lets the
+/// cross-entropy losses use the stable closed forms instead of differentiating through `log(sigmoid)`/`log(softmax)`.
+typedef enum Loss {
+  /// Sigmoid outputs, sum over outputs of (a - y)^2.
+  LOSS_MSE,
+  /// Sigmoid outputs, -(y log(a) + (1 - y) log(1 - a)) summed over outputs.
+  LOSS_BINARY_CROSS_ENTROPY,
+  /// Softmax over each sample's outputs, -sum(y log(a)).
+  /// Targets are expected to sum to 1 per sample (one-hot or a distribution).
+  LOSS_SOFTMAX_CROSS_ENTROPY,
+} Loss;
+
+typedef enum Activation {
+  ACTIVATION_SIGMOID,
+  /// Over each column.
+  ACTIVATION_SOFTMAX,
+} Activation;
+
+/// Activation the output layer must have for the loss.
+static inline Activation loss_output_activation(Loss loss) {
+  switch (loss) {
+  case LOSS_MSE:
+  case LOSS_BINARY_CROSS_ENTROPY:
+    return ACTIVATION_SIGMOID;
+  case LOSS_SOFTMAX_CROSS_ENTROPY:
+    return ACTIVATION_SOFTMAX;
+  }
+  __builtin_unreachable();
+}
+
+static inline const char *loss_name(Loss loss) {
+  switch (loss) {
+  case LOSS_MSE:
+    return "mse";
+  case LOSS_BINARY_CROSS_ENTROPY:
+    return "bce";
+  case LOSS_SOFTMAX_CROSS_ENTROPY:
+    return "softmax_ce";
+  }
+  __builtin_unreachable();
+}
+
+/// Independent partial sums of the loss, like `dot_f32` in conv.c: a single `f32` sum has to add in order, which keeps
+/// the loops from vectorizing.
+#define LOSS_LANES 8
+
+/// Sum of `TERM` over `I` in `0..LEN`, `TERM` being evaluated once per `I` in increasing order, `LOSS_LANES` at a time.
+#define LOSS_SUM_LANES_(LEN, I, TERM)                                                                                  \
+  ({                                                                                                                   \
+    const usize len_ = (LEN);                                                                                          \
+    f32 lanes_[LOSS_LANES] = {0};                                                                                      \
+    usize base_ = 0;                                                                                                   \
+    for (; base_ + LOSS_LANES <= len_; base_ += LOSS_LANES) {                                                          \
+      for (usize j_ = 0; j_ < LOSS_LANES; ++j_) {                                                                      \
+        const usize I = base_ + j_;                                                                                    \
+        lanes_[j_] += (TERM);                                                                                          \
+      }                                                                                                                \
+    }                                                                                                                  \
+    f32 sum_ = 0;                                                                                                      \
+    for (usize I = base_; I < len_; ++I)                                                                               \
+      sum_ += (TERM);                                                                                                  \
+    for (usize j_ = 0; j_ < LOSS_LANES; ++j_)                                                                          \
+      sum_ += lanes_[j_];                                                                                              \
+    sum_;                                                                                                              \
+  })
+
+static inline f32 loss_mse_at_(f32 *restrict z, const f32 *restrict y, f32 *restrict delta, usize i, f32 grad_scale) {
+  f32 a = 1 / (1 + expf_lanes(-z[i]));
+  f32 diff = a - y[i];
+  delta[i] = 2 * grad_scale * diff * a * (1 - a);
+  z[i] = a;
+  return diff * diff;
+}
+
+/// `len` is outputs * samples, MSE doesn't care about the shape.
+static inline f32 loss_mse_fused(f32 *restrict z, const f32 *restrict y, f32 *restrict delta, usize len,
+                                 f32 grad_scale) {
+  return LOSS_SUM_LANES_(len, i, loss_mse_at_(z, y, delta, i, grad_scale));
+}
+
+/// `delta[i]` holds e^-|z| on entry.
+static inline f32 loss_bce_at_(f32 *restrict z, const f32 *restrict y, f32 *restrict delta, usize i, f32 grad_scale) {
+  f32 z_ = z[i];
+  f32 e = delta[i];
+  // log1p(e) as log(u) with u = 1 + e, corrected to first order for the rounding error of u (all of e once it rounds
+  // to u = 1).
+  f32 u = 1 + e;
+  f32 log1p_e = logf_lanes(u) + (e - (u - 1)) / u;
+  // sigmoid(z) from the same exponential.
+  f32 a = (z_ >= 0 ? 1 : e) / u;
+  delta[i] = grad_scale * (a - y[i]);
+  z[i] = a;
+  return (z_ > 0 ? z_ : 0) - z_ * y[i] + log1p_e;
+}
+
+/// `len` is outputs * samples, BCE doesn't care about the shape.
+/// Computed from the logits: -(y log(sigmoid(z)) + (1 - y) log(1 - sigmoid(z))) = max(z, 0) - z y + log(1 + e^-|z|),
+/// which neither overflows nor takes log(0) for saturated outputs.
+/// The exponentials go through `delta` first: computed in the same loop, gcc folds the whole term for the clamped
+/// inputs of `expf_lanes` into constants and branches on them, which keeps the loop from vectorizing.
+static inline f32 loss_bce_fused(f32 *restrict z, const f32 *restrict y, f32 *restrict delta, usize len,
+                                 f32 grad_scale) {
+  for (usize i = 0; i < len; ++i)
+    delta[i] = expf_lanes(-fabsf(z[i]));
+  return LOSS_SUM_LANES_(len, i, loss_bce_at_(z, y, delta, i, grad_scale));
+}
+
+static inline f32 loss_softmax_ce_at_(f32 *restrict z, const f32 *restrict y, f32 *restrict delta,
+                                      const f32 *restrict lse, usize x, f32 grad_scale) {
+  f32 log_a = z[x] - lse[x];
+  f32 a = expf_lanes(log_a);
+  delta[x] = grad_scale * (a - y[x]);
+  z[x] = a;
+  return -y[x] * log_a;
+}
+
+/// `z`, `y` and `delta` are `(rows x cols)`, one sample per column.
+/// `scratch` must hold `2 * cols` floats.
+/// One pass finds the max of each column and another sums the exponentials, then a last one writes the softmax, the
+/// loss via log-sum-exp, and `delta = a - y`. That is two exponentials per element, where a single online pass would
+/// need to rescale its running sum with a third.
+/// Every pass goes row by row, so the inner loops run over contiguous columns.
+static inline f32 loss_softmax_ce_fused(f32 *restrict z, const f32 *restrict y, f32 *restrict delta, usize rows,
+                                        usize cols, f32 *restrict scratch, f32 grad_scale) {
+  f32 *col_max = scratch;
+  f32 *col_sum = &scratch[cols];
+  memcpy(col_max, z, cols * sizeof(f32));
+  for (usize r = 1; r < rows; ++r) {
+    const f32 *row = &z[r * cols];
+    for (usize x = 0; x < cols; ++x)
+      col_max[x] = row[x] > col_max[x] ? row[x] : col_max[x];
+  }
+  memset(col_sum, 0, cols * sizeof(f32));
+  for (usize r = 0; r < rows; ++r) {
+    const f32 *row = &z[r * cols];
+    for (usize x = 0; x < cols; ++x)
+      col_sum[x] += expf_lanes(row[x] - col_max[x]);
+  }
+  // Turn the sums into log-sum-exp in place, they are at least 1.
+  for (usize x = 0; x < cols; ++x)
+    col_sum[x] = col_max[x] + logf_lanes(col_sum[x]);
+  const f32 *lse = col_sum;
+  f32 loss = 0;
+  for (usize r = 0; r < rows; ++r) {
+    f32 *z_row = &z[r * cols];
+    const f32 *y_row = &y[r * cols];
+    f32 *delta_row = &delta[r * cols];
+    loss += LOSS_SUM_LANES_(cols, x, loss_softmax_ce_at_(z_row, y_row, delta_row, lse, x, grad_scale));
+  }
+  return loss;
+}
+
+/// Dispatch to the fused kernel of `loss`, see the top of this file.
+/// `scratch` must hold `2 * cols` floats.
+static inline f32 loss_fused(Loss loss, f32 *z, const f32 *y, f32 *delta, usize rows, usize cols, f32 *scratch,
+                             f32 grad_scale) {
+  switch (loss) {
+  case LOSS_MSE:
+    return loss_mse_fused(z, y, delta, rows * cols, grad_scale);
+  case LOSS_BINARY_CROSS_ENTROPY:
+    return loss_bce_fused(z, y, delta, rows * cols, grad_scale);
+  case LOSS_SOFTMAX_CROSS_ENTROPY:
+    return loss_softmax_ce_fused(z, y, delta, rows, cols, scratch, grad_scale);
+  }
+  __builtin_unreachable();
+}
@@ -0,0 +1,129 @@
+#include "mat.h"
+
+void sigmoid_mat(Mat m) {
+  for (usize i = 0; i < m.rows * m.cols; ++i) {
+    f32 *x = &m.values[i];
+    *x = sigmoidf(*x);
+  }
+}
+
+void softmax_mat(Mat m) {
+  for (usize x = 0; x < m.cols; ++x) {
+    f32 max = -INFINITY;
+    for (usize y = 0; y < m.rows; ++y)
+      max = fmaxf(max, m.values[y * m.cols + x]);
+    f32 sum = 0;
+    for (usize y = 0; y < m.rows; ++y) {
+      f32 *v = &m.values[y * m.cols + x];
+      *v = expf(*v - max);
+      sum += *v;
+    }
+    for (usize y = 0; y < m.rows; ++y)
+      m.values[y * m.cols + x] /= sum;
+  }
+}
+
+void mat_mul(Mat dest, ConstMat lhs, ConstMat rhs) {
+  // (4x3) * (3x4)
+  DEBUG_ASSERT(lhs.cols == rhs.rows);
+  DEBUG_ASSERT(dest.rows == lhs.rows);
+  DEBUG_ASSERT(dest.cols == rhs.cols);
+  for (usize y = 0; y < dest.rows; ++y) {
+    for (usize x = 0; x < dest.cols; ++x) {
+      f32 *dest_val = mat_get(dest, x, y);
+      *dest_val = 0;
+      for (usize i = 0; i < lhs.cols; ++i) {
+        *dest_val += *mat_get_(lhs, i, y) * *mat_get_(rhs, x, i);
+      }
+    }
+  }
+}
+
+void mat_add(Mat dest, ConstMat rhs) {
+  DEBUG_ASSERT(dest.cols == rhs.cols);
+  DEBUG_ASSERT(dest.rows == rhs.rows);
+  for (usize y = 0; y < dest.rows; ++y) {
+    for (usize x = 0; x < dest.cols; ++x) {
+      *mat_get(dest, x, y) += *mat_get_(rhs, x, y);
+    }
+  }
+}
+
+void mat_mul_add_rhs_t(Mat dest, ConstMat lhs, ConstMat rhs) {
+  DEBUG_ASSERT(lhs.cols == rhs.cols);
+  DEBUG_ASSERT(dest.rows == lhs.rows);
+  DEBUG_ASSERT(dest.cols == rhs.rows);
+  for (usize y = 0; y < dest.rows; ++y) {
+    for (usize x = 0; x < dest.cols; ++x) {
+      f32 *dest_val = mat_get(dest, x, y);
+      for (usize i = 0; i < lhs.cols; ++i) {
+        *dest_val += *mat_get_(lhs, i, y) * *mat_get_(rhs, i, x);
+      }
+    }
+  }
+}
+
+void mat_mul_lhs_t(Mat dest, ConstMat lhs, ConstMat rhs) {
+  DEBUG_ASSERT(lhs.rows == rhs.rows);
+  DEBUG_ASSERT(dest.rows == lhs.cols);
+  DEBUG_ASSERT(dest.cols == rhs.cols);
+  memset(dest.values, 0, dest.rows * dest.cols * sizeof(f32));
+  // i outermost so both lhs and rhs are walked row by row.
+  for (usize i = 0; i < lhs.rows; ++i) {
+    for (usize y = 0; y < dest.rows; ++y) {
+      f32 l = *mat_get_(lhs, y, i);
+      for (usize x = 0; x < dest.cols; ++x) {
+        *mat_get(dest, x, y) += l * *mat_get_(rhs, x, i);
+      }
+    }
+  }
+}
+
+void mat_add_col(Mat dest, ConstMat col) {
+  DEBUG_ASSERT(col.cols == 1);
+  DEBUG_ASSERT(dest.rows == col.rows);
+  for (usize y = 0; y < dest.rows; ++y) {
+    for (usize x = 0; x < dest.cols; ++x) {
+      *mat_get(dest, x, y) += col.values[y];
+    }
+  }
+}
+
+void mat_add_row_sums(Mat dest, ConstMat m) {
+  DEBUG_ASSERT(dest.cols == 1);
+  DEBUG_ASSERT(dest.rows == m.rows);
+  for (usize y = 0; y < m.rows; ++y) {
+    f32 sum = 0;
+    for (usize x = 0; x < m.cols; ++x) {
+      sum += *mat_get_(m, x, y);
+    }
+    dest.values[y] += sum;
+  }
+}
+
+void mat_println(Mat m) {
+  for (usize y = 0; y < m.rows; ++y) {
+    printf("[ ");
+    for (usize x = 0; x < m.cols; ++x) {
+      i32 len = printf("%.3f", *mat_get(m, x, y));
+      if (len < 8)
+        printf("%*s", 8 - len, "");
+      else if (len >= 8)
+        printf(" ");
+      if (x == m.cols - 1)
+        printf(" ]\n");
+    }
+  }
+}
+
+void mat_rand(Mat m, Rng rng, f32 floor, f32 ceil) {
+  rng_fill_uniform(rng, m.values, 0, m.rows * m.cols, floor, ceil);
+}
+
+void mat_randn(Mat m, Rng rng, f32 mean, f32 stddev) {
+  rng_fill_normal(rng, m.values, 0, m.rows * m.cols, mean, stddev);
+}
+
+void da_free_f32(DynArrayF32 *da) {
+  da_free(*da);
+}
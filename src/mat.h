@@ -0,0 +1,131 @@
+#pragma once
+
+#include "common.h"
+#include "da.h"
+#include "rng.h"
+
+DECL_DA_STRUCT(f32, DynArrayF32);
+DECL_ADA_STRUCT(f32, AdaF32);
+DECL_SLICE_STRUCT(f32, SliceF32);
+
+static inline f32 sigmoidf(f32 x) {
+  return 1 / (1 + expf(-x));
+}
+
+/// `expf` written without calls or branches, so that elementwise loops vectorize: Cody-Waite range reduction and the
+/// Cephes polynomial, within 1 ULP of `expf` where the result is a normal float.
+static inline f32 expf_lanes(f32 x) {
+  x = x < -87.3f ? -87.3f : x;
+  x = x > 88.3f ? 88.3f : x;
+  // Round to nearest by adding 1.5 * 2^23, which leaves n in the low mantissa bits.
+  f32 shifted = x * 1.44269504088896341f + 12582912.0f;
+  f32 n = shifted - 12582912.0f;
+  i32 n_bits;
+  memcpy(&n_bits, &shifted, sizeof(n_bits));
+  n_bits -= 0x4B400000;
+  f32 r = x - n * 0.693359375f + n * 2.12194440e-4f;
+  f32 p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  i32 scale_bits = (n_bits + 127) << 23;
+  f32 scale;
+  memcpy(&scale, &scale_bits, sizeof(scale));
+  return (p * r * r + r + 1) * scale;
+}
+
+/// `logf` for positive normal `x`, the same way as `expf_lanes`: the exponent is split off and the Cephes polynomial
+/// runs on the mantissa in [sqrt(1/2), sqrt(2)).
+static inline f32 logf_lanes(f32 x) {
+  u32 bits;
+  memcpy(&bits, &x, sizeof(bits));
+  // Mantissas below sqrt(2) keep their exponent, the others move to the next one: m = x / 2^e in [sqrt(1/2), sqrt(2)).
+  // Integer arithmetic only, gcc turns selects on floats back into branches once the loop body gets large.
+  u32 shifted = bits + (0x3F800000u - 0x3F3504F3u);
+  i32 e_bits = (i32)(shifted >> 23) - 127;
+  u32 m_bits = (shifted & 0x007FFFFFu) + 0x3F3504F3u;
+  f32 m;
+  memcpy(&m, &m_bits, sizeof(m));
+  f32 e = (f32)e_bits;
+  m -= 1;
+  f32 z = m * m;
+  f32 p = 7.0376836292e-2f;
+  p = p * m - 1.1514610310e-1f;
+  p = p * m + 1.1676998740e-1f;
+  p = p * m - 1.2420140846e-1f;
+  p = p * m + 1.4249322787e-1f;
+  p = p * m - 1.6668057665e-1f;
+  p = p * m + 2.0000714765e-1f;
+  p = p * m - 2.4999993993e-1f;
+  p = p * m + 3.3333331174e-1f;
+  f32 y = p * m * z - 2.12194440e-4f * e - 0.5f * z;
+  return m + y + 0.693359375f * e;
+}
+
+/// Tensor is a cringe name,
+/// I'm gonna call it Mat, short for Mattress.
+/// Does not own the data.
+typedef struct Mat {
+  f32 *values;
+  usize cols;
+  usize rows;
+} Mat;
+
+/// Tensor is a cringe name,
+/// I'm gonna call it Mat, short for Mattress.
+/// Does not own the data.
+typedef struct ConstMat {
+  const f32 *values;
+  usize cols;
+  usize rows;
+} ConstMat;
+
+DECL_DA_STRUCT(Mat, DynArrayMat);
+
+static inline f32 *mat_get(Mat m, usize x, usize y) {
+  return &m.values[y * m.cols + x];
+}
+
+static inline const f32 *mat_get_(ConstMat m, usize x, usize y) {
+  return &m.values[y * m.cols + x];
+}
+
+attribute(const, always_inline) static inline ConstMat mat_as_const(Mat m) {
+  return PTR_CAST(ConstMat, m);
+}
+
+/// Perform sigmoid on every element of a matrix.
+void sigmoid_mat(Mat m);
+
+/// Perform softmax on every column of a matrix.
+void softmax_mat(Mat m);
+
+/// SAFETY: Data of dest must not overlap with either of lhs or rhs.
+void mat_mul(Mat dest, ConstMat lhs, ConstMat rhs);
+
+void mat_add(Mat dest, ConstMat rhs);
+
+/// dest += lhs * transpose(rhs)
+/// SAFETY: Data of dest must not overlap with either of lhs or rhs.
+void mat_mul_add_rhs_t(Mat dest, ConstMat lhs, ConstMat rhs);
+
+/// dest = transpose(lhs) * rhs
+/// SAFETY: Data of dest must not overlap with either of lhs or rhs.
+void mat_mul_lhs_t(Mat dest, ConstMat lhs, ConstMat rhs);
+
+/// Add column vector `col` to every column of `dest`.
+void mat_add_col(Mat dest, ConstMat col);
+
+/// Sum every row of `m` into column vector `dest`.
+void mat_add_row_sums(Mat dest, ConstMat m);
+
+void mat_println(Mat m);
+
+/// Arguments: ceil >= floor
+void mat_rand(Mat m, Rng rng, f32 floor, f32 ceil);
+
+void mat_randn(Mat m, Rng rng, f32 mean, f32 stddev);
+
+void da_free_f32(DynArrayF32 *da);
@@ -0,0 +1,670 @@
+#include "nn.h"
+#include "norm.h"
+#include "alloc_track.h"
+#include "parallel.h"
+
+/// Number of floats of the buffers shared by even and odd layers for `NN_ACTIVATIONS_PING_PONG`.
+static void nn_ping_pong_lens(usize *layers, usize layers_count, usize lens[2]) {
+  lens[0] = 0;
+  lens[1] = 0;
+  for (usize i = 1; i < layers_count; ++i)
+    lens[(i - 1) % 2] = max(lens[(i - 1) % 2], layers[i]);
+}
+
+/// Round `len` floats up to a whole number of cache lines.
+static usize nn_pool_round(usize len) {
+  return (len + 15) / 16 * 16;
+}
+
+NN nn_new_with(usize *layers, usize layers_count, const DaConfig *pool_config, NNOptions options) {
+  ASSERT(layers_count > 1);
+  const usize m = layers_count - 1;
+  const bool per_layer = options.activations == NN_ACTIVATIONS_PER_LAYER;
+  const bool pad = options.pool_layout == NN_POOL_SEPARATE_PADDED;
+  // Normalized hidden layers have a gamma and beta, plus the running mean and variance for batch norm.
+  const usize norm_vectors = options.norm == NN_NORM_NONE ? 0 : options.norm == NN_NORM_BATCH ? 4 : 2;
+  usize ping_pong_lens[2];
+  nn_ping_pong_lens(layers, layers_count, ping_pong_lens);
+
+  // Offsets of every matrix are decided before allocating, the matrices point into the pool so it must never be
+  // reallocated afterwards.
+  usize *w_at = xalloc(usize, 7 * m);
+  usize *b_at = &w_at[m];
+  usize *a_at = &w_at[2 * m];
+  usize *norm_at = &w_at[3 * m];
+  usize pool_len = 0;
+#define PLACE(LEN)                                                                                                     \
+  ({                                                                                                                   \
+    usize at_ = pad ? nn_pool_round(pool_len) : pool_len;                                                              \
+    pool_len = at_ + (LEN);                                                                                            \
+    at_;                                                                                                               \
+  })
+  for (usize i = 1; i < layers_count; ++i) {
+    w_at[i - 1] = PLACE(layers[i - 1] * layers[i]);
+    b_at[i - 1] = PLACE(layers[i]);
+    for (usize v = 0; v < norm_vectors && i < m; ++v)
+      norm_at[v * m + i - 1] = PLACE(layers[i]);
+    if (per_layer && options.pool_layout == NN_POOL_INTERLEAVED)
+      a_at[i - 1] = PLACE(layers[i]);
+  }
+  if (per_layer && options.pool_layout != NN_POOL_INTERLEAVED)
+    for (usize i = 1; i < layers_count; ++i)
+      a_at[i - 1] = PLACE(layers[i]);
+  // After all the parameters whatever the layout, so the weights stay as densely packed as with per-layer activations.
+  usize ping_pong_at[2] = {0, 0};
+  if (!per_layer) {
+    ping_pong_at[0] = PLACE(ping_pong_lens[0]);
+    ping_pong_at[1] = PLACE(ping_pong_lens[1]);
+  }
+#undef PLACE
+  if (pad)
+    pool_len = nn_pool_round(pool_len);
+
+  NN nn = {
+      .pool = {.da_config = pool_config},
+      .activations = options.activations,
+      .pool_layout = options.pool_layout,
+      .norm = options.norm,
+      .output_activation = ACTIVATION_SIGMOID,
+  };
+  da_reserve_exact(&nn.ws, m);
+  da_reserve_exact(&nn.bs, m);
+  da_reserve_exact(&nn.as, m);
+  ada_reserve_exact(&nn.pool, pool_len);
+  ada_append_zeros(&nn.pool, pool_len);
+  for (usize i = 1; i < layers_count; ++i) {
+    usize layer = layers[i];
+    usize prev_layer = layers[i - 1];
+    da_push(&nn.ws, ((Mat){
+                        .cols = prev_layer,
+                        .rows = layer,
+                        .values = da_get(&nn.pool, w_at[i - 1]),
+                    }));
+    da_push(&nn.bs, ((Mat){
+                        .cols = 1,
+                        .rows = layer,
+                        .values = da_get(&nn.pool, b_at[i - 1]),
+                    }));
+    da_push(&nn.as, ((Mat){
+                        .cols = 1,
+                        .rows = layer,
+                        .values = da_get(&nn.pool, per_layer ? a_at[i - 1] : ping_pong_at[(i - 1) % 2]),
+                    }));
+  }
+  DynArrayMat *norm_mats[] = {&nn.gammas, &nn.betas, &nn.running_means, &nn.running_vars};
+  for (usize v = 0; v < norm_vectors; ++v) {
+    da_reserve_exact(norm_mats[v], m - 1);
+    for (usize i = 1; i < m; ++i)
+      da_push(norm_mats[v], ((Mat){.cols = 1, .rows = layers[i], .values = da_get(&nn.pool, norm_at[v * m + i - 1])}));
+  }
+  // Identity until trained: gamma 1, beta 0, and a running variance of 1.
+  for (usize i = 0; i < nn.gammas.da_len; ++i)
+    for (usize r = 0; r < layers[i + 1]; ++r)
+      da_get(&nn.gammas, i)->values[r] = 1;
+  for (usize i = 0; i < nn.running_vars.da_len; ++i)
+    for (usize r = 0; r < layers[i + 1]; ++r)
+      da_get(&nn.running_vars, i)->values[r] = 1;
+  xfree(w_at);
+  return nn;
+}
+
+NN nn_new_in(usize *layers, usize layers_count, const DaConfig *pool_config) {
+  return nn_new_with(layers, layers_count, pool_config, (NNOptions){0});
+}
+
+NN nn_new(usize *layers, usize layers_count) {
+  return nn_new_in(layers, layers_count, &DA_CONFIG_CACHE_ALIGNED);
+}
+
+NNOptions nn_options(NN nn) {
+  return (NNOptions){
+      .activations = nn.activations,
+      .pool_layout = nn.pool_layout,
+      .norm = nn.norm,
+  };
+}
+
+NN nn_clone_in(NN nn, const DaConfig *pool_config) {
+  usize layers_count = nn_layer_count(nn) + 1;
+  usize *layers = xalloc(usize, layers_count);
+  layers[0] = nn_input_count(nn);
+  for (usize l = 0; l < nn_layer_count(nn); ++l)
+    layers[l + 1] = nn_neuron_count_in_layer(nn, l);
+  NN clone = nn_new_with(layers, layers_count, pool_config, nn_options(nn));
+  xfree(layers);
+  clone.output_activation = nn.output_activation;
+  memcpy(clone.pool.da_items, nn.pool.da_items, nn.pool.da_len * sizeof(f32));
+  return clone;
+}
+
+void nn_free(NN nn) {
+  ada_free(nn.pool);
+  da_free(nn.ws);
+  da_free(nn.bs);
+  da_free(nn.as);
+  da_free(nn.gammas);
+  da_free(nn.betas);
+  da_free(nn.running_means);
+  da_free(nn.running_vars);
+}
+
+usize nn_layer_count(NN nn) {
+  return nn.as.da_len;
+}
+
+usize nn_input_count(NN nn) {
+  return da_get(&nn.ws, 0)->cols;
+}
+
+usize nn_neuron_count_in_layer(NN nn, usize layer) {
+  return da_get(&nn.as, layer)->rows;
+}
+
+usize nn_output_count(NN nn) {
+  return nn_neuron_count_in_layer(nn, nn_layer_count(nn) - 1);
+}
+
+void nn_layer_forward_linear(NN nn, usize l, Mat z, ConstMat a_prev) {
+  ConstMat w = mat_as_const(*da_get(&nn.ws, l));
+  ConstMat b = mat_as_const(*da_get(&nn.bs, l));
+  mat_mul(z, w, a_prev);
+  mat_add_col(z, b);
+}
+
+/// Whether layer `l` normalizes its pre-activations, only hidden layers do.
+static bool nn_layer_is_normalized(NN nn, usize l) {
+  return nn.norm != NN_NORM_NONE && l + 1 < nn_layer_count(nn);
+}
+
+void nn_layer_forward(NN nn, usize l, Mat a, ConstMat a_prev) {
+  nn_layer_forward_linear(nn, l, a, a_prev);
+  if (nn_layer_is_normalized(nn, l)) {
+    ConstMat gamma = mat_as_const(*da_get(&nn.gammas, l));
+    ConstMat beta = mat_as_const(*da_get(&nn.betas, l));
+    if (nn.norm == NN_NORM_BATCH)
+      batch_norm_forward_infer(a, gamma, beta, mat_as_const(*da_get(&nn.running_means, l)),
+                               mat_as_const(*da_get(&nn.running_vars, l)));
+    else
+      layer_norm_forward(a, (Mat){0}, (Mat){0}, gamma, beta);
+  }
+  if (l == nn_layer_count(nn) - 1 && nn.output_activation == ACTIVATION_SOFTMAX)
+    softmax_mat(a);
+  else
+    sigmoid_mat(a);
+}
+
+const f32 *nn_forward(NN nn, const f32 *input) {
+  ConstMat a0 = {
+      .cols = 1,
+      .rows = nn_input_count(nn),
+      .values = input,
+  };
+  for (usize l = 0; l < nn_layer_count(nn); ++l) {
+    ConstMat a_ = l == 0 ? a0 : mat_as_const(*da_get(&nn.as, l - 1)); // a previous layer
+    nn_layer_forward(nn, l, *da_get(&nn.as, l), a_);
+  }
+  Mat out = *da_get(&nn.as, nn.as.da_len - 1);
+  return out.values;
+}
+
+usize nn_activation_len(NN nn) {
+  usize lens[2] = {0, 0};
+  for (usize l = 0; l < nn_layer_count(nn); ++l)
+    lens[l % 2] = max(lens[l % 2], nn_neuron_count_in_layer(nn, l));
+  return lens[0] + lens[1];
+}
+
+const f32 *nn_forward_scratch(NN nn, f32 *activations, const f32 *input) {
+  ConstMat a_ = {
+      .cols = 1,
+      .rows = nn_input_count(nn),
+      .values = input,
+  };
+  // Ping-pong between the two halves, the even layers' half is as wide as the widest even layer.
+  usize even_len = 0;
+  for (usize l = 0; l < nn_layer_count(nn); l += 2)
+    even_len = max(even_len, nn_neuron_count_in_layer(nn, l));
+  for (usize l = 0; l < nn_layer_count(nn); ++l) {
+    Mat a = {.cols = 1, .rows = nn_neuron_count_in_layer(nn, l), .values = &activations[l % 2 == 0 ? 0 : even_len]};
+    nn_layer_forward(nn, l, a, a_);
+    a_ = mat_as_const(a);
+  }
+  return a_.values;
+}
+
+void weight_init_fill(WeightInit init, Rng rng, f32 *dst, usize begin, usize end, usize fan_in_, usize fan_out_) {
+  f32 fan_in = (f32)fan_in_;
+  f32 fan_out = (f32)fan_out_;
+  switch (init) {
+  case WEIGHT_INIT_XAVIER_UNIFORM: {
+    f32 limit = sqrtf(6 / (fan_in + fan_out));
+    rng_fill_uniform(rng, dst, begin, end, -limit, limit);
+  } break;
+  case WEIGHT_INIT_XAVIER_NORMAL:
+    rng_fill_normal(rng, dst, begin, end, 0, sqrtf(2 / (fan_in + fan_out)));
+    break;
+  case WEIGHT_INIT_HE_UNIFORM: {
+    f32 limit = sqrtf(6 / fan_in);
+    rng_fill_uniform(rng, dst, begin, end, -limit, limit);
+  } break;
+  case WEIGHT_INIT_HE_NORMAL:
+    rng_fill_normal(rng, dst, begin, end, 0, sqrtf(2 / fan_in));
+    break;
+  }
+}
+
+typedef struct NNInitCtx {
+  NN *nn;
+  WeightInit init;
+  u64 seed;
+} NNInitCtx;
+
+/// Fill weights `begin..end`, indexed as if all the weight matrices were concatenated.
+static void nn_init_weights_range(void *ctx_, usize begin, usize end) {
+  NNInitCtx *ctx = ctx_;
+  usize offset = 0;
+  for (usize l = 0; l < nn_layer_count(*ctx->nn) && offset < end; ++l) {
+    Mat w = *da_get(&ctx->nn->ws, l);
+    usize len = w.rows * w.cols;
+    usize lo = max(begin, offset);
+    usize hi = min(end, offset + len);
+    offset += len;
+    if (lo >= hi)
+      continue;
+    // Streams are per layer and indices are within the matrix, so the values don't depend on the pool layout either.
+    Rng rng = {.seed = ctx->seed, .stream = l};
+    usize i = lo - (offset - len);
+    usize j = hi - (offset - len);
+    weight_init_fill(ctx->init, rng, &w.values[i], i, j, w.cols, w.rows);
+  }
+}
+
+void nn_init_weights(NN *nn, WeightInit init, u64 seed, usize n_threads) {
+  usize n_weights = 0;
+  for (usize l = 0; l < nn_layer_count(*nn); ++l) {
+    Mat w = *da_get(&nn->ws, l);
+    n_weights += w.rows * w.cols;
+    Mat b = *da_get(&nn->bs, l);
+    memset(b.values, 0, b.rows * b.cols * sizeof(f32));
+  }
+  NNInitCtx ctx = {
+      .nn = nn,
+      .init = init,
+      .seed = seed,
+  };
+  parallel_for(n_weights, n_threads, 1 << 14, nn_init_weights_range, &ctx);
+}
+
+static bool training_context_is_checkpoint(const TrainingContext *ctx, usize layer_count, usize l) {
+  usize k = max(ctx->checkpoint_every, (usize)1);
+  return l % k == k - 1 || l == layer_count - 1;
+}
+
+usize training_context_activation_floats(const TrainingContext *ctx, NN nn) {
+  usize floats = 0;
+  for (usize l = 0; l < nn_layer_count(nn); ++l)
+    if (training_context_is_checkpoint(ctx, nn_layer_count(nn), l))
+      floats += nn_neuron_count_in_layer(nn, l);
+  for (usize i = 0; i < ctx->segment.da_len; ++i)
+    floats += da_get(&ctx->segment, i)->rows;
+  for (usize l = 0; l < ctx->norm_xhats.da_len; ++l)
+    if (da_get(&ctx->norm_xhats, l)->values != NULL)
+      floats += da_get(&ctx->norm_xhats, l)->rows;
+  for (usize i = 0; i < ctx->norm_segment.da_len; ++i)
+    floats += da_get(&ctx->norm_segment, i)->rows;
+  return floats;
+}
+
+TrainingContext training_context_new(NN nn, Loss loss, usize batch, usize checkpoint_every) {
+  ASSERT(batch > 0);
+  ASSERT_PRINTF(nn.output_activation == loss_output_activation(loss), "output activation doesn't match loss %s\n",
+                loss_name(loss));
+  const usize m = nn_layer_count(nn);
+  TrainingContext ctx = {
+      .loss = loss,
+      .batch = batch,
+      .checkpoint_every = checkpoint_every,
+  };
+  usize k = max(checkpoint_every, (usize)1);
+  usize widest = 0;
+  for (usize l = 0; l < m; ++l)
+    widest = max(widest, nn_neuron_count_in_layer(nn, l));
+
+  // Normalized layers keep the normalized pre-activations next to their activations, following the same checkpoints.
+  const bool norm = nn.norm != NN_NORM_NONE;
+  usize pool_len = 0;
+  for (usize l = 0; l < m; ++l) {
+    usize neurons = nn_neuron_count_in_layer(nn, l);
+    pool_len += da_get(&nn.ws, l)->rows * da_get(&nn.ws, l)->cols + neurons;
+    if (training_context_is_checkpoint(&ctx, m, l))
+      pool_len += neurons * batch;
+    if (norm && l + 1 < m) {
+      pool_len += 2 * neurons;
+      pool_len += nn.norm == NN_NORM_BATCH ? neurons : batch;
+      if (training_context_is_checkpoint(&ctx, m, l))
+        pool_len += neurons * batch;
+    }
+  }
+  pool_len += (k - 1) * widest * batch;
+  if (norm)
+    pool_len += (k - 1) * widest * batch;
+  pool_len += (2 * nn_input_count(nn) + nn_output_count(nn)) * batch;
+  pool_len += 2 * widest * batch;
+  pool_len += 2 * batch;
+  // The matrices point into the pool so it must never be reallocated afterwards.
+  ctx.pool.da_config = nn.pool.da_config;
+  ada_reserve_exact(&ctx.pool, pool_len);
+  ada_append_zeros(&ctx.pool, pool_len);
+
+  usize idx = 0;
+#define TAKE(ROWS, COLS)                                                                                               \
+  ({                                                                                                                   \
+    Mat m_ = {.rows = (ROWS), .cols = (COLS), .values = da_get(&ctx.pool, idx)};                                       \
+    idx += m_.rows * m_.cols;                                                                                          \
+    m_;                                                                                                                \
+  })
+  da_reserve_exact(&ctx.dws, m);
+  da_reserve_exact(&ctx.dbs, m);
+  da_reserve_exact(&ctx.checkpoints, m);
+  for (usize l = 0; l < m; ++l) {
+    Mat w = *da_get(&nn.ws, l);
+    usize neurons = nn_neuron_count_in_layer(nn, l);
+    da_push(&ctx.dws, TAKE(w.rows, w.cols));
+    da_push(&ctx.dbs, TAKE(neurons, 1));
+    if (training_context_is_checkpoint(&ctx, m, l))
+      da_push(&ctx.checkpoints, TAKE(neurons, batch));
+    else
+      da_push(&ctx.checkpoints, ((Mat){.rows = neurons, .cols = batch, .values = NULL}));
+  }
+  if (k > 1)
+    da_reserve_exact(&ctx.segment, k - 1);
+  for (usize i = 0; i + 1 < k; ++i)
+    da_push(&ctx.segment, TAKE(widest, batch));
+  if (norm) {
+    da_reserve_exact(&ctx.dgammas, m - 1);
+    da_reserve_exact(&ctx.dbetas, m - 1);
+    da_reserve_exact(&ctx.norm_xhats, m - 1);
+    da_reserve_exact(&ctx.norm_inv_stds, m - 1);
+    for (usize l = 0; l + 1 < m; ++l) {
+      usize neurons = nn_neuron_count_in_layer(nn, l);
+      da_push(&ctx.dgammas, TAKE(neurons, 1));
+      da_push(&ctx.dbetas, TAKE(neurons, 1));
+      if (nn.norm == NN_NORM_BATCH)
+        da_push(&ctx.norm_inv_stds, TAKE(neurons, 1));
+      else
+        da_push(&ctx.norm_inv_stds, TAKE(1, batch));
+      if (training_context_is_checkpoint(&ctx, m, l))
+        da_push(&ctx.norm_xhats, TAKE(neurons, batch));
+      else
+        da_push(&ctx.norm_xhats, ((Mat){.rows = neurons, .cols = batch, .values = NULL}));
+    }
+    if (k > 1)
+      da_reserve_exact(&ctx.norm_segment, k - 1);
+    for (usize i = 0; i + 1 < k; ++i)
+      da_push(&ctx.norm_segment, TAKE(widest, batch));
+  }
+  ctx.x = TAKE(nn_input_count(nn), batch);
+  ctx.y = TAKE(nn_output_count(nn), batch);
+  ctx.dx = TAKE(nn_input_count(nn), batch);
+  ctx.delta = TAKE(widest, batch);
+  ctx.delta_prev = TAKE(widest, batch);
+  ctx.loss_scratch = TAKE(2, batch);
+#undef TAKE
+  DEBUG_ASSERT(idx == pool_len);
+  return ctx;
+}
+
+void training_context_free(TrainingContext ctx) {
+  ada_free(ctx.pool);
+  da_free(ctx.dws);
+  da_free(ctx.dbs);
+  da_free(ctx.checkpoints);
+  da_free(ctx.segment);
+  da_free(ctx.dgammas);
+  da_free(ctx.dbetas);
+  da_free(ctx.norm_xhats);
+  da_free(ctx.norm_segment);
+  da_free(ctx.norm_inv_stds);
+}
+
+/// Activations of layer `l` for a batch of `n` samples, either a checkpoint or a segment buffer.
+static Mat training_context_activation(TrainingContext *ctx, NN nn, usize l, usize n) {
+  usize k = max(ctx->checkpoint_every, (usize)1);
+  usize neurons = nn_neuron_count_in_layer(nn, l);
+  f32 *values = training_context_is_checkpoint(ctx, nn_layer_count(nn), l) ? da_get(&ctx->checkpoints, l)->values
+                                                                           : da_get(&ctx->segment, l % k)->values;
+  return (Mat){.rows = neurons, .cols = n, .values = values};
+}
+
+/// Input to layer `l`, i.e. activations of layer `l - 1`, or the training inputs for `l == 0`.
+static ConstMat training_context_layer_input(TrainingContext *ctx, NN nn, usize l, usize n) {
+  if (l == 0)
+    return (ConstMat){.rows = ctx->x.rows, .cols = n, .values = ctx->x.values};
+  return mat_as_const(training_context_activation(ctx, nn, l - 1, n));
+}
+
+/// Normalized pre-activations of hidden layer `l` for a batch of `n` samples, kept like `training_context_activation`.
+static Mat training_context_xhat(TrainingContext *ctx, NN nn, usize l, usize n) {
+  usize k = max(ctx->checkpoint_every, (usize)1);
+  usize neurons = nn_neuron_count_in_layer(nn, l);
+  f32 *values = training_context_is_checkpoint(ctx, nn_layer_count(nn), l) ? da_get(&ctx->norm_xhats, l)->values
+                                                                           : da_get(&ctx->norm_segment, l % k)->values;
+  return (Mat){.rows = neurons, .cols = n, .values = values};
+}
+
+/// `nn_layer_forward` of hidden layer `l` with the statistics of the batch, keeping what the backward pass of the
+/// normalization needs. The running statistics only move with `update_running`, so recomputing a segment doesn't
+/// count its batch twice.
+static void nn_layer_forward_train(NN nn, TrainingContext *ctx, usize l, usize n, bool update_running) {
+  Mat a = training_context_activation(ctx, nn, l, n);
+  if (!nn_layer_is_normalized(nn, l)) {
+    nn_layer_forward(nn, l, a, training_context_layer_input(ctx, nn, l, n));
+    return;
+  }
+  nn_layer_forward_linear(nn, l, a, training_context_layer_input(ctx, nn, l, n));
+  Mat xhat = training_context_xhat(ctx, nn, l, n);
+  Mat inv_std = *da_get(&ctx->norm_inv_stds, l);
+  ConstMat gamma = mat_as_const(*da_get(&nn.gammas, l));
+  ConstMat beta = mat_as_const(*da_get(&nn.betas, l));
+  if (nn.norm == NN_NORM_BATCH) {
+    batch_norm_forward_train(a, xhat, inv_std, gamma, beta, *da_get(&nn.running_means, l),
+                             *da_get(&nn.running_vars, l), update_running ? NN_BATCH_NORM_MOMENTUM : 0);
+  } else {
+    inv_std.cols = n;
+    layer_norm_forward(a, xhat, inv_std, gamma, beta);
+  }
+  sigmoid_mat(a);
+}
+
+f32 nn_backprop_batch(NN nn, TrainingContext *ctx, usize n, f32 grad_scale) {
+  const usize m = nn_layer_count(nn);
+  const usize k = max(ctx->checkpoint_every, (usize)1);
+
+  for (usize l = 0; l + 1 < m; ++l)
+    nn_layer_forward_train(nn, ctx, l, n, true);
+
+  // The output activation is fused into the loss, which leaves dL/dz of the output layer in `delta`.
+  Mat out = training_context_activation(ctx, nn, m - 1, n);
+  nn_layer_forward_linear(nn, m - 1, out, training_context_layer_input(ctx, nn, m - 1, n));
+  Mat delta = {.rows = out.rows, .cols = n, .values = ctx->delta.values};
+  f32 loss = loss_fused(ctx->loss, out.values, ctx->y.values, delta.values, out.rows, n, ctx->loss_scratch.values,
+                        grad_scale);
+
+  // Segments are walked last to first, the last segment's inner activations are still there from the forward pass.
+  for (usize seg_begin = (m - 1) / k * k; seg_begin != SIZE_MAX; seg_begin -= k) {
+    usize seg_end = min(seg_begin + k, m);
+    if (seg_end != m) {
+      for (usize l = seg_begin; l + 1 < seg_end; ++l)
+        nn_layer_forward_train(nn, ctx, l, n, false);
+    }
+    for (usize l = seg_end - 1; l >= seg_begin && l != SIZE_MAX; --l) {
+      Mat a = training_context_activation(ctx, nn, l, n);
+      ConstMat a_prev = training_context_layer_input(ctx, nn, l, n);
+      // dL/dz = dL/da * sigmoid'(z), sigmoid'(z) = a (1 - a).
+      if (l != m - 1)
+        for (usize i = 0; i < a.rows * n; ++i)
+          delta.values[i] *= a.values[i] * (1 - a.values[i]);
+      if (nn_layer_is_normalized(nn, l)) {
+        ConstMat xhat = mat_as_const(training_context_xhat(ctx, nn, l, n));
+        Mat inv_std = *da_get(&ctx->norm_inv_stds, l);
+        ConstMat gamma = mat_as_const(*da_get(&nn.gammas, l));
+        Mat dgamma = *da_get(&ctx->dgammas, l);
+        Mat dbeta = *da_get(&ctx->dbetas, l);
+        if (nn.norm == NN_NORM_BATCH) {
+          batch_norm_backward(delta, xhat, mat_as_const(inv_std), gamma, dgamma, dbeta);
+        } else {
+          inv_std.cols = n;
+          layer_norm_backward(delta, xhat, mat_as_const(inv_std), gamma, dgamma, dbeta);
+        }
+      }
+      mat_mul_add_rhs_t(*da_get(&ctx->dws, l), mat_as_const(delta), a_prev);
+      mat_add_row_sums(*da_get(&ctx->dbs, l), mat_as_const(delta));
+      if (l == 0) {
+        if (ctx->input_grad)
+          mat_mul_lhs_t((Mat){.rows = ctx->dx.rows, .cols = n, .values = ctx->dx.values},
+                        mat_as_const(*da_get(&nn.ws, 0)), mat_as_const(delta));
+        break;
+      }
+      Mat delta_prev = {.rows = a_prev.rows, .cols = n, .values = ctx->delta_prev.values};
+      mat_mul_lhs_t(delta_prev, mat_as_const(*da_get(&nn.ws, l)), mat_as_const(delta));
+      Mat tmp = ctx->delta;
+      ctx->delta = ctx->delta_prev;
+      ctx->delta_prev = tmp;
+      delta = delta_prev;
+    }
+    if (seg_begin == 0)
+      break;
+  }
+  return loss;
+}
+
+void training_context_load_batch(TrainingContext *ctx, NN nn, const f32 *data, const usize *order, usize begin,
+                                 usize batch) {
+  const usize inputs = nn_input_count(nn);
+  const usize outputs = nn_output_count(nn);
+  const usize stride = inputs + outputs;
+  // Samples are rows in `data` but columns in the batch matrices.
+  for (usize s = 0; s < batch; ++s) {
+    const f32 *sample = &data[(order != NULL ? order[begin + s] : begin + s) * stride];
+    for (usize j = 0; j < inputs; ++j)
+      ctx->x.values[j * batch + s] = sample[j];
+    for (usize j = 0; j < outputs; ++j)
+      ctx->y.values[j * batch + s] = sample[inputs + j];
+  }
+}
+
+f32 nn_evaluate(NN nn, TrainingContext *ctx, const f32 *data, usize data_len) {
+  const usize stride = nn_input_count(nn) + nn_output_count(nn);
+  const usize n = data_len / stride;
+  const usize m = nn_layer_count(nn);
+  ASSERT(data_len % stride == 0);
+  ASSERT(n > 0);
+
+  f32 loss = 0;
+  for (usize begin = 0; begin < n; begin += ctx->batch) {
+    usize batch = min(ctx->batch, n - begin);
+    training_context_load_batch(ctx, nn, data, NULL, begin, batch);
+    for (usize l = 0; l + 1 < m; ++l)
+      nn_layer_forward(nn, l, training_context_activation(ctx, nn, l, batch),
+                       training_context_layer_input(ctx, nn, l, batch));
+    Mat out = training_context_activation(ctx, nn, m - 1, batch);
+    nn_layer_forward_linear(nn, m - 1, out, training_context_layer_input(ctx, nn, m - 1, batch));
+    // Zero `grad_scale`, `delta` is only scratch here.
+    loss += loss_fused(ctx->loss, out.values, ctx->y.values, ctx->delta.values, out.rows, batch,
+                       ctx->loss_scratch.values, 0);
+  }
+  return loss / n;
+}
+
+void training_context_zero_grads(TrainingContext *ctx) {
+  for (usize l = 0; l < ctx->dws.da_len; ++l) {
+    Mat dw = *da_get(&ctx->dws, l);
+    Mat db = *da_get(&ctx->dbs, l);
+    memset(dw.values, 0, dw.rows * dw.cols * sizeof(f32));
+    memset(db.values, 0, db.rows * db.cols * sizeof(f32));
+  }
+  for (usize l = 0; l < ctx->dgammas.da_len; ++l) {
+    memset(da_get(&ctx->dgammas, l)->values, 0, da_get(&ctx->dgammas, l)->rows * sizeof(f32));
+    memset(da_get(&ctx->dbetas, l)->values, 0, da_get(&ctx->dbetas, l)->rows * sizeof(f32));
+  }
+}
+
+void nn_apply_grads(NN *nn, const TrainingContext *ctx, f32 rate) {
+  for (usize l = 0; l < nn_layer_count(*nn); ++l) {
+    Mat w = *da_get(&nn->ws, l);
+    Mat b = *da_get(&nn->bs, l);
+    Mat dw = *da_get(&ctx->dws, l);
+    Mat db = *da_get(&ctx->dbs, l);
+    for (usize j = 0; j < w.rows * w.cols; ++j)
+      w.values[j] -= rate * dw.values[j];
+    for (usize j = 0; j < b.rows; ++j)
+      b.values[j] -= rate * db.values[j];
+  }
+  for (usize l = 0; l < ctx->dgammas.da_len; ++l) {
+    Mat gamma = *da_get(&nn->gammas, l);
+    Mat beta = *da_get(&nn->betas, l);
+    Mat dgamma = *da_get(&ctx->dgammas, l);
+    Mat dbeta = *da_get(&ctx->dbetas, l);
+    for (usize j = 0; j < gamma.rows; ++j) {
+      gamma.values[j] -= rate * dgamma.values[j];
+      beta.values[j] -= rate * dbeta.values[j];
+    }
+  }
+}
+
+f32 nn_train(NN *nn, TrainingContext *ctx, const f32 *training_data, usize training_data_len, f32 rate) {
+  const usize stride = nn_input_count(*nn) + nn_output_count(*nn);
+  const usize n = training_data_len / stride;
+  ASSERT(training_data_len % stride == 0);
+  ASSERT(n > 0);
+
+  ALLOC_TRACK_STEP_BEGIN();
+  training_context_zero_grads(ctx);
+  f32 loss = 0;
+  for (usize begin = 0; begin < n; begin += ctx->batch) {
+    usize batch = min(ctx->batch, n - begin);
+    training_context_load_batch(ctx, *nn, training_data, NULL, begin, batch);
+    loss += nn_backprop_batch(*nn, ctx, batch, 1 / (f32)n);
+  }
+  nn_apply_grads(nn, ctx, rate);
+  ALLOC_TRACK_STEP_END();
+  return loss / n;
+}
+
+NN nn_fold_batch_norm(NN nn, const DaConfig *pool_config) {
+  ASSERT(nn.norm == NN_NORM_BATCH);
+  const usize m = nn_layer_count(nn);
+  usize *layers = xalloc(usize, m + 1);
+  layers[0] = nn_input_count(nn);
+  for (usize l = 0; l < m; ++l)
+    layers[l + 1] = nn_neuron_count_in_layer(nn, l);
+  NNOptions options = nn_options(nn);
+  options.norm = NN_NORM_NONE;
+  NN folded = nn_new_with(layers, m + 1, pool_config, options);
+  xfree(layers);
+  folded.output_activation = nn.output_activation;
+
+  for (usize l = 0; l < m; ++l) {
+    Mat w = *da_get(&nn.ws, l);
+    Mat b = *da_get(&nn.bs, l);
+    Mat folded_w = *da_get(&folded.ws, l);
+    Mat folded_b = *da_get(&folded.bs, l);
+    if (l + 1 == m) {
+      memcpy(folded_w.values, w.values, w.rows * w.cols * sizeof(f32));
+      memcpy(folded_b.values, b.values, b.rows * sizeof(f32));
+      continue;
+    }
+    // gamma * (W x + b - mean) / std + beta = (s W) x + s (b - mean) + beta, with s = gamma / std.
+    const f32 *gamma = da_get(&nn.gammas, l)->values;
+    const f32 *beta = da_get(&nn.betas, l)->values;
+    const f32 *mean = da_get(&nn.running_means, l)->values;
+    const f32 *var = da_get(&nn.running_vars, l)->values;
+    for (usize r = 0; r < w.rows; ++r) {
+      f32 s = gamma[r] / sqrtf(var[r] + NORM_EPSILON);
+      for (usize c = 0; c < w.cols; ++c)
+        folded_w.values[r * w.cols + c] = s * w.values[r * w.cols + c];
+      folded_b.values[r] = s * (b.values[r] - mean[r]) + beta[r];
+    }
+  }
+  return folded;
+}
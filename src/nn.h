@@ -0,0 +1,226 @@
+#pragma once
+
+#include "common.h"
+#include "da.h"
+#include "mat.h"
+#include "loss.h"
+
+/// Where `nn_forward` keeps the activations of every layer.
+typedef enum NNActivations {
+  /// One buffer per layer, every layer's activations stay around after `nn_forward`.
+  NN_ACTIVATIONS_PER_LAYER,
+  /// Only two layers are live at once during `nn_forward`, so even layers share one buffer and odd layers share
+  /// another, each sized to the widest layer using it. Only the output layer is meaningful after `nn_forward`.
+  /// For inference, training keeps its own activations in `TrainingContext` either way.
+  NN_ACTIVATIONS_PING_PONG,
+} NNActivations;
+
+/// How `NN.pool` is laid out.
+typedef enum NNPoolLayout {
+  /// Every layer's weights, biases and (with `NN_ACTIVATIONS_PER_LAYER`) activations next to each other.
+  NN_POOL_INTERLEAVED,
+  /// All the weights and biases first, then all the activations, so the parameters are one contiguous region that
+  /// `nn_forward` only reads.
+  NN_POOL_SEPARATE,
+  /// `NN_POOL_SEPARATE` with every matrix starting on its own cache line, so no line holds both parameters and
+  /// activations, or parts of two matrices.
+  NN_POOL_SEPARATE_PADDED,
+} NNPoolLayout;
+
+/// Normalization of the pre-activations of every hidden layer, see `norm.h`.
+typedef enum NNNorm {
+  NN_NORM_NONE,
+  /// Batch statistics while training, running averages of them at inference.
+  NN_NORM_BATCH,
+  NN_NORM_LAYER,
+} NNNorm;
+
+/// Fraction of the batch statistics blended into the running ones at every training batch.
+#define NN_BATCH_NORM_MOMENTUM 0.1f
+
+/// Construction options of `nn_new_with`, zero for the defaults of `nn_new_in`.
+typedef struct NNOptions {
+  NNActivations activations;
+  NNPoolLayout pool_layout;
+  NNNorm norm;
+} NNOptions;
+
+typedef struct NN {
+  /// A pool of floats.
+  AdaF32 pool;
+  DynArrayMat ws;
+  DynArrayMat bs;
+  /// `NN.pool` slices for `NN_ACTIVATIONS_PER_LAYER`, aliasing each other for `NN_ACTIVATIONS_PING_PONG`.
+  DynArrayMat as;
+  NNActivations activations;
+  NNPoolLayout pool_layout;
+  NNNorm norm;
+  /// `(neurons x 1)` per hidden layer, empty without normalization. Scale and shift of the normalized pre-activations,
+  /// trained like the biases.
+  DynArrayMat gammas;
+  DynArrayMat betas;
+  /// `(neurons x 1)` per hidden layer for `NN_NORM_BATCH`, empty otherwise. Not trained, updated by every training
+  /// batch's forward pass.
+  DynArrayMat running_means;
+  DynArrayMat running_vars;
+  /// Activation of the output layer, hidden layers are always sigmoid.
+  /// Must match `loss_output_activation` of the loss it's trained with.
+  Activation output_activation;
+} NN;
+
+/// The first layer is the number of inputs.
+/// Must have at least 2 layers (0th layer for input and 1 layer of neurons).
+/// `pool_config` decides where `NN.pool` (and the `TrainingContext` of this network) is allocated, must outlive the
+/// network.
+NN nn_new_in(usize *layers, usize layers_count, const DaConfig *pool_config);
+
+/// `nn_new_in`, with `options.activations` deciding the layout of `NN.as`, `options.pool_layout` the order of
+/// `NN.pool` and `options.norm` the normalization of the hidden layers.
+NN nn_new_with(usize *layers, usize layers_count, const DaConfig *pool_config, NNOptions options);
+
+/// `nn_new_in` with the pool in cache line aligned heap memory.
+NN nn_new(usize *layers, usize layers_count);
+
+/// Options `nn` was created with.
+NNOptions nn_options(NN nn);
+
+/// Deep copy with the pool allocated through `pool_config`, keeping the options.
+/// The pool is written by the calling thread, so under first-touch NUMA policy the copy lives on the caller's node.
+NN nn_clone_in(NN nn, const DaConfig *pool_config);
+
+void nn_free(NN nn);
+
+/// Not including input layer.
+usize nn_layer_count(NN nn);
+
+/// Number of inputs of a neuron network.
+usize nn_input_count(NN nn);
+
+/// Number of neuron in layer in a neural network.
+/// `layer` does not include inputs.
+usize nn_neuron_count_in_layer(NN nn, usize layer);
+
+/// Number of inputs of a neuron network.
+usize nn_output_count(NN nn);
+
+/// Compute the pre-activations of layer `l` for every column of `a_prev`, writing into `z`.
+/// SAFETY: `z` must not overlap with `a_prev`.
+void nn_layer_forward_linear(NN nn, usize l, Mat z, ConstMat a_prev);
+
+/// Compute layer `l` for every column of `a_prev`, writing into `a`.
+/// SAFETY: `a` must not overlap with `a_prev`.
+void nn_layer_forward(NN nn, usize l, Mat a, ConstMat a_prev);
+
+/// SAFETY: `input` must be an array of same number of elements as input layer.
+/// Returns reference to the last layer (output layer).
+const f32 *nn_forward(NN nn, const f32 *input);
+
+/// Number of floats of scratch `nn_forward_scratch` needs: the widest even layer plus the widest odd layer.
+usize nn_activation_len(NN nn);
+
+/// `nn_forward`, but activations go into `activations` (`nn_activation_len` floats) instead of `NN.as`, so that
+/// multiple threads can run the same network at once.
+/// Returns reference to the output layer inside `activations`.
+const f32 *nn_forward_scratch(NN nn, f32 *activations, const f32 *input);
+
+typedef enum WeightInit {
+  /// U(-sqrt(6 / (fan_in + fan_out)), sqrt(6 / (fan_in + fan_out))), for sigmoid/tanh.
+  WEIGHT_INIT_XAVIER_UNIFORM,
+  /// N(0, 2 / (fan_in + fan_out)), for sigmoid/tanh.
+  WEIGHT_INIT_XAVIER_NORMAL,
+  /// U(-sqrt(6 / fan_in), sqrt(6 / fan_in)), for ReLU.
+  WEIGHT_INIT_HE_UNIFORM,
+  /// N(0, 2 / fan_in), for ReLU.
+  WEIGHT_INIT_HE_NORMAL,
+} WeightInit;
+
+/// Fill `dst` with elements `begin..end` of `rng`'s sequence for `init` on a `(fan_out x fan_in)` weight matrix.
+void weight_init_fill(WeightInit init, Rng rng, f32 *dst, usize begin, usize end, usize fan_in, usize fan_out);
+
+/// Initialize weights with `init` and zero the biases.
+/// The result only depends on `seed` and the topology, not on `n_threads`.
+void nn_init_weights(NN *nn, WeightInit init, u64 seed, usize n_threads);
+
+/// Scratch memory for `nn_train`, allocated once and reused across rounds.
+///
+/// With `checkpoint_every = k > 1`, the forward pass only keeps the activations of every `k`th layer (and the output
+/// layer). The backward pass walks the network one segment of `k` layers at a time, recomputing the segment's inner
+/// activations from the checkpoint before it. That costs at most one extra forward pass per round, and activation
+/// memory goes from `depth` layers to `depth / k + k - 1` layers, which is smallest around `k = sqrt(depth)`.
+typedef struct TrainingContext {
+  Loss loss;
+  /// Maximum number of samples processed together.
+  usize batch;
+  /// 0 or 1 keeps every activation.
+  usize checkpoint_every;
+  /// Allocated with the same `DaConfig` as `NN.pool`.
+  AdaF32 pool;
+  /// Gradients, same shapes as `NN.ws` and `NN.bs`.
+  DynArrayMat dws;
+  DynArrayMat dbs;
+  /// `(neurons x batch)` activations of checkpointed layers, `values` is NULL for the others.
+  DynArrayMat checkpoints;
+  /// `checkpoint_every - 1` buffers for the activations inside of a segment.
+  DynArrayMat segment;
+  /// `(inputs x batch)` and `(outputs x batch)`.
+  Mat x;
+  Mat y;
+  /// With `input_grad`, `nn_backprop_batch` also writes the gradient w.r.t. `x` into `dx` (`(inputs x batch)`), for
+  /// layers feeding the network such as `Embedding`.
+  bool input_grad;
+  Mat dx;
+  /// `(widest layer x batch)`, gradient w.r.t. the activations of the current layer and the one before it.
+  Mat delta;
+  Mat delta_prev;
+  /// `(2 x batch)`, for `loss_fused`.
+  Mat loss_scratch;
+  /// Empty without `NN.norm`. Gradients, same shapes as `NN.gammas` and `NN.betas`.
+  DynArrayMat dgammas;
+  DynArrayMat dbetas;
+  /// `(neurons x batch)` normalized pre-activations of every hidden layer, kept and recomputed like the activations:
+  /// `values` is NULL for the layers that aren't checkpoints, which use one of the `norm_segment` buffers.
+  DynArrayMat norm_xhats;
+  DynArrayMat norm_segment;
+  /// `1 / std` of every hidden layer, `(neurons x 1)` for batch norm and `(1 x batch)` for layer norm.
+  DynArrayMat norm_inv_stds;
+} TrainingContext;
+
+/// Number of activation floats kept alive during a round, per sample.
+usize training_context_activation_floats(const TrainingContext *ctx, NN nn);
+
+/// `checkpoint_every`: see `TrainingContext`.
+TrainingContext training_context_new(NN nn, Loss loss, usize batch, usize checkpoint_every);
+
+void training_context_free(TrainingContext ctx);
+
+/// Forward, then backward for one batch of `n` samples, accumulating into `ctx->dws` and `ctx->dbs` (and
+/// `ctx->dgammas` and `ctx->dbetas`). Batch norm uses the statistics of the batch and updates the running ones.
+/// `ctx->x` and `ctx->y` must already be filled.
+/// `grad_scale` is applied to the output gradient, pass `1 / total samples` to get mean gradients.
+/// Returns the loss summed over the batch.
+f32 nn_backprop_batch(NN nn, TrainingContext *ctx, usize n, f32 grad_scale);
+
+/// Copy `batch` samples starting at sample `begin` of `data` (laid out like for `nn_train`) into `ctx->x` and
+/// `ctx->y`. With `order`, sample `order[begin + s]` of `data` is loaded instead of `begin + s`, e.g. for shuffling.
+void training_context_load_batch(TrainingContext *ctx, NN nn, const f32 *data, const usize *order, usize begin,
+                                 usize batch);
+
+/// Zero every gradient in `ctx`.
+void training_context_zero_grads(TrainingContext *ctx);
+
+/// Gradient descent step: subtract `rate` times the gradients in `ctx` from the parameters of `nn`.
+void nn_apply_grads(NN *nn, const TrainingContext *ctx, f32 rate);
+
+/// One round of full-batch gradient descent over `training_data`.
+/// `training_data` is an array of samples, each being the inputs followed by the expected outputs.
+/// Returns the mean loss per sample before the update.
+f32 nn_train(NN *nn, TrainingContext *ctx, const f32 *training_data, usize training_data_len, f32 rate);
+
+/// Mean loss per sample over `data` (same layout as `nn_train`), forwarding `ctx->batch` samples at a time through
+/// `ctx`'s buffers. Doesn't touch the gradients.
+f32 nn_evaluate(NN nn, TrainingContext *ctx, const f32 *data, usize data_len);
+
+/// Copy of `nn` (`NN_NORM_BATCH`) with the inference-time batch norm folded into the weights and biases of every hidden
+/// layer, and no normalization left: same outputs as `nn_forward` on `nn` up to rounding, one multiply-add less per
+/// neuron. Layer norm depends on every sample's own statistics and can't be folded.
+NN nn_fold_batch_norm(NN nn, const DaConfig *pool_config);
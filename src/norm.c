@@ -0,0 +1,172 @@
+#include "norm.h"
+
+#define NORM_ROW_LANES 8
+#define NORM_COL_BLOCK 16
+
+/// Mean and biased variance of `x[0..len]`.
+static void norm_row_stats(const f32 *x, usize len, f32 *mean_out, f32 *var_out) {
+  f32 mean[NORM_ROW_LANES] = {0};
+  f32 m2[NORM_ROW_LANES] = {0};
+  const usize full = len / NORM_ROW_LANES;
+  for (usize i = 0; i < full; ++i) {
+    const f32 inv_count = 1 / (f32)(i + 1);
+    const f32 *block = &x[i * NORM_ROW_LANES];
+    for (usize j = 0; j < NORM_ROW_LANES; ++j) {
+      f32 delta = block[j] - mean[j];
+      mean[j] += delta * inv_count;
+      m2[j] += delta * (block[j] - mean[j]);
+    }
+  }
+  const usize rem = len % NORM_ROW_LANES;
+  for (usize j = 0; j < rem; ++j) {
+    f32 value = x[full * NORM_ROW_LANES + j];
+    f32 delta = value - mean[j];
+    mean[j] += delta / (f32)(full + 1);
+    m2[j] += delta * (value - mean[j]);
+  }
+  // Merge the lanes (Chan et al.), lane `j` saw `full + 1` values if `j < rem`.
+  f32 count = (f32)(full + (rem > 0));
+  f32 total_mean = mean[0];
+  f32 total_m2 = m2[0];
+  for (usize j = 1; j < NORM_ROW_LANES; ++j) {
+    f32 lane_count = (f32)(full + (j < rem));
+    if (lane_count == 0)
+      continue;
+    f32 merged = count + lane_count;
+    f32 delta = mean[j] - total_mean;
+    total_mean += delta * lane_count / merged;
+    total_m2 += m2[j] + delta * delta * count * lane_count / merged;
+    count = merged;
+  }
+  *mean_out = total_mean;
+  *var_out = total_m2 / (f32)len;
+}
+
+void batch_norm_forward_train(Mat z, Mat xhat, Mat inv_std, ConstMat gamma, ConstMat beta, Mat running_mean,
+                              Mat running_var, f32 momentum) {
+  const usize n = z.cols;
+  for (usize r = 0; r < z.rows; ++r) {
+    f32 mean, var;
+    norm_row_stats(&z.values[r * n], n, &mean, &var);
+    f32 s = 1 / sqrtf(var + NORM_EPSILON);
+    inv_std.values[r] = s;
+    f32 g = gamma.values[r];
+    f32 b = beta.values[r];
+    f32 *restrict row = &z.values[r * n];
+    f32 *restrict xhat_row = &xhat.values[r * n];
+    for (usize i = 0; i < n; ++i) {
+      xhat_row[i] = (row[i] - mean) * s;
+      row[i] = g * xhat_row[i] + b;
+    }
+    if (momentum > 0) {
+      f32 unbiased = n > 1 ? var * (f32)n / (f32)(n - 1) : var;
+      running_mean.values[r] += momentum * (mean - running_mean.values[r]);
+      running_var.values[r] += momentum * (unbiased - running_var.values[r]);
+    }
+  }
+}
+
+void batch_norm_forward_infer(Mat z, ConstMat gamma, ConstMat beta, ConstMat running_mean, ConstMat running_var) {
+  const usize n = z.cols;
+  for (usize r = 0; r < z.rows; ++r) {
+    f32 scale = gamma.values[r] / sqrtf(running_var.values[r] + NORM_EPSILON);
+    f32 shift = beta.values[r] - running_mean.values[r] * scale;
+    f32 *restrict row = &z.values[r * n];
+    for (usize i = 0; i < n; ++i)
+      row[i] = row[i] * scale + shift;
+  }
+}
+
+void batch_norm_backward(Mat dy, ConstMat xhat, ConstMat inv_std, ConstMat gamma, Mat dgamma, Mat dbeta) {
+  const usize n = dy.cols;
+  for (usize r = 0; r < dy.rows; ++r) {
+    f32 *restrict d = &dy.values[r * n];
+    const f32 *restrict x = &xhat.values[r * n];
+    f32 sum = 0;
+    f32 sum_x = 0;
+    for (usize i = 0; i < n; ++i) {
+      sum += d[i];
+      sum_x += d[i] * x[i];
+    }
+    dgamma.values[r] += sum_x;
+    dbeta.values[r] += sum;
+    // dz = gamma / std / n * (n dy - sum(dy) - xhat sum(dy xhat))
+    f32 scale = gamma.values[r] * inv_std.values[r] / (f32)n;
+    for (usize i = 0; i < n; ++i)
+      d[i] = scale * ((f32)n * d[i] - sum - x[i] * sum_x);
+  }
+}
+
+void layer_norm_forward(Mat z, Mat xhat, Mat inv_std, ConstMat gamma, ConstMat beta) {
+  const usize n = z.cols;
+  const usize rows = z.rows;
+  for (usize begin = 0; begin < n; begin += NORM_COL_BLOCK) {
+    const usize width = min((usize)NORM_COL_BLOCK, n - begin);
+    f32 mean[NORM_COL_BLOCK] = {0};
+    f32 m2[NORM_COL_BLOCK] = {0};
+    for (usize r = 0; r < rows; ++r) {
+      const f32 inv_count = 1 / (f32)(r + 1);
+      const f32 *restrict row = &z.values[r * n + begin];
+      for (usize i = 0; i < width; ++i) {
+        f32 delta = row[i] - mean[i];
+        mean[i] += delta * inv_count;
+        m2[i] += delta * (row[i] - mean[i]);
+      }
+    }
+    f32 s[NORM_COL_BLOCK];
+    for (usize i = 0; i < width; ++i)
+      s[i] = 1 / sqrtf(m2[i] / (f32)rows + NORM_EPSILON);
+    if (inv_std.values != NULL)
+      memcpy(&inv_std.values[begin], s, width * sizeof(f32));
+    for (usize r = 0; r < rows; ++r) {
+      f32 g = gamma.values[r];
+      f32 b = beta.values[r];
+      f32 *restrict row = &z.values[r * n + begin];
+      for (usize i = 0; i < width; ++i) {
+        f32 x = (row[i] - mean[i]) * s[i];
+        if (xhat.values != NULL)
+          xhat.values[r * n + begin + i] = x;
+        row[i] = g * x + b;
+      }
+    }
+  }
+}
+
+void layer_norm_backward(Mat dy, ConstMat xhat, ConstMat inv_std, ConstMat gamma, Mat dgamma, Mat dbeta) {
+  const usize n = dy.cols;
+  const usize rows = dy.rows;
+  for (usize r = 0; r < rows; ++r) {
+    const f32 *restrict d = &dy.values[r * n];
+    const f32 *restrict x = &xhat.values[r * n];
+    f32 sum = 0;
+    f32 sum_x = 0;
+    for (usize i = 0; i < n; ++i) {
+      sum += d[i];
+      sum_x += d[i] * x[i];
+    }
+    dgamma.values[r] += sum_x;
+    dbeta.values[r] += sum;
+  }
+  for (usize begin = 0; begin < n; begin += NORM_COL_BLOCK) {
+    const usize width = min((usize)NORM_COL_BLOCK, n - begin);
+    // Sums over the features of dxhat = gamma dy and dxhat xhat, per sample.
+    f32 sum[NORM_COL_BLOCK] = {0};
+    f32 sum_x[NORM_COL_BLOCK] = {0};
+    for (usize r = 0; r < rows; ++r) {
+      f32 g = gamma.values[r];
+      const f32 *restrict d = &dy.values[r * n + begin];
+      const f32 *restrict x = &xhat.values[r * n + begin];
+      for (usize i = 0; i < width; ++i) {
+        sum[i] += g * d[i];
+        sum_x[i] += g * d[i] * x[i];
+      }
+    }
+    for (usize r = 0; r < rows; ++r) {
+      f32 g = gamma.values[r];
+      f32 *restrict d = &dy.values[r * n + begin];
+      const f32 *restrict x = &xhat.values[r * n + begin];
+      for (usize i = 0; i < width; ++i)
+        d[i] = inv_std.values[begin + i] / (f32)rows * ((f32)rows * g * d[i] - sum[i] - x[i] * sum_x[i]);
+    }
+  }
+}
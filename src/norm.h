@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+#include "mat.h"
+
+/// Batch norm and layer norm over `(features x samples)` matrices, one sample per column like the batch matrices in
+/// `nn_train`.
+///
+/// Both compute `y = gamma * (z - mean) / sqrt(var + NORM_EPSILON) + beta` with `gamma` and `beta` per feature. Batch
+/// norm takes the statistics of every feature over the samples (a row), or running averages of them at inference.
+/// Layer norm takes the statistics of every sample over its features (a column), the same at training and inference.
+///
+/// Statistics are single pass (Welford): rows are split into 8 interleaved accumulators merged at the end, columns are
+/// done 16 at a time with one accumulator each, so that both vectorize.
+
+#define NORM_EPSILON 1e-5f
+
+/// Batch norm of `z` in place with the statistics of the batch.
+/// `xhat` (same shape as `z`) receives the normalized values and `inv_std` (`(rows x 1)`) `1 / sqrt(var + eps)`, both
+/// needed by `batch_norm_backward`.
+/// With `momentum > 0`, `running_mean` and `running_var` move towards the batch's mean and unbiased variance by
+/// `momentum`.
+void batch_norm_forward_train(Mat z, Mat xhat, Mat inv_std, ConstMat gamma, ConstMat beta, Mat running_mean,
+                              Mat running_var, f32 momentum);
+
+/// Batch norm of `z` in place with the running statistics.
+void batch_norm_forward_infer(Mat z, ConstMat gamma, ConstMat beta, ConstMat running_mean, ConstMat running_var);
+
+/// Given `dy`, the gradient w.r.t. the output of `batch_norm_forward_train`, overwrite it with the gradient w.r.t. its
+/// input and accumulate the gradients w.r.t. `gamma` and `beta` into `dgamma` and `dbeta`.
+void batch_norm_backward(Mat dy, ConstMat xhat, ConstMat inv_std, ConstMat gamma, Mat dgamma, Mat dbeta);
+
+/// Layer norm of `z` in place.
+/// `xhat` and `inv_std` (`(1 x cols)`) are nullable, for `layer_norm_backward`.
+void layer_norm_forward(Mat z, Mat xhat, Mat inv_std, ConstMat gamma, ConstMat beta);
+
+/// `batch_norm_backward` for `layer_norm_forward`.
+void layer_norm_backward(Mat dy, ConstMat xhat, ConstMat inv_std, ConstMat gamma, Mat dgamma, Mat dbeta);
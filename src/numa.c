@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include <sched.h>
+
+#include "numa.h"
+#include "parallel.h"
+
+/// Parse a sysfs cpulist like "0-3,8,10-11".
+static void parse_cpulist(const char *s, DynArrayUsize *cpus) {
+  while (*s != '\0' && *s != '\n') {
+    char *end;
+    usize lo = strtoul(s, &end, 10);
+    usize hi = lo;
+    if (end == s)
+      break;
+    s = end;
+    if (*s == '-') {
+      hi = strtoul(s + 1, &end, 10);
+      s = end;
+    }
+    for (usize cpu = lo; cpu <= hi; ++cpu)
+      da_push(cpus, cpu);
+    if (*s == ',')
+      ++s;
+  }
+}
+
+static NumaTopology numa_topology_single_node() {
+  NumaTopology topology = {
+      .cpus = xalloc(DynArrayUsize, 1),
+      .node_count = 1,
+  };
+  topology.cpus[0] = (DynArrayUsize){0};
+  for (usize cpu = 0; cpu < cpu_count(); ++cpu)
+    da_push(&topology.cpus[0], cpu);
+  return topology;
+}
+
+DECL_DA_STRUCT(DynArrayUsize, DynArrayCpuLists);
+
+NumaTopology numa_topology_detect() {
+  DynArrayCpuLists nodes = {0};
+  // Node numbers can have holes, stop after a run of missing ones.
+  for (usize node = 0, missing = 0; missing < 64; ++node) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+      ++missing;
+      continue;
+    }
+    missing = 0;
+    char line[4096];
+    DynArrayUsize cpus = {0};
+    if (fgets(line, sizeof(line), f) != NULL)
+      parse_cpulist(line, &cpus);
+    fclose(f);
+    // Memory-only nodes have no CPUs to run workers on.
+    if (cpus.da_len == 0) {
+      da_free(cpus);
+      continue;
+    }
+    da_push(&nodes, cpus);
+  }
+  if (nodes.da_len == 0)
+    return numa_topology_single_node();
+  return (NumaTopology){
+      .cpus = nodes.da_items,
+      .node_count = nodes.da_len,
+  };
+}
+
+void numa_topology_free(NumaTopology topology) {
+  for (usize i = 0; i < topology.node_count; ++i)
+    da_free(topology.cpus[i]);
+  xfree(topology.cpus);
+}
+
+bool pin_current_thread(usize cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+typedef struct ReplicaInit {
+  NumaReplica *replica;
+  NN nn;
+  usize cpu;
+} ReplicaInit;
+
+/// Runs on a thread pinned to the replica's node, so that first touch places the pages there.
+static void *replica_init_thread(void *init_) {
+  ReplicaInit *init = init_;
+  pin_current_thread(init->cpu);
+  usize bytes = init->nn.pool.da_len * sizeof(f32) + (1 << 20);
+  init->replica->arena = arena_new(bytes, ARENA_PAGES_TRANSPARENT_HUGE);
+  init->replica->nn = nn_clone_in(init->nn, arena_da_config(&init->replica->arena));
+  return NULL;
+}
+
+static void *numa_worker_main(void *worker_) {
+  NumaWorker *worker = worker_;
+  NumaInference *inference = worker->inference;
+  if (inference->options.pin)
+    pin_current_thread(worker->cpu);
+  NN nn = inference->replicas != NULL ? inference->replicas[worker->node].nn : inference->nn;
+  worker->activations = xalloc(f32, nn_activation_len(nn));
+  const usize inputs = nn_input_count(nn);
+  const usize outputs = nn_output_count(nn);
+
+  u64 seen_generation = 0;
+  for (;;) {
+    pthread_mutex_lock(&inference->mutex);
+    while (inference->generation == seen_generation && !inference->quit)
+      pthread_cond_wait(&inference->job_ready, &inference->mutex);
+    if (inference->quit) {
+      pthread_mutex_unlock(&inference->mutex);
+      break;
+    }
+    seen_generation = inference->generation;
+    usize n = inference->n;
+    const f32 *job_inputs = inference->inputs;
+    f32 *job_outputs = inference->outputs;
+    pthread_mutex_unlock(&inference->mutex);
+
+    usize begin = n * worker->index / inference->worker_count;
+    usize end = n * (worker->index + 1) / inference->worker_count;
+    for (usize i = begin; i < end; ++i) {
+      const f32 *out = nn_forward_scratch(nn, worker->activations, &job_inputs[i * inputs]);
+      memcpy(&job_outputs[i * outputs], out, outputs * sizeof(f32));
+    }
+
+    pthread_mutex_lock(&inference->mutex);
+    if (--inference->workers_busy == 0)
+      pthread_cond_signal(&inference->job_done);
+    pthread_mutex_unlock(&inference->mutex);
+  }
+  xfree(worker->activations);
+  return NULL;
+}
+
+NumaInference *numa_inference_new(NN nn, NumaOptions options) {
+  NumaInference *inference = xalloc(NumaInference, 1);
+  *inference = (NumaInference){
+      .topology = numa_topology_detect(),
+      .options = options,
+      .nn = nn,
+  };
+  NumaTopology topology = inference->topology;
+
+  if (options.replicate) {
+    inference->replicas = xalloc(NumaReplica, topology.node_count);
+    ReplicaInit *inits = xalloc(ReplicaInit, topology.node_count);
+    pthread_t *threads = xalloc(pthread_t, topology.node_count);
+    for (usize node = 0; node < topology.node_count; ++node) {
+      inits[node] = (ReplicaInit){
+          .replica = &inference->replicas[node],
+          .nn = nn,
+          .cpu = *da_get(&topology.cpus[node], 0),
+      };
+      ASSERT(pthread_create(&threads[node], NULL, replica_init_thread, &inits[node]) == 0);
+    }
+    for (usize node = 0; node < topology.node_count; ++node)
+      pthread_join(threads[node], NULL);
+    xfree(inits);
+    xfree(threads);
+  }
+
+  pthread_mutex_init(&inference->mutex, NULL);
+  pthread_cond_init(&inference->job_ready, NULL);
+  pthread_cond_init(&inference->job_done, NULL);
+  inference->worker_count = options.threads != 0 ? options.threads : cpu_count();
+  inference->workers = xalloc(NumaWorker, inference->worker_count);
+  for (usize i = 0; i < inference->worker_count; ++i) {
+    // Round robin over nodes, then over the CPUs within a node.
+    usize node = i % topology.node_count;
+    DynArrayUsize *cpus = &topology.cpus[node];
+    inference->workers[i] = (NumaWorker){
+        .inference = inference,
+        .index = i,
+        .node = node,
+        .cpu = *da_get(cpus, (i / topology.node_count) % cpus->da_len),
+    };
+  }
+  for (usize i = 0; i < inference->worker_count; ++i)
+    ASSERT(pthread_create(&inference->workers[i].thread, NULL, numa_worker_main, &inference->workers[i]) == 0);
+  return inference;
+}
+
+void numa_inference_forward(NumaInference *inference, const f32 *inputs, usize n, f32 *outputs) {
+  pthread_mutex_lock(&inference->mutex);
+  inference->inputs = inputs;
+  inference->outputs = outputs;
+  inference->n = n;
+  inference->workers_busy = inference->worker_count;
+  ++inference->generation;
+  pthread_cond_broadcast(&inference->job_ready);
+  while (inference->workers_busy != 0)
+    pthread_cond_wait(&inference->job_done, &inference->mutex);
+  pthread_mutex_unlock(&inference->mutex);
+}
+
+void numa_inference_free(NumaInference *inference) {
+  pthread_mutex_lock(&inference->mutex);
+  inference->quit = true;
+  pthread_cond_broadcast(&inference->job_ready);
+  pthread_mutex_unlock(&inference->mutex);
+  for (usize i = 0; i < inference->worker_count; ++i)
+    pthread_join(inference->workers[i].thread, NULL);
+  if (inference->replicas != NULL) {
+    for (usize node = 0; node < inference->topology.node_count; ++node) {
+      nn_free(inference->replicas[node].nn);
+      arena_free(&inference->replicas[node].arena);
+    }
+    xfree(inference->replicas);
+  }
+  pthread_mutex_destroy(&inference->mutex);
+  pthread_cond_destroy(&inference->job_ready);
+  pthread_cond_destroy(&inference->job_done);
+  xfree(inference->workers);
+  numa_topology_free(inference->topology);
+  xfree(inference);
+}
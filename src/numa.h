@@ -0,0 +1,86 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+#include "da.h"
+#include "nn.h"
+#include "arena.h"
+
+DECL_DA_STRUCT(usize, DynArrayUsize);
+
+/// CPUs of every NUMA node, read from `/sys/devices/system/node`.
+/// Systems without NUMA information (non-Linux, containers hiding sysfs) are one node with every CPU.
+typedef struct NumaTopology {
+  /// `cpus[node]` are the CPUs of `node`, no node is empty.
+  DynArrayUsize *cpus;
+  usize node_count;
+} NumaTopology;
+
+NumaTopology numa_topology_detect();
+
+void numa_topology_free(NumaTopology topology);
+
+/// Pin the calling thread to `cpu`. Returns false if pinning is unsupported or failed.
+bool pin_current_thread(usize cpu);
+
+typedef struct NumaOptions {
+  /// Total worker threads, spread round robin over the nodes. 0 for one per CPU.
+  usize threads;
+  /// Pin every worker to one CPU of its node.
+  bool pin;
+  /// Give every node its own copy of the weights, first touched by a thread on that node.
+  /// Without this, every worker reads the weights of the network passed to `numa_inference_new`.
+  bool replicate;
+} NumaOptions;
+
+typedef struct NumaReplica {
+  Arena arena;
+  NN nn;
+} NumaReplica;
+
+typedef struct NumaWorker {
+  pthread_t thread;
+  struct NumaInference *inference;
+  usize index;
+  usize node;
+  usize cpu;
+  /// `nn_activation_len` floats, allocated by the worker itself so it's local to the node.
+  f32 *activations;
+} NumaWorker;
+
+/// Inference over a pool of worker threads, each running requests against the copy of the weights on its own node.
+typedef struct NumaInference {
+  NumaTopology topology;
+  NumaOptions options;
+  /// The network passed in, used by every worker when not replicating.
+  NN nn;
+  /// One per node when replicating, otherwise NULL.
+  NumaReplica *replicas;
+  NumaWorker *workers;
+  usize worker_count;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t job_ready;
+  pthread_cond_t job_done;
+  /// Bumped for every job, workers wait for it to change.
+  u64 generation;
+  usize workers_busy;
+  bool quit;
+
+  /// Current job.
+  const f32 *inputs;
+  f32 *outputs;
+  usize n;
+} NumaInference;
+
+/// `nn` must outlive the inference pool, and its weights must not change while the pool is alive (replicas are copied
+/// once at creation).
+NumaInference *numa_inference_new(NN nn, NumaOptions options);
+
+/// Run `n` requests: `inputs` are `n` input vectors back to back, `outputs` receives `n` output vectors.
+/// Requests are split in contiguous chunks, one per worker, and every worker uses its node-local replica.
+/// Blocks until every request is done.
+void numa_inference_forward(NumaInference *inference, const f32 *inputs, usize n, f32 *outputs);
+
+void numa_inference_free(NumaInference *inference);
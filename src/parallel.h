@@ -0,0 +1,62 @@
+#pragma once
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/// Number of online CPUs, at least 1.
+static inline usize cpu_count() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (usize)n : 1;
+}
+
+/// Body of a `parallel_for`, processes indices `begin..end`.
+typedef void (*ParallelForFn)(void *ctx, usize begin, usize end);
+
+typedef struct ParallelForTask {
+  ParallelForFn f;
+  void *ctx;
+  usize begin;
+  usize end;
+} ParallelForTask;
+
+static inline void *parallel_for_thread_main(void *task_) {
+  ParallelForTask *task = task_;
+  task->f(task->ctx, task->begin, task->end);
+  return NULL;
+}
+
+/// Split `0..n` into at most `n_threads` contiguous chunks and run `f` over them in parallel.
+/// Chunk boundaries are multiples of `grain` (except for the last one), so no thread gets less than `grain` elements.
+/// The calling thread runs the first chunk itself, with 1 chunk no thread is spawned at all.
+static inline void parallel_for(usize n, usize n_threads, usize grain, ParallelForFn f, void *ctx) {
+  if (n == 0)
+    return;
+  grain = max(grain, (usize)1);
+  usize n_grains = (n + grain - 1) / grain;
+  n_threads = min(max(n_threads, (usize)1), n_grains);
+  if (n_threads == 1) {
+    f(ctx, 0, n);
+    return;
+  }
+  usize grains_per_thread = (n_grains + n_threads - 1) / n_threads;
+  ParallelForTask *tasks = xalloc(ParallelForTask, n_threads);
+  pthread_t *threads = xalloc(pthread_t, n_threads);
+  usize n_tasks = 0;
+  for (usize begin = 0; begin < n; begin += grains_per_thread * grain) {
+    tasks[n_tasks++] = (ParallelForTask){
+        .f = f,
+        .ctx = ctx,
+        .begin = begin,
+        .end = min(begin + grains_per_thread * grain, n),
+    };
+  }
+  for (usize t = 1; t < n_tasks; ++t)
+    ASSERT(pthread_create(&threads[t], NULL, parallel_for_thread_main, &tasks[t]) == 0);
+  parallel_for_thread_main(&tasks[0]);
+  for (usize t = 1; t < n_tasks; ++t)
+    pthread_join(threads[t], NULL);
+  xfree(tasks);
+  xfree(threads);
+}
@@ -0,0 +1,136 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+f64 now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+/// Start time of the last `perf_counters_start`, benchmarks only measure one thing at a time.
+static f64 start_seconds = 0;
+
+#ifdef __linux__
+
+static i32 perf_event_open_(PerfEvent event) {
+  struct perf_event_attr attr = {0};
+  attr.size = sizeof(attr);
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  switch (event) {
+  case PERF_EVENT_CYCLES:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case PERF_EVENT_INSTRUCTIONS:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case PERF_EVENT_DTLB_LOAD_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  case PERF_EVENT_LLC_LOAD_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  case PERF_EVENT_COUNT_:
+    PANIC();
+  }
+  return (i32)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+PerfCounters perf_counters_open() {
+  PerfCounters counters;
+  for (usize i = 0; i < PERF_EVENT_COUNT_; ++i)
+    counters.fds[i] = perf_event_open_((PerfEvent)i);
+  return counters;
+}
+
+void perf_counters_close(PerfCounters *counters) {
+  for (usize i = 0; i < PERF_EVENT_COUNT_; ++i) {
+    if (counters->fds[i] >= 0)
+      close(counters->fds[i]);
+    counters->fds[i] = -1;
+  }
+}
+
+void perf_counters_start(PerfCounters *counters) {
+  for (usize i = 0; i < PERF_EVENT_COUNT_; ++i) {
+    if (counters->fds[i] < 0)
+      continue;
+    ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+  start_seconds = now_seconds();
+}
+
+PerfSample perf_counters_stop(PerfCounters *counters) {
+  PerfSample sample;
+  sample.seconds = now_seconds() - start_seconds;
+  for (usize i = 0; i < PERF_EVENT_COUNT_; ++i) {
+    sample.values[i] = PERF_COUNTER_UNAVAILABLE;
+    if (counters->fds[i] < 0)
+      continue;
+    ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    u64 value;
+    if (read(counters->fds[i], &value, sizeof(value)) == sizeof(value))
+      sample.values[i] = value;
+  }
+  return sample;
+}
+
+#else
+
+PerfCounters perf_counters_open() {
+  PerfCounters counters;
+  for (usize i = 0; i < PERF_EVENT_COUNT_; ++i)
+    counters.fds[i] = -1;
+  return counters;
+}
+
+void perf_counters_close(PerfCounters *counters) {
+  (void)counters;
+}
+
+void perf_counters_start(PerfCounters *counters) {
+  (void)counters;
+  start_seconds = now_seconds();
+}
+
+PerfSample perf_counters_stop(PerfCounters *counters) {
+  (void)counters;
+  PerfSample sample;
+  sample.seconds = now_seconds() - start_seconds;
+  for (usize i = 0; i < PERF_EVENT_COUNT_; ++i)
+    sample.values[i] = PERF_COUNTER_UNAVAILABLE;
+  return sample;
+}
+
+#endif
+
+const char *perf_event_name(PerfEvent event) {
+  switch (event) {
+  case PERF_EVENT_CYCLES:
+    return "cycles";
+  case PERF_EVENT_INSTRUCTIONS:
+    return "instructions";
+  case PERF_EVENT_DTLB_LOAD_MISSES:
+    return "dTLB-load-misses";
+  case PERF_EVENT_LLC_LOAD_MISSES:
+    return "LLC-load-misses";
+  case PERF_EVENT_COUNT_:
+    break;
+  }
+  PANIC();
+}
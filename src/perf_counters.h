@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+/// Hardware counters for benchmarks, through `perf_event_open` on Linux.
+/// Unavailable counters (other OSes, containers, `perf_event_paranoid`) read as `PERF_COUNTER_UNAVAILABLE`.
+typedef enum PerfEvent {
+  PERF_EVENT_CYCLES,
+  PERF_EVENT_INSTRUCTIONS,
+  PERF_EVENT_DTLB_LOAD_MISSES,
+  PERF_EVENT_LLC_LOAD_MISSES,
+  PERF_EVENT_COUNT_,
+} PerfEvent;
+
+#define PERF_COUNTER_UNAVAILABLE UINT64_MAX
+
+typedef struct PerfCounters {
+  i32 fds[PERF_EVENT_COUNT_];
+} PerfCounters;
+
+typedef struct PerfSample {
+  u64 values[PERF_EVENT_COUNT_];
+  /// Wall clock, in seconds.
+  f64 seconds;
+} PerfSample;
+
+/// Open every counter for the calling thread (and threads it spawns afterwards), disabled.
+PerfCounters perf_counters_open();
+
+void perf_counters_close(PerfCounters *counters);
+
+/// Reset and enable the counters.
+void perf_counters_start(PerfCounters *counters);
+
+/// Disable the counters and read them, `seconds` is the time since `perf_counters_start`.
+PerfSample perf_counters_stop(PerfCounters *counters);
+
+const char *perf_event_name(PerfEvent event);
+
+/// Seconds from a monotonic clock.
+f64 now_seconds();
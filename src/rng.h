@@ -0,0 +1,153 @@
+#pragma once
+
+#include "common.h"
+
+/// Counter-based RNG (Philox4x32-10).
+/// There is no hidden state: every output is a pure function of `(seed, stream, index)`, so any thread can generate any
+/// range of a sequence on its own and the result is bitwise identical no matter how the work is split up.
+typedef struct Rng {
+  u64 seed;
+  /// Independent sub-sequence, e.g. one per layer.
+  u64 stream;
+} Rng;
+
+/// Number of philox blocks generated together in the batched paths, written as plain loops over lanes so that the
+/// compiler can vectorize them.
+#define RNG_LANES 8
+
+/// Each philox block yields 4 u32s.
+#define RNG_BLOCK_LEN 4
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+/// Generate `RNG_LANES` consecutive philox blocks starting at block index `block`.
+/// `out[j][lane]` is the `j`th u32 of block `block + lane`.
+static inline void philox_lanes(Rng rng, u64 block, u32 out[RNG_BLOCK_LEN][RNG_LANES]) {
+  u32 c0[RNG_LANES], c1[RNG_LANES], c2[RNG_LANES], c3[RNG_LANES];
+  for (usize l = 0; l < RNG_LANES; ++l) {
+    u64 counter = block + l;
+    c0[l] = (u32)counter;
+    c1[l] = (u32)(counter >> 32);
+    c2[l] = (u32)rng.stream;
+    c3[l] = (u32)(rng.stream >> 32);
+  }
+  u32 k0 = (u32)rng.seed;
+  u32 k1 = (u32)(rng.seed >> 32);
+  for (usize r = 0; r < 10; ++r) {
+    for (usize l = 0; l < RNG_LANES; ++l) {
+      u64 p0 = (u64)PHILOX_M0 * c0[l];
+      u64 p1 = (u64)PHILOX_M1 * c2[l];
+      u32 n0 = (u32)(p1 >> 32) ^ c1[l] ^ k0;
+      u32 n1 = (u32)p1;
+      u32 n2 = (u32)(p0 >> 32) ^ c3[l] ^ k1;
+      u32 n3 = (u32)p0;
+      c0[l] = n0;
+      c1[l] = n1;
+      c2[l] = n2;
+      c3[l] = n3;
+    }
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  for (usize l = 0; l < RNG_LANES; ++l) {
+    out[0][l] = c0[l];
+    out[1][l] = c1[l];
+    out[2][l] = c2[l];
+    out[3][l] = c3[l];
+  }
+}
+
+/// Uniform in [0, 1), 24 bits of precision.
+attribute(always_inline) static inline f32 rng_u32_to_f32(u32 x) {
+  return (f32)(x >> 8) * 0x1p-24f;
+}
+
+/// Uniform in (0, 1], safe to pass into `logf`.
+attribute(always_inline) static inline f32 rng_u32_to_f32_nonzero(u32 x) {
+  return (f32)((x >> 8) + 1) * 0x1p-24f;
+}
+
+/// The `index`th element of the sequence lives in lane `index % 4` of block `index / 4`.
+/// Elements `begin..end` of the sequence are generated into `dst[0..(end - begin)]`.
+/// Unaligned `begin`/`end` are fine, the partial blocks at the edges are generated and partially discarded.
+#define RNG_FILL_IMPL(RNG, DST, BEGIN, END, ELEM_EXPR)                                                                 \
+  ({                                                                                                                   \
+    Rng RNG_ = (RNG);                                                                                                  \
+    f32 *DST_ = (DST);                                                                                                 \
+    usize BEGIN_ = (BEGIN);                                                                                            \
+    usize END_ = (END);                                                                                                \
+    const usize CHUNK_ = RNG_LANES * RNG_BLOCK_LEN;                                                                    \
+    u32 bits[RNG_BLOCK_LEN][RNG_LANES];                                                                                \
+    f32 vals[RNG_LANES * RNG_BLOCK_LEN];                                                                               \
+    for (usize base = BEGIN_ / CHUNK_ * CHUNK_; base < END_; base += CHUNK_) {                                         \
+      philox_lanes(RNG_, base / RNG_BLOCK_LEN, bits);                                                                  \
+      for (usize l = 0; l < RNG_LANES; ++l) {                                                                          \
+        f32 *out = &vals[l * RNG_BLOCK_LEN];                                                                           \
+        u32 x0 = bits[0][l], x1 = bits[1][l], x2 = bits[2][l], x3 = bits[3][l];                                        \
+        ELEM_EXPR;                                                                                                     \
+      }                                                                                                                \
+      usize lo = max(base, BEGIN_);                                                                                    \
+      usize hi = min(base + CHUNK_, END_);                                                                             \
+      memcpy(&DST_[lo - BEGIN_], &vals[lo - base], (hi - lo) * sizeof(f32));                                           \
+    }                                                                                                                  \
+  })
+
+/// Fill `dst` with elements `begin..end` of a uniform sequence over [floor, ceil).
+static inline void rng_fill_uniform(Rng rng, f32 *dst, usize begin, usize end, f32 floor, f32 ceil) {
+  DEBUG_ASSERT(ceil >= floor);
+  const f32 scale = ceil - floor;
+  RNG_FILL_IMPL(rng, dst, begin, end, ({
+                  out[0] = floor + scale * rng_u32_to_f32(x0);
+                  out[1] = floor + scale * rng_u32_to_f32(x1);
+                  out[2] = floor + scale * rng_u32_to_f32(x2);
+                  out[3] = floor + scale * rng_u32_to_f32(x3);
+                }));
+}
+
+/// Fill `dst` with elements `begin..end` of a normal sequence N(mean, stddev^2).
+/// Box-Muller, each block of 4 u32s produces 4 normals.
+static inline void rng_fill_normal(Rng rng, f32 *dst, usize begin, usize end, f32 mean, f32 stddev) {
+  const f32 two_pi = 6.28318530717958647692f;
+  RNG_FILL_IMPL(rng, dst, begin, end, ({
+                  f32 r0 = stddev * sqrtf(-2 * logf(rng_u32_to_f32_nonzero(x0)));
+                  f32 t0 = two_pi * rng_u32_to_f32(x1);
+                  f32 r1 = stddev * sqrtf(-2 * logf(rng_u32_to_f32_nonzero(x2)));
+                  f32 t1 = two_pi * rng_u32_to_f32(x3);
+                  out[0] = mean + r0 * cosf(t0);
+                  out[1] = mean + r0 * sinf(t0);
+                  out[2] = mean + r1 * cosf(t1);
+                  out[3] = mean + r1 * sinf(t1);
+                }));
+}
+
+/// The philox block `block` alone, the scalar counterpart of `philox_lanes`.
+static inline void philox_block(Rng rng, u64 block, u32 out[RNG_BLOCK_LEN]) {
+  u32 c0 = (u32)block, c1 = (u32)(block >> 32), c2 = (u32)rng.stream, c3 = (u32)(rng.stream >> 32);
+  u32 k0 = (u32)rng.seed;
+  u32 k1 = (u32)(rng.seed >> 32);
+  for (usize r = 0; r < 10; ++r) {
+    u64 p0 = (u64)PHILOX_M0 * c0;
+    u64 p1 = (u64)PHILOX_M1 * c2;
+    c0 = (u32)(p1 >> 32) ^ c1 ^ k0;
+    c1 = (u32)p1;
+    c2 = (u32)(p0 >> 32) ^ c3 ^ k1;
+    c3 = (u32)p0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+/// Element `index` of the uniform sequence over [0, 1) that `rng_fill_uniform` generates, from its block alone.
+/// A quarter of a fill's work per block, so loops over many elements should still fill a buffer.
+static inline f32 rng_f32_at(Rng rng, usize index) {
+  u32 bits[RNG_BLOCK_LEN];
+  philox_block(rng, index / RNG_BLOCK_LEN, bits);
+  return rng_u32_to_f32(bits[index % RNG_BLOCK_LEN]);
+}
@@ -0,0 +1,329 @@
+#include "rnn.h"
+#include "nn.h"
+#include "alloc_track.h"
+
+/// `tanh` through `expf_lanes`, so that the gate loops vectorize.
+static inline f32 tanhf_lanes(f32 x) {
+  return 2 / (1 + expf_lanes(-2 * x)) - 1;
+}
+
+static inline f32 sigmoidf_lanes(f32 x) {
+  return 1 / (1 + expf_lanes(-x));
+}
+
+usize rnn_gate_count(RnnCell cell) {
+  switch (cell) {
+  case RNN_LSTM:
+    return 4;
+  case RNN_GRU:
+    return 3;
+  }
+  __builtin_unreachable();
+}
+
+/// The next `(rows x cols)` matrix of `pool`, from `*idx` on. `pool` must be fully reserved up front: the matrices
+/// point into it.
+static Mat pool_take(AdaF32 *pool, usize *idx, usize rows, usize cols) {
+  Mat m = {.rows = rows, .cols = cols, .values = da_get(pool, *idx)};
+  *idx += rows * cols;
+  return m;
+}
+
+Rnn rnn_new(RnnCell cell, usize inputs, usize hidden, usize outputs, Loss loss) {
+  ASSERT(inputs > 0 && hidden > 0 && outputs > 0);
+  const usize gates = rnn_gate_count(cell) * hidden;
+  const usize pool_len = gates * (inputs + hidden) + gates + outputs * hidden + outputs;
+  Rnn rnn = {
+      .cell = cell,
+      .inputs = inputs,
+      .hidden = hidden,
+      .outputs = outputs,
+      .loss = loss,
+      .pool = {.da_config = &DA_CONFIG_CACHE_ALIGNED},
+  };
+  ada_reserve_exact(&rnn.pool, pool_len);
+  ada_append_zeros(&rnn.pool, pool_len);
+  usize idx = 0;
+  rnn.w = pool_take(&rnn.pool, &idx, gates, inputs + hidden);
+  rnn.b = pool_take(&rnn.pool, &idx, gates, 1);
+  rnn.w_out = pool_take(&rnn.pool, &idx, outputs, hidden);
+  rnn.b_out = pool_take(&rnn.pool, &idx, outputs, 1);
+  DEBUG_ASSERT(idx == pool_len);
+  return rnn;
+}
+
+void rnn_free(Rnn rnn) {
+  ada_free(rnn.pool);
+}
+
+void rnn_init_weights(Rnn *rnn, u64 seed) {
+  const usize h = rnn->hidden;
+  // Every gate is its own `(hidden x inputs + hidden)` layer as far as the fan-out goes.
+  weight_init_fill(WEIGHT_INIT_XAVIER_UNIFORM, (Rng){.seed = seed, .stream = 0}, rnn->w.values, 0,
+                   rnn->w.rows * rnn->w.cols, rnn->w.cols, h);
+  weight_init_fill(WEIGHT_INIT_XAVIER_UNIFORM, (Rng){.seed = seed, .stream = 1}, rnn->w_out.values, 0,
+                   rnn->w_out.rows * rnn->w_out.cols, h, rnn->outputs);
+  memset(rnn->b.values, 0, rnn->b.rows * sizeof(f32));
+  memset(rnn->b_out.values, 0, rnn->b_out.rows * sizeof(f32));
+  if (rnn->cell == RNN_LSTM)
+    for (usize r = h; r < 2 * h; ++r)
+      rnn->b.values[r] = 1;
+}
+
+RnnContext rnn_context_new(Rnn rnn, usize batch, usize bptt) {
+  ASSERT(batch > 0 && bptt > 0);
+  const usize n = batch;
+  const usize h = rnn.hidden;
+  const usize xh = rnn.inputs + h;
+  const usize gates = rnn_gate_count(rnn.cell) * h;
+  const bool lstm = rnn.cell == RNN_LSTM;
+  RnnContext ctx = {
+      .batch = batch,
+      .bptt = bptt,
+  };
+  usize pool_len = 2 * h * n;
+  pool_len += gates * xh + gates + rnn.outputs * h + rnn.outputs;
+  pool_len += bptt * (xh + (lstm ? 0 : xh) + gates + h + 2 * rnn.outputs) * n;
+  pool_len += lstm ? (bptt + 1) * h * n : 0;
+  pool_len += (gates + xh + 3 * h + 2) * n;
+  ctx.pool.da_config = rnn.pool.da_config;
+  ada_reserve_exact(&ctx.pool, pool_len);
+  ada_append_zeros(&ctx.pool, pool_len);
+
+  usize idx = 0;
+  ctx.h = pool_take(&ctx.pool, &idx, h, n);
+  ctx.c = pool_take(&ctx.pool, &idx, h, n);
+  ctx.dw = pool_take(&ctx.pool, &idx, rnn.w.rows, rnn.w.cols);
+  ctx.db = pool_take(&ctx.pool, &idx, rnn.b.rows, 1);
+  ctx.dw_out = pool_take(&ctx.pool, &idx, rnn.w_out.rows, rnn.w_out.cols);
+  ctx.db_out = pool_take(&ctx.pool, &idx, rnn.b_out.rows, 1);
+  ctx.xh = pool_take(&ctx.pool, &idx, bptt * xh, n).values;
+  ctx.xrh = lstm ? NULL : pool_take(&ctx.pool, &idx, bptt * xh, n).values;
+  ctx.gates = pool_take(&ctx.pool, &idx, bptt * gates, n).values;
+  ctx.hs = pool_take(&ctx.pool, &idx, bptt * h, n).values;
+  ctx.outs = pool_take(&ctx.pool, &idx, bptt * rnn.outputs, n).values;
+  ctx.out_deltas = pool_take(&ctx.pool, &idx, bptt * rnn.outputs, n).values;
+  ctx.cells = lstm ? pool_take(&ctx.pool, &idx, (bptt + 1) * h, n).values : NULL;
+  ctx.dgates = pool_take(&ctx.pool, &idx, gates, n);
+  ctx.dxh = pool_take(&ctx.pool, &idx, xh, n);
+  ctx.dh = pool_take(&ctx.pool, &idx, h, n);
+  ctx.dh_next = pool_take(&ctx.pool, &idx, h, n);
+  ctx.dc_next = pool_take(&ctx.pool, &idx, h, n);
+  ctx.loss_scratch = pool_take(&ctx.pool, &idx, 2, n);
+  DEBUG_ASSERT(idx == pool_len);
+  return ctx;
+}
+
+void rnn_context_free(RnnContext ctx) {
+  ada_free(ctx.pool);
+}
+
+void rnn_context_reset(RnnContext *ctx) {
+  memset(ctx->h.values, 0, ctx->h.rows * ctx->h.cols * sizeof(f32));
+  memset(ctx->c.values, 0, ctx->c.rows * ctx->c.cols * sizeof(f32));
+}
+
+/// Step `t` of the current chunk, from the state left by step `t - 1` (or `ctx->h` and `ctx->c` for the first one).
+static void rnn_step(Rnn rnn, RnnContext *ctx, usize t, const f32 *x) {
+  const usize n = ctx->batch;
+  const usize h = rnn.hidden;
+  const usize hn = h * n;
+  const usize xh_rows = rnn.inputs + h;
+  const usize gates = rnn_gate_count(rnn.cell) * h;
+  const f32 *restrict h_prev = t == 0 ? ctx->h.values : &ctx->hs[(t - 1) * hn];
+  f32 *restrict h_out = &ctx->hs[t * hn];
+  f32 *g = &ctx->gates[t * gates * n];
+  // Rows are samples' features, so concatenating `x` and `h` is two copies.
+  f32 *xh = &ctx->xh[t * xh_rows * n];
+  memcpy(xh, x, rnn.inputs * n * sizeof(f32));
+  memcpy(&xh[rnn.inputs * n], h_prev, hn * sizeof(f32));
+  ConstMat xh_mat = {.rows = xh_rows, .cols = n, .values = xh};
+
+  if (rnn.cell == RNN_LSTM) {
+    Mat g_mat = {.rows = gates, .cols = n, .values = g};
+    mat_mul(g_mat, mat_as_const(rnn.w), xh_mat);
+    mat_add_col(g_mat, mat_as_const(rnn.b));
+    const f32 *restrict c_prev = t == 0 ? ctx->c.values : &ctx->cells[t * hn];
+    f32 *restrict c = &ctx->cells[(t + 1) * hn];
+    f32 *restrict gi = g;
+    f32 *restrict gf = &g[hn];
+    f32 *restrict gg = &g[2 * hn];
+    f32 *restrict go = &g[3 * hn];
+    for (usize j = 0; j < hn; ++j) {
+      gi[j] = sigmoidf_lanes(gi[j]);
+      gf[j] = sigmoidf_lanes(gf[j]);
+      gg[j] = tanhf_lanes(gg[j]);
+      go[j] = sigmoidf_lanes(go[j]);
+      c[j] = gf[j] * c_prev[j] + gi[j] * gg[j];
+      h_out[j] = go[j] * tanhf_lanes(c[j]);
+    }
+    return;
+  }
+
+  // GRU: the `z r` rows first, `n` needs `r`.
+  Mat zr_mat = {.rows = 2 * h, .cols = n, .values = g};
+  mat_mul(zr_mat, (ConstMat){.rows = 2 * h, .cols = xh_rows, .values = rnn.w.values}, xh_mat);
+  mat_add_col(zr_mat, (ConstMat){.rows = 2 * h, .cols = 1, .values = rnn.b.values});
+  f32 *restrict gz = g;
+  f32 *restrict gr = &g[hn];
+  f32 *restrict gn = &g[2 * hn];
+  f32 *xrh = &ctx->xrh[t * xh_rows * n];
+  f32 *rh = &xrh[rnn.inputs * n];
+  memcpy(xrh, x, rnn.inputs * n * sizeof(f32));
+  for (usize j = 0; j < hn; ++j) {
+    gz[j] = sigmoidf_lanes(gz[j]);
+    gr[j] = sigmoidf_lanes(gr[j]);
+    rh[j] = gr[j] * h_prev[j];
+  }
+  Mat n_mat = {.rows = h, .cols = n, .values = gn};
+  mat_mul(n_mat, (ConstMat){.rows = h, .cols = xh_rows, .values = &rnn.w.values[2 * h * xh_rows]},
+          (ConstMat){.rows = xh_rows, .cols = n, .values = xrh});
+  mat_add_col(n_mat, (ConstMat){.rows = h, .cols = 1, .values = &rnn.b.values[2 * h]});
+  for (usize j = 0; j < hn; ++j) {
+    gn[j] = tanhf_lanes(gn[j]);
+    h_out[j] = (1 - gz[j]) * gn[j] + gz[j] * h_prev[j];
+  }
+}
+
+/// Run `steps` steps of `x` into the chunk buffers, with the readout's pre-activations in `ctx->outs`, and move the
+/// state in `ctx` to after the last one.
+static void rnn_forward_chunk(Rnn rnn, RnnContext *ctx, const f32 *x, usize steps) {
+  ASSERT(steps > 0 && steps <= ctx->bptt);
+  const usize n = ctx->batch;
+  const usize hn = rnn.hidden * n;
+  for (usize t = 0; t < steps; ++t) {
+    rnn_step(rnn, ctx, t, &x[t * rnn.inputs * n]);
+    Mat out = {.rows = rnn.outputs, .cols = n, .values = &ctx->outs[t * rnn.outputs * n]};
+    mat_mul(out, mat_as_const(rnn.w_out), (ConstMat){.rows = rnn.hidden, .cols = n, .values = &ctx->hs[t * hn]});
+    mat_add_col(out, mat_as_const(rnn.b_out));
+  }
+  // The state before the chunk stays where the backward pass finds it: in `xh` of the first step, and `cells[0]`.
+  if (rnn.cell == RNN_LSTM) {
+    memcpy(ctx->cells, ctx->c.values, hn * sizeof(f32));
+    memcpy(ctx->c.values, &ctx->cells[steps * hn], hn * sizeof(f32));
+  }
+  memcpy(ctx->h.values, &ctx->hs[(steps - 1) * hn], hn * sizeof(f32));
+}
+
+void rnn_forward(Rnn rnn, RnnContext *ctx, const f32 *x, f32 *out, usize steps) {
+  const usize n = ctx->batch;
+  for (usize begin = 0; begin < steps; begin += ctx->bptt) {
+    usize len = min(ctx->bptt, steps - begin);
+    rnn_forward_chunk(rnn, ctx, &x[begin * rnn.inputs * n], len);
+    for (usize t = 0; t < len; ++t) {
+      Mat o = {.rows = rnn.outputs, .cols = n, .values = &ctx->outs[t * rnn.outputs * n]};
+      if (loss_output_activation(rnn.loss) == ACTIVATION_SOFTMAX)
+        softmax_mat(o);
+      else
+        sigmoid_mat(o);
+    }
+    memcpy(&out[begin * rnn.outputs * n], ctx->outs, len * rnn.outputs * n * sizeof(f32));
+  }
+}
+
+f32 rnn_backprop_chunk(Rnn rnn, RnnContext *ctx, const f32 *x, const f32 *y, usize steps, f32 grad_scale) {
+  rnn_forward_chunk(rnn, ctx, x, steps);
+  const usize n = ctx->batch;
+  const usize h = rnn.hidden;
+  const usize hn = h * n;
+  const usize in_n = rnn.inputs * n;
+  const usize xh_rows = rnn.inputs + h;
+  const usize gates = rnn_gate_count(rnn.cell) * h;
+  const usize out_n = rnn.outputs * n;
+
+  f32 loss = 0;
+  for (usize t = 0; t < steps; ++t)
+    loss += loss_fused(rnn.loss, &ctx->outs[t * out_n], &y[t * out_n], &ctx->out_deltas[t * out_n], rnn.outputs, n,
+                       ctx->loss_scratch.values, grad_scale);
+
+  // Truncated: nothing flows back into the chunk from the steps after it.
+  memset(ctx->dh_next.values, 0, hn * sizeof(f32));
+  memset(ctx->dc_next.values, 0, hn * sizeof(f32));
+  for (usize t = steps - 1; t != SIZE_MAX; --t) {
+    ConstMat h_t = {.rows = h, .cols = n, .values = &ctx->hs[t * hn]};
+    ConstMat delta_out = {.rows = rnn.outputs, .cols = n, .values = &ctx->out_deltas[t * out_n]};
+    mat_mul_add_rhs_t(ctx->dw_out, delta_out, h_t);
+    mat_add_row_sums(ctx->db_out, delta_out);
+    mat_mul_lhs_t(ctx->dh, mat_as_const(rnn.w_out), delta_out);
+
+    f32 *restrict dh = ctx->dh.values;
+    f32 *restrict dh_next = ctx->dh_next.values;
+    const f32 *restrict g = &ctx->gates[t * gates * n];
+    f32 *restrict dg = ctx->dgates.values;
+    const f32 *xh = &ctx->xh[t * xh_rows * n];
+    const f32 *restrict h_prev = &xh[in_n];
+    const f32 *dxh_h = &ctx->dxh.values[in_n];
+    if (rnn.cell == RNN_LSTM) {
+      const f32 *restrict c = &ctx->cells[(t + 1) * hn];
+      const f32 *restrict c_prev = &ctx->cells[t * hn];
+      f32 *restrict dc_next = ctx->dc_next.values;
+      for (usize j = 0; j < hn; ++j) {
+        f32 gi = g[j], gf = g[hn + j], gg = g[2 * hn + j], go = g[3 * hn + j];
+        f32 d = dh[j] + dh_next[j];
+        f32 tanh_c = tanhf_lanes(c[j]);
+        f32 dc = dc_next[j] + d * go * (1 - tanh_c * tanh_c);
+        dg[j] = dc * gg * gi * (1 - gi);
+        dg[hn + j] = dc * c_prev[j] * gf * (1 - gf);
+        dg[2 * hn + j] = dc * gi * (1 - gg * gg);
+        dg[3 * hn + j] = d * tanh_c * go * (1 - go);
+        dc_next[j] = dc * gf;
+      }
+      ConstMat dg_mat = {.rows = gates, .cols = n, .values = dg};
+      mat_mul_add_rhs_t(ctx->dw, dg_mat, (ConstMat){.rows = xh_rows, .cols = n, .values = xh});
+      mat_add_row_sums(ctx->db, dg_mat);
+      mat_mul_lhs_t(ctx->dxh, mat_as_const(rnn.w), dg_mat);
+      memcpy(dh_next, dxh_h, hn * sizeof(f32));
+      continue;
+    }
+
+    // GRU: through the `n` rows first, whose input `[x; r h]` depends on the `r` gate.
+    const f32 *xrh = &ctx->xrh[t * xh_rows * n];
+    for (usize j = 0; j < hn; ++j) {
+      f32 gz = g[j], gn = g[2 * hn + j];
+      f32 d = dh[j] + dh_next[j];
+      dh[j] = d;
+      dg[j] = d * (h_prev[j] - gn) * gz * (1 - gz);
+      dg[2 * hn + j] = d * (1 - gz) * (1 - gn * gn);
+    }
+    ConstMat dn_mat = {.rows = h, .cols = n, .values = &dg[2 * hn]};
+    mat_mul_add_rhs_t((Mat){.rows = h, .cols = xh_rows, .values = &ctx->dw.values[2 * h * xh_rows]}, dn_mat,
+                      (ConstMat){.rows = xh_rows, .cols = n, .values = xrh});
+    mat_add_row_sums((Mat){.rows = h, .cols = 1, .values = &ctx->db.values[2 * h]}, dn_mat);
+    mat_mul_lhs_t(ctx->dxh, (ConstMat){.rows = h, .cols = xh_rows, .values = &rnn.w.values[2 * h * xh_rows]}, dn_mat);
+    for (usize j = 0; j < hn; ++j) {
+      f32 gz = g[j], gr = g[hn + j];
+      // dxh_h is the gradient w.r.t. `r h`.
+      dg[hn + j] = dxh_h[j] * h_prev[j] * gr * (1 - gr);
+      dh_next[j] = dh[j] * gz + dxh_h[j] * gr;
+    }
+    ConstMat dzr_mat = {.rows = 2 * h, .cols = n, .values = dg};
+    mat_mul_add_rhs_t((Mat){.rows = 2 * h, .cols = xh_rows, .values = ctx->dw.values}, dzr_mat,
+                      (ConstMat){.rows = xh_rows, .cols = n, .values = xh});
+    mat_add_row_sums((Mat){.rows = 2 * h, .cols = 1, .values = ctx->db.values}, dzr_mat);
+    mat_mul_lhs_t(ctx->dxh, (ConstMat){.rows = 2 * h, .cols = xh_rows, .values = rnn.w.values}, dzr_mat);
+    for (usize j = 0; j < hn; ++j)
+      dh_next[j] += dxh_h[j];
+  }
+  return loss;
+}
+
+f32 rnn_train(Rnn *rnn, RnnContext *ctx, const f32 *x, const f32 *y, usize steps, f32 rate) {
+  ASSERT(steps > 0);
+  const usize n = ctx->batch;
+  Mat params[] = {rnn->w, rnn->b, rnn->w_out, rnn->b_out};
+  Mat grads[] = {ctx->dw, ctx->db, ctx->dw_out, ctx->db_out};
+  f32 loss = 0;
+  for (usize begin = 0; begin < steps; begin += ctx->bptt) {
+    ALLOC_TRACK_STEP_BEGIN();
+    usize len = min(ctx->bptt, steps - begin);
+    for (usize i = 0; i < ARR_LEN(grads); ++i)
+      memset(grads[i].values, 0, grads[i].rows * grads[i].cols * sizeof(f32));
+    loss += rnn_backprop_chunk(*rnn, ctx, &x[begin * rnn->inputs * n], &y[begin * rnn->outputs * n], len,
+                               1 / (f32)(len * n));
+    for (usize i = 0; i < ARR_LEN(params); ++i)
+      for (usize j = 0; j < params[i].rows * params[i].cols; ++j)
+        params[i].values[j] -= rate * grads[i].values[j];
+    ALLOC_TRACK_STEP_END();
+  }
+  return loss / (f32)(steps * n);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "common.h"
+#include "mat.h"
+#include "loss.h"
+
+/// Recurrent layers over batches of sequences, followed by a dense readout at every timestep.
+///
+/// A sequence of `steps` timesteps for a batch of `n` sequences is `steps` matrices back to back, each `(features x n)`
+/// with one sequence per column like the batch matrices in `nn_train`. All `n` sequences advance in lockstep.
+///
+/// Every gate reads the input and the previous hidden state concatenated, `[x; h]`, and the weights of all the gates
+/// are one `(gates * hidden x inputs + hidden)` matrix with the gates stacked, so that a timestep is one GEMM over the
+/// whole batch followed by one fused elementwise pass over all the gates:
+/// - LSTM, gates `i f g o`: `c = sigmoid(f) c + sigmoid(i) tanh(g)`, `h = sigmoid(o) tanh(c)`.
+/// - GRU, gates `z r n`: `h = (1 - sigmoid(z)) tanh(n) + sigmoid(z) h`, where `n` reads `[x; sigmoid(r) h]` instead,
+///   so its rows are multiplied separately after the `z r` rows, which are one GEMM on their own.
+typedef enum RnnCell {
+  RNN_LSTM,
+  RNN_GRU,
+} RnnCell;
+
+/// Parameters of a recurrent layer and its readout, in one pool.
+typedef struct Rnn {
+  RnnCell cell;
+  usize inputs;
+  usize hidden;
+  usize outputs;
+  /// Loss of the readout, which decides its activation like `NN.output_activation`.
+  Loss loss;
+  AdaF32 pool;
+  /// `(gates * hidden x inputs + hidden)` stacked gate weights and `(gates * hidden x 1)` biases.
+  Mat w;
+  Mat b;
+  /// `(outputs x hidden)` and `(outputs x 1)`, from the hidden state to the outputs.
+  Mat w_out;
+  Mat b_out;
+} Rnn;
+
+/// State and scratch for running an `Rnn` over a batch of sequences, and its gradients.
+///
+/// Training is truncated backpropagation through time: sequences are cut into chunks of at most `bptt` steps, the
+/// hidden state is carried from one chunk to the next but gradients are not, and the parameters are updated after
+/// every chunk. Everything a chunk's backward pass needs is kept for `bptt` steps, however long the sequence.
+typedef struct RnnContext {
+  /// Sequences processed in lockstep.
+  usize batch;
+  usize bptt;
+  /// Allocated with the same `DaConfig` as `Rnn.pool`.
+  AdaF32 pool;
+  /// `(hidden x batch)` state after the last step run, the cell state `c` is only used by LSTMs.
+  Mat h;
+  Mat c;
+  /// Gradients, same shapes as the parameters of `Rnn`.
+  Mat dw;
+  Mat db;
+  Mat dw_out;
+  Mat db_out;
+  /// Per step of the current chunk: `[x; h]` of the step before, `[x; sigmoid(r) h]` for GRUs, the activated gates,
+  /// the hidden state and the readout's outputs.
+  f32 *xh;
+  f32 *xrh;
+  f32 *gates;
+  f32 *hs;
+  f32 *outs;
+  /// Per step of the current chunk and one before it, the LSTM cell state.
+  f32 *cells;
+  /// Per step of the current chunk, gradients w.r.t. the readout's pre-activations.
+  f32 *out_deltas;
+  /// Backward scratch: `(gates * hidden x batch)`, `(inputs + hidden x batch)` and three `(hidden x batch)`.
+  Mat dgates;
+  Mat dxh;
+  Mat dh;
+  Mat dh_next;
+  Mat dc_next;
+  /// `(2 x batch)`, for `loss_fused`.
+  Mat loss_scratch;
+} RnnContext;
+
+/// 4 for LSTMs, 3 for GRUs.
+usize rnn_gate_count(RnnCell cell);
+
+/// Parameters start at zero, see `rnn_init_weights`.
+Rnn rnn_new(RnnCell cell, usize inputs, usize hidden, usize outputs, Loss loss);
+
+void rnn_free(Rnn rnn);
+
+/// Xavier uniform weights, zero biases except the LSTM forget gate's, which start at 1 so that the cell state is kept
+/// by default.
+void rnn_init_weights(Rnn *rnn, u64 seed);
+
+/// State starts at zero.
+RnnContext rnn_context_new(Rnn rnn, usize batch, usize bptt);
+
+void rnn_context_free(RnnContext ctx);
+
+/// Zero the state, before starting on new sequences.
+void rnn_context_reset(RnnContext *ctx);
+
+/// Run `steps` timesteps of `x` (`(inputs x batch)` each) from the state in `ctx`, writing the readout's activated
+/// outputs (`(outputs x batch)` each) into `out`, and leaving the state after the last step in `ctx`.
+void rnn_forward(Rnn rnn, RnnContext *ctx, const f32 *x, f32 *out, usize steps);
+
+/// Forward, then backward for one chunk of at most `ctx->bptt` steps of `x` with targets `y` (`(outputs x batch)`
+/// each), accumulating into the gradients in `ctx`. Gradients stop at the state the chunk starts from.
+/// `grad_scale` is applied to the output gradients, like for `nn_backprop_batch`.
+/// Returns the loss summed over the batch and the steps.
+f32 rnn_backprop_chunk(Rnn rnn, RnnContext *ctx, const f32 *x, const f32 *y, usize steps, f32 grad_scale);
+
+/// Truncated BPTT over `steps` timesteps, continuing from the state in `ctx`: gradient descent with `rate` on the mean
+/// loss per sample and step of every chunk of `ctx->bptt` steps.
+/// Returns the mean loss per sample and step, every chunk measured before its update.
+f32 rnn_train(Rnn *rnn, RnnContext *ctx, const f32 *x, const f32 *y, usize steps, f32 rate);
@@ -0,0 +1,270 @@
+#include "sweep.h"
+#include "alloc_track.h"
+
+Sweep sweep_new(usize *layers, usize layers_count, usize models, Loss loss) {
+  ASSERT(layers_count > 1);
+  ASSERT(models > 0);
+  const usize lanes = (models + 15) / 16 * 16;
+  const usize m = layers_count - 1;
+  usize widest = 0;
+  usize pool_len = 0;
+  for (usize l = 0; l < m; ++l) {
+    widest = max(widest, layers[l + 1]);
+    pool_len += 2 * (layers[l] * layers[l + 1] + layers[l + 1]) * lanes + layers[l + 1] * lanes;
+  }
+  pool_len += 2 * lanes + 2 * widest * lanes + 2 * layers[m] + 2;
+
+  Sweep sweep = {
+      .models = models,
+      .lanes = lanes,
+      .loss = loss,
+      .pool = {.da_config = &DA_CONFIG_CACHE_ALIGNED},
+      .layers = xalloc(SweepLayer, m),
+      .layer_count = m,
+  };
+  // The arrays point into the pool so it must never be reallocated afterwards.
+  ada_reserve_exact(&sweep.pool, pool_len);
+  ada_append_zeros(&sweep.pool, pool_len);
+  usize idx = 0;
+#define TAKE(LEN)                                                                                                      \
+  ({                                                                                                                   \
+    f32 *p_ = da_get(&sweep.pool, idx);                                                                                \
+    idx += (LEN);                                                                                                      \
+    p_;                                                                                                                \
+  })
+  for (usize l = 0; l < m; ++l) {
+    usize inputs = layers[l];
+    usize neurons = layers[l + 1];
+    sweep.layers[l] = (SweepLayer){
+        .inputs = inputs,
+        .neurons = neurons,
+        .w = TAKE(neurons * inputs * lanes),
+        .b = TAKE(neurons * lanes),
+        .dw = TAKE(neurons * inputs * lanes),
+        .db = TAKE(neurons * lanes),
+        .a = TAKE(neurons * lanes),
+    };
+  }
+  sweep.rates = TAKE(lanes);
+  sweep.round_losses = TAKE(lanes);
+  sweep.delta = TAKE(widest * lanes);
+  sweep.delta_prev = TAKE(widest * lanes);
+  sweep.out = TAKE(layers[m]);
+  sweep.out_delta = TAKE(layers[m]);
+  sweep.loss_scratch = TAKE(2);
+#undef TAKE
+  DEBUG_ASSERT(idx == pool_len);
+  for (usize k = 0; k < models; ++k)
+    sweep.rates[k] = 1;
+  return sweep;
+}
+
+void sweep_free(Sweep sweep) {
+  ada_free(sweep.pool);
+  xfree(sweep.layers);
+}
+
+void sweep_init_weights(Sweep *sweep, WeightInit init, const u64 *seeds) {
+  const usize lanes = sweep->lanes;
+  for (usize l = 0; l < sweep->layer_count; ++l) {
+    SweepLayer layer = sweep->layers[l];
+    usize len = layer.neurons * layer.inputs;
+    f32 *w = xalloc(f32, len);
+    for (usize k = 0; k < sweep->models; ++k) {
+      // Same stream and indices as `nn_init_weights`.
+      weight_init_fill(init, (Rng){.seed = seeds[k], .stream = l}, w, 0, len, layer.inputs, layer.neurons);
+      for (usize i = 0; i < len; ++i)
+        layer.w[i * lanes + k] = w[i];
+      for (usize i = 0; i < layer.neurons; ++i)
+        layer.b[i * lanes + k] = 0;
+    }
+    xfree(w);
+  }
+}
+
+void sweep_set_model(Sweep *sweep, usize model, NN nn) {
+  ASSERT(model < sweep->models);
+  ASSERT(nn_layer_count(nn) == sweep->layer_count);
+  ASSERT(nn.norm == NN_NORM_NONE);
+  const usize lanes = sweep->lanes;
+  for (usize l = 0; l < sweep->layer_count; ++l) {
+    SweepLayer layer = sweep->layers[l];
+    Mat w = *da_get(&nn.ws, l);
+    Mat b = *da_get(&nn.bs, l);
+    ASSERT(w.rows == layer.neurons && w.cols == layer.inputs);
+    for (usize i = 0; i < w.rows * w.cols; ++i)
+      layer.w[i * lanes + model] = w.values[i];
+    for (usize i = 0; i < b.rows; ++i)
+      layer.b[i * lanes + model] = b.values[i];
+  }
+}
+
+void sweep_get_model(Sweep sweep, usize model, NN *nn) {
+  ASSERT(model < sweep.models);
+  ASSERT(nn_layer_count(*nn) == sweep.layer_count);
+  ASSERT(nn->norm == NN_NORM_NONE);
+  const usize lanes = sweep.lanes;
+  for (usize l = 0; l < sweep.layer_count; ++l) {
+    SweepLayer layer = sweep.layers[l];
+    Mat w = *da_get(&nn->ws, l);
+    Mat b = *da_get(&nn->bs, l);
+    ASSERT(w.rows == layer.neurons && w.cols == layer.inputs);
+    for (usize i = 0; i < w.rows * w.cols; ++i)
+      w.values[i] = layer.w[i * lanes + model];
+    for (usize i = 0; i < b.rows; ++i)
+      b.values[i] = layer.b[i * lanes + model];
+  }
+  nn->output_activation = loss_output_activation(sweep.loss);
+}
+
+/// Forward one sample through every model, leaving the output layer's pre-activations in its `a`.
+static void sweep_forward(Sweep *sweep, const f32 *input) {
+  const usize lanes = sweep->lanes;
+  for (usize l = 0; l < sweep->layer_count; ++l) {
+    SweepLayer layer = sweep->layers[l];
+    const f32 *prev = l == 0 ? NULL : sweep->layers[l - 1].a;
+    for (usize r = 0; r < layer.neurons; ++r) {
+      f32 *restrict acc = &layer.a[r * lanes];
+      memcpy(acc, &layer.b[r * lanes], lanes * sizeof(f32));
+      for (usize c = 0; c < layer.inputs; ++c) {
+        const f32 *restrict w = &layer.w[(r * layer.inputs + c) * lanes];
+        if (prev == NULL) {
+          // The input is the same for every model.
+          f32 x = input[c];
+          for (usize k = 0; k < lanes; ++k)
+            acc[k] += w[k] * x;
+        } else {
+          const f32 *restrict a_prev = &prev[c * lanes];
+          for (usize k = 0; k < lanes; ++k)
+            acc[k] += w[k] * a_prev[k];
+        }
+      }
+      if (l + 1 != sweep->layer_count)
+        for (usize k = 0; k < lanes; ++k)
+          acc[k] = 1 / (1 + expf_lanes(-acc[k]));
+    }
+  }
+}
+
+/// Backward pass of one sample, accumulating into `dw` and `db`, and every model's loss into `losses` (`lanes` floats).
+static void sweep_backward(Sweep *sweep, const f32 *input, const f32 *target, f32 grad_scale, f32 *losses) {
+  const usize lanes = sweep->lanes;
+  SweepLayer last = sweep->layers[sweep->layer_count - 1];
+  const usize outputs = last.neurons;
+  if (sweep->loss == LOSS_MSE) {
+    // `loss_mse_fused` across models.
+    f32 *restrict lane_losses = losses;
+    for (usize o = 0; o < outputs; ++o) {
+      f32 *restrict z = &last.a[o * lanes];
+      f32 *restrict delta = &sweep->delta[o * lanes];
+      const f32 y = target[o];
+      for (usize k = 0; k < lanes; ++k) {
+        f32 a = 1 / (1 + expf_lanes(-z[k]));
+        f32 diff = a - y;
+        lane_losses[k] += diff * diff;
+        delta[k] = 2 * grad_scale * diff * a * (1 - a);
+        z[k] = a;
+      }
+    }
+  } else {
+    // Every model goes through `loss_fused` on its own. Output layers are narrow, the wide work is in the layers below.
+    memset(sweep->delta, 0, outputs * lanes * sizeof(f32));
+    for (usize k = 0; k < sweep->models; ++k) {
+      for (usize o = 0; o < outputs; ++o)
+        sweep->out[o] = last.a[o * lanes + k];
+      losses[k] += loss_fused(sweep->loss, sweep->out, target, sweep->out_delta, outputs, 1, sweep->loss_scratch,
+                              grad_scale);
+      for (usize o = 0; o < outputs; ++o) {
+        last.a[o * lanes + k] = sweep->out[o];
+        sweep->delta[o * lanes + k] = sweep->out_delta[o];
+      }
+    }
+  }
+
+  for (usize l = sweep->layer_count - 1; l != SIZE_MAX; --l) {
+    SweepLayer layer = sweep->layers[l];
+    const f32 *prev = l == 0 ? NULL : sweep->layers[l - 1].a;
+    f32 *restrict delta = sweep->delta;
+    // dL/dz = dL/da * sigmoid'(z), sigmoid'(z) = a (1 - a).
+    if (l + 1 != sweep->layer_count)
+      for (usize i = 0; i < layer.neurons * lanes; ++i)
+        delta[i] *= layer.a[i] * (1 - layer.a[i]);
+    for (usize r = 0; r < layer.neurons; ++r) {
+      const f32 *restrict d = &delta[r * lanes];
+      f32 *restrict db = &layer.db[r * lanes];
+      for (usize k = 0; k < lanes; ++k)
+        db[k] += d[k];
+      for (usize c = 0; c < layer.inputs; ++c) {
+        f32 *restrict dw = &layer.dw[(r * layer.inputs + c) * lanes];
+        if (prev == NULL) {
+          f32 x = input[c];
+          for (usize k = 0; k < lanes; ++k)
+            dw[k] += d[k] * x;
+        } else {
+          const f32 *restrict a_prev = &prev[c * lanes];
+          for (usize k = 0; k < lanes; ++k)
+            dw[k] += d[k] * a_prev[k];
+        }
+      }
+    }
+    if (l == 0)
+      break;
+    f32 *restrict delta_prev = sweep->delta_prev;
+    memset(delta_prev, 0, layer.inputs * lanes * sizeof(f32));
+    for (usize r = 0; r < layer.neurons; ++r) {
+      const f32 *restrict d = &delta[r * lanes];
+      for (usize c = 0; c < layer.inputs; ++c) {
+        const f32 *restrict w = &layer.w[(r * layer.inputs + c) * lanes];
+        f32 *restrict dp = &delta_prev[c * lanes];
+        for (usize k = 0; k < lanes; ++k)
+          dp[k] += w[k] * d[k];
+      }
+    }
+    sweep->delta_prev = delta;
+    sweep->delta = delta_prev;
+  }
+}
+
+void sweep_train(Sweep *sweep, const f32 *training_data, usize training_data_len, f32 *losses) {
+  const usize lanes = sweep->lanes;
+  const usize inputs = sweep->layers[0].inputs;
+  const usize stride = inputs + sweep->layers[sweep->layer_count - 1].neurons;
+  const usize n = training_data_len / stride;
+  ASSERT(training_data_len % stride == 0);
+  ASSERT(n > 0);
+
+  ALLOC_TRACK_STEP_BEGIN();
+  for (usize l = 0; l < sweep->layer_count; ++l) {
+    SweepLayer layer = sweep->layers[l];
+    memset(layer.dw, 0, layer.neurons * layer.inputs * lanes * sizeof(f32));
+    memset(layer.db, 0, layer.neurons * lanes * sizeof(f32));
+  }
+  f32 *round_losses = sweep->round_losses;
+  memset(round_losses, 0, lanes * sizeof(f32));
+  for (usize s = 0; s < n; ++s) {
+    const f32 *sample = &training_data[s * stride];
+    sweep_forward(sweep, sample);
+    sweep_backward(sweep, sample, &sample[inputs], 1 / (f32)n, round_losses);
+  }
+
+  const f32 *restrict rates = sweep->rates;
+  for (usize l = 0; l < sweep->layer_count; ++l) {
+    SweepLayer layer = sweep->layers[l];
+    for (usize i = 0; i < layer.neurons * layer.inputs; ++i) {
+      f32 *restrict w = &layer.w[i * lanes];
+      const f32 *restrict dw = &layer.dw[i * lanes];
+      for (usize k = 0; k < lanes; ++k)
+        w[k] -= rates[k] * dw[k];
+    }
+    for (usize i = 0; i < layer.neurons; ++i) {
+      f32 *restrict b = &layer.b[i * lanes];
+      const f32 *restrict db = &layer.db[i * lanes];
+      for (usize k = 0; k < lanes; ++k)
+        b[k] -= rates[k] * db[k];
+    }
+  }
+  ALLOC_TRACK_STEP_END();
+  if (losses != NULL)
+    for (usize k = 0; k < sweep->models; ++k)
+      losses[k] = round_losses[k] / n;
+}
@@ -0,0 +1,1571 @@
+#include <float.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "mat.h"
+#include "nn.h"
+#include "loss.h"
+#include "conv.h"
+#include "graph.h"
+#include "sweep.h"
+#include "rnn.h"
+#include "embedding.h"
+#include "checkpoint.h"
+#include "train.h"
+#include "alloc_track.h"
+#include "infer_cache.h"
+
+/// Gradient checks and kernel fuzzing.
+///
+/// Kernels are compared against the scalar reference implementations below, computed in f64. Dot-product-like kernels
+/// get the standard floating point summation bound `|got - want| <= (len + 2) * FLT_EPSILON * sum |terms|`,
+/// elementwise ones a bound in ULPs. Gradients from `nn_backprop_batch` are compared against central differences of the
+/// loss.
+///
+/// Usage: test [filter (runs tests whose name contains it)] [seed, default 1]
+
+static usize failures = 0;
+static usize checks = 0;
+
+/// Report the first few failures of a test in full, count the rest.
+#define TEST_CHECK(COND, ...)                                                                                          \
+  ({                                                                                                                   \
+    ++checks;                                                                                                          \
+    if (!(COND)) {                                                                                                     \
+      if (failures++ < 20) {                                                                                           \
+        printf("    [%s:%d] check failed: ", __FILE__, __LINE__);                                                      \
+        printf(__VA_ARGS__);                                                                                           \
+        printf("\n");                                                                                                  \
+      }                                                                                                                \
+    }                                                                                                                  \
+  })
+
+static Rng test_rng = {.seed = 1, .stream = 0xC0FFEE};
+static usize test_rng_index = 0;
+
+/// In `floor..=ceil`.
+static usize rand_usize(usize floor, usize ceil) {
+  return floor + min((usize)(rng_f32_at(test_rng, test_rng_index++) * (f32)(ceil - floor + 1)), ceil - floor);
+}
+
+static void rand_fill(f32 *dst, usize len, f32 floor, f32 ceil) {
+  rng_fill_uniform(test_rng, dst, test_rng_index, test_rng_index + len, floor, ceil);
+  test_rng_index += len;
+}
+
+static Mat rand_mat(usize rows, usize cols, f32 floor, f32 ceil) {
+  Mat m = {.values = xalloc(f32, max(rows * cols, (usize)1)), .cols = cols, .rows = rows};
+  rand_fill(m.values, rows * cols, floor, ceil);
+  return m;
+}
+
+/// Distance between two floats in units in the last place, 0 for equal values.
+static u32 ulp_diff(f32 a, f32 b) {
+  if (a == b)
+    return 0;
+  if (isnan(a) || isnan(b))
+    return UINT32_MAX;
+  i32 ia = PTR_CAST(i32, a);
+  i32 ib = PTR_CAST(i32, b);
+  // Map the sign-magnitude bit patterns onto a monotonic integer line.
+  ia = ia < 0 ? INT32_MIN - ia : ia;
+  ib = ib < 0 ? INT32_MIN - ib : ib;
+  i64 d = (i64)ia - (i64)ib;
+  return (u32)min((u64)(d < 0 ? -d : d), (u64)UINT32_MAX);
+}
+
+/// Within the summation bound of a `len`-term sum whose absolute terms add up to `abs_sum`.
+static bool within_sum_bound(f32 got, f64 want, usize len, f64 abs_sum) {
+  f64 bound = (f64)(len + 2) * FLT_EPSILON * abs_sum + FLT_MIN;
+  return fabs((f64)got - want) <= bound;
+}
+
+// Reference implementations, scalar and in f64.
+
+static void ref_mat_mul(Mat got, ConstMat lhs, ConstMat rhs, bool lhs_t, bool rhs_t, bool accumulate,
+                        const f32 *initial) {
+  usize k_len = lhs_t ? lhs.rows : lhs.cols;
+  for (usize y = 0; y < got.rows; ++y) {
+    for (usize x = 0; x < got.cols; ++x) {
+      f64 want = accumulate ? initial[y * got.cols + x] : 0;
+      f64 abs_sum = fabs(want);
+      for (usize i = 0; i < k_len; ++i) {
+        f64 l = lhs_t ? *mat_get_(lhs, y, i) : *mat_get_(lhs, i, y);
+        f64 r = rhs_t ? *mat_get_(rhs, i, x) : *mat_get_(rhs, x, i);
+        want += l * r;
+        abs_sum += fabs(l * r);
+      }
+      f32 g = *mat_get(got, x, y);
+      TEST_CHECK(within_sum_bound(g, want, k_len, abs_sum), "(%zu, %zu) of %zux%zu: got %.9g, want %.9g", x, y,
+                 got.cols, got.rows, g, want);
+    }
+  }
+}
+
+static f64 ref_sigmoid(f64 x) {
+  return 1 / (1 + exp(-x));
+}
+
+// Kernel fuzzing.
+
+static void test_mat_mul() {
+  for (usize round = 0; round < 200; ++round) {
+    usize rows = rand_usize(1, 33);
+    usize cols = rand_usize(1, 33);
+    usize inner = rand_usize(1, 70);
+    Mat lhs = rand_mat(rows, inner, -2, 2);
+    Mat rhs = rand_mat(inner, cols, -2, 2);
+    Mat dest = rand_mat(rows, cols, -2, 2);
+    mat_mul(dest, mat_as_const(lhs), mat_as_const(rhs));
+    ref_mat_mul(dest, mat_as_const(lhs), mat_as_const(rhs), false, false, false, NULL);
+    xfree(lhs.values);
+    xfree(rhs.values);
+    xfree(dest.values);
+  }
+}
+
+static void test_mat_mul_add_rhs_t() {
+  for (usize round = 0; round < 200; ++round) {
+    usize rows = rand_usize(1, 33);
+    usize cols = rand_usize(1, 33);
+    usize inner = rand_usize(1, 70);
+    Mat lhs = rand_mat(rows, inner, -2, 2);
+    Mat rhs = rand_mat(cols, inner, -2, 2);
+    Mat dest = rand_mat(rows, cols, -2, 2);
+    f32 *initial = xalloc(f32, rows * cols);
+    memcpy(initial, dest.values, rows * cols * sizeof(f32));
+    mat_mul_add_rhs_t(dest, mat_as_const(lhs), mat_as_const(rhs));
+    ref_mat_mul(dest, mat_as_const(lhs), mat_as_const(rhs), false, true, true, initial);
+    xfree(initial);
+    xfree(lhs.values);
+    xfree(rhs.values);
+    xfree(dest.values);
+  }
+}
+
+static void test_mat_mul_lhs_t() {
+  for (usize round = 0; round < 200; ++round) {
+    usize rows = rand_usize(1, 33);
+    usize cols = rand_usize(1, 33);
+    usize inner = rand_usize(1, 70);
+    Mat lhs = rand_mat(inner, rows, -2, 2);
+    Mat rhs = rand_mat(inner, cols, -2, 2);
+    Mat dest = rand_mat(rows, cols, -2, 2);
+    mat_mul_lhs_t(dest, mat_as_const(lhs), mat_as_const(rhs));
+    ref_mat_mul(dest, mat_as_const(lhs), mat_as_const(rhs), true, false, false, NULL);
+    xfree(lhs.values);
+    xfree(rhs.values);
+    xfree(dest.values);
+  }
+}
+
+static void test_mat_add_col_and_row_sums() {
+  for (usize round = 0; round < 100; ++round) {
+    usize rows = rand_usize(1, 40);
+    usize cols = rand_usize(1, 40);
+    Mat m = rand_mat(rows, cols, -2, 2);
+    Mat col = rand_mat(rows, 1, -2, 2);
+    Mat sums = rand_mat(rows, 1, -2, 2);
+    f32 *initial = xalloc(f32, rows * cols);
+    f32 *initial_sums = xalloc(f32, rows);
+    memcpy(initial, m.values, rows * cols * sizeof(f32));
+    memcpy(initial_sums, sums.values, rows * sizeof(f32));
+    mat_add_row_sums(sums, mat_as_const(m));
+    for (usize y = 0; y < rows; ++y) {
+      f64 want = initial_sums[y];
+      f64 abs_sum = fabs(want);
+      for (usize x = 0; x < cols; ++x) {
+        want += initial[y * cols + x];
+        abs_sum += fabs(initial[y * cols + x]);
+      }
+      TEST_CHECK(within_sum_bound(sums.values[y], want, cols, abs_sum), "row %zu: got %.9g, want %.9g", y,
+                 sums.values[y], want);
+    }
+    mat_add_col(m, mat_as_const(col));
+    for (usize i = 0; i < rows * cols; ++i) {
+      f32 want = initial[i] + col.values[i / cols];
+      TEST_CHECK(m.values[i] == want, "element %zu: got %.9g, want %.9g", i, m.values[i], want);
+    }
+    xfree(initial);
+    xfree(initial_sums);
+    xfree(m.values);
+    xfree(col.values);
+    xfree(sums.values);
+  }
+}
+
+static void test_sigmoid_mat() {
+  Mat m = rand_mat(64, 64, -20, 20);
+  // Edges: zero, saturation, and overflow of exp.
+  const f32 edges[] = {0, -0.0f, 1e-8f, -1e-8f, 88, -88, 100, -100, 1e30f, -1e30f};
+  memcpy(m.values, edges, sizeof(edges));
+  f32 *x = xalloc(f32, 64 * 64);
+  memcpy(x, m.values, 64 * 64 * sizeof(f32));
+  sigmoid_mat(m);
+  for (usize i = 0; i < 64 * 64; ++i) {
+    f32 want = (f32)ref_sigmoid(x[i]);
+    // Underflow into subnormals (exp overflowing to inf for very negative x) is fine.
+    bool ok = ulp_diff(m.values[i], want) <= 4 || fabsf(m.values[i] - want) < FLT_MIN;
+    TEST_CHECK(ok, "sigmoid(%.9g): got %.9g, want %.9g", x[i], m.values[i], want);
+  }
+  xfree(x);
+  xfree(m.values);
+}
+
+static void test_exp_log_lanes() {
+  const usize len = 4096;
+  f32 *x = xalloc(f32, len);
+  rand_fill(x, len, -87, 88);
+  for (usize i = 0; i < len; ++i) {
+    f32 want = (f32)exp(x[i]);
+    TEST_CHECK(ulp_diff(expf_lanes(x[i]), want) <= 1, "expf_lanes(%.9g): got %.9g, want %.9g", x[i], expf_lanes(x[i]),
+               want);
+  }
+  // Mantissas on either side of sqrt(2), and the exponents of every normal.
+  rand_fill(x, len, 1, 2);
+  for (usize i = 0; i < len; ++i)
+    x[i] = ldexpf(x[i], (i32)rand_usize(0, 253) - 126);
+  const f32 edges[] = {1, 2, 0.5f, 1.41421354f, 1.41421366f, FLT_MIN, FLT_MAX, 1 + FLT_EPSILON};
+  memcpy(x, edges, sizeof(edges));
+  for (usize i = 0; i < len; ++i) {
+    f32 want = (f32)log(x[i]);
+    TEST_CHECK(ulp_diff(logf_lanes(x[i]), want) <= 2, "logf_lanes(%.9g): got %.9g, want %.9g", x[i], logf_lanes(x[i]),
+               want);
+  }
+  xfree(x);
+}
+
+static void test_softmax_mat() {
+  for (usize round = 0; round < 50; ++round) {
+    usize rows = rand_usize(1, 20);
+    usize cols = rand_usize(1, 20);
+    f32 scale = round % 2 == 0 ? 5 : 200;
+    Mat m = rand_mat(rows, cols, -scale, scale);
+    f32 *z = xalloc(f32, rows * cols);
+    memcpy(z, m.values, rows * cols * sizeof(f32));
+    softmax_mat(m);
+    for (usize x = 0; x < cols; ++x) {
+      f64 max_z = -INFINITY;
+      for (usize y = 0; y < rows; ++y)
+        max_z = fmax(max_z, z[y * cols + x]);
+      f64 sum = 0;
+      for (usize y = 0; y < rows; ++y)
+        sum += exp(z[y * cols + x] - max_z);
+      for (usize y = 0; y < rows; ++y) {
+        f64 want = exp(z[y * cols + x] - max_z) / sum;
+        f32 got = m.values[y * cols + x];
+        // Relative to the column, tiny probabilities only need to be tiny.
+        TEST_CHECK(fabs(got - want) <= 4 * (f64)(rows + 2) * FLT_EPSILON * fmax(want, 1e-30) + 1e-7,
+                   "(%zu, %zu): got %.9g, want %.9g", x, y, got, want);
+      }
+    }
+    xfree(z);
+    xfree(m.values);
+  }
+}
+
+/// Activations within a few ULPs, deltas within as many of the larger of activation and target (they are differences
+/// of the two), the loss within the summation bound.
+static void test_loss_fused() {
+  for (Loss loss = LOSS_MSE; loss <= LOSS_SOFTMAX_CROSS_ENTROPY; ++loss) {
+    for (usize round = 0; round < 50; ++round) {
+      usize rows = rand_usize(1, 12);
+      usize cols = rand_usize(1, 20);
+      // Wide logits saturate the sigmoids, so that 1 + e^-|z| rounds to 1 in BCE.
+      f32 scale = round % 2 == 0 ? 8 : 40;
+      Mat z = rand_mat(rows, cols, -scale, scale);
+      Mat y = rand_mat(rows, cols, 0, 1);
+      if (loss == LOSS_SOFTMAX_CROSS_ENTROPY) {
+        for (usize x = 0; x < cols; ++x) {
+          f32 sum = 0;
+          for (usize r = 0; r < rows; ++r)
+            sum += y.values[r * cols + x];
+          for (usize r = 0; r < rows; ++r)
+            y.values[r * cols + x] /= sum;
+        }
+      }
+      f32 *z0 = xalloc(f32, rows * cols);
+      f32 *delta = xalloc(f32, rows * cols);
+      f32 *scratch = xalloc(f32, 2 * cols);
+      memcpy(z0, z.values, rows * cols * sizeof(f32));
+      const f32 grad_scale = 0.25f;
+      f32 got = loss_fused(loss, z.values, y.values, delta, rows, cols, scratch, grad_scale);
+
+      f64 want = 0;
+      f64 abs_sum = 0;
+      for (usize x = 0; x < cols; ++x) {
+        f64 lse = 0;
+        if (loss == LOSS_SOFTMAX_CROSS_ENTROPY) {
+          f64 max_z = -INFINITY;
+          for (usize r = 0; r < rows; ++r)
+            max_z = fmax(max_z, z0[r * cols + x]);
+          f64 sum = 0;
+          for (usize r = 0; r < rows; ++r)
+            sum += exp(z0[r * cols + x] - max_z);
+          lse = max_z + log(sum);
+        }
+        for (usize r = 0; r < rows; ++r) {
+          usize i = r * cols + x;
+          f64 t = y.values[i];
+          f64 a = 0, l = 0, d = 0;
+          switch (loss) {
+          case LOSS_MSE:
+            a = ref_sigmoid(z0[i]);
+            l = (a - t) * (a - t);
+            d = 2 * (a - t) * a * (1 - a);
+            break;
+          case LOSS_BINARY_CROSS_ENTROPY:
+            a = ref_sigmoid(z0[i]);
+            l = fmax(z0[i], 0) - z0[i] * t + log1p(exp(-fabs(z0[i])));
+            d = a - t;
+            break;
+          case LOSS_SOFTMAX_CROSS_ENTROPY:
+            a = exp(z0[i] - lse);
+            l = -t * (z0[i] - lse);
+            d = a - t;
+            break;
+          }
+          want += l;
+          abs_sum += fabs(l);
+          // The softmax exponentiates `z - lse`, a relative error of `a` as large as the absolute one of its exponent.
+          const f64 ulps = 4 + (loss == LOSS_SOFTMAX_CROSS_ENTROPY ? 2 * (fabs(z0[i] - lse) + fabs(lse)) : 0);
+          TEST_CHECK(ulp_diff(z.values[i], (f32)a) <= ulps || fabs(z.values[i] - a) < FLT_MIN,
+                     "%s activation of %.9g: got %.9g, want %.9g", loss_name(loss), z0[i], z.values[i], a);
+          TEST_CHECK(fabs(delta[i] - grad_scale * d) <= grad_scale * 2 * (ulps + 2) * FLT_EPSILON * fmax(a, t),
+                     "%s delta of %.9g: got %.9g, want %.9g", loss_name(loss), z0[i], delta[i], grad_scale * d);
+        }
+      }
+      // Every term carries a few ULPs of its own on top of the summation error.
+      TEST_CHECK(fabs(got - want) <= (f64)(rows * cols + 8) * 4 * FLT_EPSILON * abs_sum,
+                 "%s loss: got %.9g, want %.9g", loss_name(loss), got, want);
+      xfree(z0);
+      xfree(delta);
+      xfree(scratch);
+      xfree(z.values);
+      xfree(y.values);
+    }
+  }
+}
+
+static void test_conv2d() {
+  for (usize round = 0; round < 60; ++round) {
+    Conv2d conv = {
+        .in_channels = rand_usize(1, 4),
+        .in_height = rand_usize(1, 9),
+        .in_width = rand_usize(1, 9),
+        .out_channels = rand_usize(1, 4),
+        .kernel = round % 2 == 0 ? 3 : rand_usize(1, 4),
+        .stride = round % 2 == 0 ? 1 : rand_usize(1, 3),
+        .padding = rand_usize(0, 2),
+    };
+    if (conv.in_height + 2 * conv.padding < conv.kernel || conv.in_width + 2 * conv.padding < conv.kernel)
+      continue;
+    const usize n = rand_usize(1, 3);
+    const usize oh = conv2d_out_height(conv);
+    const usize ow = conv2d_out_width(conv);
+    const usize in_len = conv2d_in_len(conv);
+    const usize out_len = conv2d_out_len(conv);
+    const usize k = conv.kernel;
+    Mat w = rand_mat(conv.out_channels, conv.in_channels * k * k, -1, 1);
+    Mat b = rand_mat(conv.out_channels, 1, -1, 1);
+    Mat x = rand_mat(n, in_len, -1, 1);
+    Mat dy = rand_mat(n, out_len, -1, 1);
+
+    // Straight from the definition, also the adjoints for the backward pass.
+    f64 *y_want = xalloc(f64, n * out_len);
+    f64 *y_abs = xalloc(f64, n * out_len);
+    f64 *dx_want = xalloc(f64, n * in_len);
+    f64 *dw_want = xalloc(f64, w.rows * w.cols);
+    memset(dx_want, 0, n * in_len * sizeof(f64));
+    memset(dw_want, 0, w.rows * w.cols * sizeof(f64));
+    for (usize s = 0; s < n; ++s) {
+      for (usize oc = 0; oc < conv.out_channels; ++oc) {
+        for (usize oy = 0; oy < oh; ++oy) {
+          for (usize ox = 0; ox < ow; ++ox) {
+            usize o = s * out_len + (oc * oh + oy) * ow + ox;
+            f64 acc = b.values[oc];
+            f64 abs_acc = fabs(acc);
+            for (usize ic = 0; ic < conv.in_channels; ++ic) {
+              for (usize ky = 0; ky < k; ++ky) {
+                for (usize kx = 0; kx < k; ++kx) {
+                  isize iy = (isize)(oy * conv.stride + ky) - (isize)conv.padding;
+                  isize ix = (isize)(ox * conv.stride + kx) - (isize)conv.padding;
+                  if (iy < 0 || ix < 0 || iy >= (isize)conv.in_height || ix >= (isize)conv.in_width)
+                    continue;
+                  usize xi = s * in_len + (ic * conv.in_height + (usize)iy) * conv.in_width + (usize)ix;
+                  usize wi = ((oc * conv.in_channels + ic) * k + ky) * k + kx;
+                  acc += (f64)w.values[wi] * x.values[xi];
+                  abs_acc += fabs((f64)w.values[wi] * x.values[xi]);
+                  dx_want[xi] += (f64)w.values[wi] * dy.values[o];
+                  dw_want[wi] += (f64)x.values[xi] * dy.values[o];
+                }
+              }
+            }
+            y_want[o] = acc;
+            y_abs[o] = abs_acc;
+          }
+        }
+      }
+    }
+
+    const Conv2dAlgo algos[] = {CONV2D_IM2COL, CONV2D_DIRECT_3X3};
+    for (usize a = 0; a < ARR_LEN(algos); ++a) {
+      if (algos[a] == CONV2D_DIRECT_3X3 && (k != 3 || conv.stride != 1))
+        continue;
+      f32 *y = xalloc(f32, n * out_len);
+      f32 *dx = xalloc(f32, n * in_len);
+      Mat dw = {.values = xalloc(f32, w.rows * w.cols), .cols = w.cols, .rows = w.rows};
+      Mat db = {.values = xalloc(f32, w.rows), .cols = 1, .rows = w.rows};
+      memset(dw.values, 0, w.rows * w.cols * sizeof(f32));
+      memset(db.values, 0, w.rows * sizeof(f32));
+      f32 *scratch = xalloc(f32, conv2d_scratch_len(conv, algos[a]) + 1);
+      conv2d_forward(conv, algos[a], mat_as_const(w), mat_as_const(b), x.values, y, n, scratch);
+      conv2d_backward(conv, algos[a], mat_as_const(w), x.values, dy.values, dx, dw, db, n, scratch);
+      const usize taps = conv.in_channels * k * k;
+      for (usize i = 0; i < n * out_len; ++i)
+        TEST_CHECK(within_sum_bound(y[i], y_want[i], taps + 1, y_abs[i]), "algo %zu, y[%zu]: got %.9g, want %.9g",
+                   (usize)algos[a], i, y[i], y_want[i]);
+      // Gradients sum over many more terms, compare relative to the largest one.
+      for (usize i = 0; i < n * in_len; ++i)
+        TEST_CHECK(fabs(dx[i] - dx_want[i]) <= 1e-5 * (f64)(taps * conv.out_channels + 2),
+                   "algo %zu, dx[%zu]: got %.9g, want %.9g", (usize)algos[a], i, dx[i], dx_want[i]);
+      for (usize i = 0; i < w.rows * w.cols; ++i)
+        TEST_CHECK(fabs(dw.values[i] - dw_want[i]) <= 1e-5 * (f64)(n * oh * ow + 2),
+                   "algo %zu, dw[%zu]: got %.9g, want %.9g", (usize)algos[a], i, dw.values[i], dw_want[i]);
+      for (usize oc = 0; oc < conv.out_channels; ++oc) {
+        f64 want = 0;
+        for (usize s = 0; s < n; ++s)
+          for (usize p = 0; p < oh * ow; ++p)
+            want += dy.values[s * out_len + oc * oh * ow + p];
+        TEST_CHECK(fabs(db.values[oc] - want) <= 1e-5 * (f64)(n * oh * ow + 2),
+                   "algo %zu, db[%zu]: got %.9g, want %.9g", (usize)algos[a], oc, db.values[oc], want);
+      }
+      xfree(y);
+      xfree(dx);
+      xfree(dw.values);
+      xfree(db.values);
+      xfree(scratch);
+    }
+    xfree(y_want);
+    xfree(y_abs);
+    xfree(dx_want);
+    xfree(dw_want);
+    xfree(w.values);
+    xfree(b.values);
+    xfree(x.values);
+    xfree(dy.values);
+  }
+}
+
+/// The sequence must not depend on how it is split into fills.
+static void test_rng_chunking() {
+  Rng rng = {.seed = 42, .stream = 7};
+  const usize len = 1000;
+  f32 *whole = xalloc(f32, len);
+  f32 *chunked = xalloc(f32, len);
+  rng_fill_normal(rng, whole, 0, len, 0, 1);
+  for (usize begin = 0; begin < len;) {
+    usize end = min(begin + rand_usize(1, 37), len);
+    rng_fill_normal(rng, &chunked[begin], begin, end, 0, 1);
+    begin = end;
+  }
+  TEST_CHECK(memcmp(whole, chunked, len * sizeof(f32)) == 0, "chunked fills differ");
+  rng_fill_uniform(rng, whole, 0, len, 0, 1);
+  for (usize i = 0; i < len; ++i)
+    TEST_CHECK(rng_f32_at(rng, i) == whole[i], "rng_f32_at(%zu) = %g, filled %g", i, rng_f32_at(rng, i), whole[i]);
+  xfree(whole);
+  xfree(chunked);
+}
+
+static usize *rand_topology(usize *layers_count) {
+  *layers_count = rand_usize(2, 5);
+  usize *layers = xalloc(usize, *layers_count);
+  for (usize i = 0; i < *layers_count; ++i)
+    layers[i] = rand_usize(1, 7);
+  return layers;
+}
+
+/// `nn_forward`, `nn_forward_scratch`, the ping-pong and padded layouts and the equivalent `Graph` must agree bit for
+/// bit.
+static void test_forward_paths() {
+  for (usize round = 0; round < 50; ++round) {
+    usize layers_count;
+    usize *layers = rand_topology(&layers_count);
+    NN nn = nn_new(layers, layers_count);
+    NN ping_pong = nn_new_with(layers, layers_count, &DA_CONFIG_CACHE_ALIGNED,
+                               (NNOptions){.activations = NN_ACTIVATIONS_PING_PONG});
+    NN padded = nn_new_with(layers, layers_count, &DA_CONFIG_CACHE_ALIGNED,
+                            (NNOptions){.pool_layout = NN_POOL_SEPARATE_PADDED});
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_NORMAL, round, 1);
+    nn_init_weights(&ping_pong, WEIGHT_INIT_XAVIER_NORMAL, round, 2);
+    nn_init_weights(&padded, WEIGHT_INIT_XAVIER_NORMAL, round, 3);
+
+    Graph graph = graph_new();
+    GraphTensor h = graph_input(&graph, layers[0]);
+    for (usize l = 0; l + 1 < layers_count; ++l) {
+      h = graph_dense(&graph, h, layers[l + 1]);
+      Mat w = graph_dense_w(&graph, h);
+      Mat b = graph_dense_b(&graph, h);
+      memcpy(w.values, da_get(&nn.ws, l)->values, w.rows * w.cols * sizeof(f32));
+      memcpy(b.values, da_get(&nn.bs, l)->values, b.rows * sizeof(f32));
+      h = graph_activation(&graph, h, ACTIVATION_SIGMOID);
+    }
+    graph_plan(&graph, h, 1);
+
+    f32 *input = xalloc(f32, layers[0]);
+    f32 *scratch = xalloc(f32, nn_activation_len(nn));
+    rand_fill(input, layers[0], -1, 1);
+    const usize outputs = nn_output_count(nn);
+    const f32 *want = nn_forward(nn, input);
+    const f32 *const graph_inputs[] = {input};
+    TEST_CHECK(memcmp(want, nn_forward_scratch(nn, scratch, input), outputs * sizeof(f32)) == 0,
+               "nn_forward_scratch differs");
+    TEST_CHECK(memcmp(want, nn_forward(ping_pong, input), outputs * sizeof(f32)) == 0, "ping-pong layout differs");
+    TEST_CHECK(memcmp(want, nn_forward(padded, input), outputs * sizeof(f32)) == 0, "padded layout differs");
+    TEST_CHECK(memcmp(want, graph_forward(&graph, graph_inputs, 1), outputs * sizeof(f32)) == 0,
+               "graph differs");
+    xfree(input);
+    xfree(scratch);
+    graph_free(graph);
+    nn_free(nn);
+    nn_free(ping_pong);
+    nn_free(padded);
+    xfree(layers);
+  }
+}
+
+/// `(rows x n)` output of dense op `t` of `graph` on the `(cols x n)` `x`, in f64.
+static void ref_graph_dense(const Graph *graph, GraphTensor t, const f64 *x, usize n, f64 *out) {
+  Mat w = graph_dense_w(graph, t);
+  Mat b = graph_dense_b(graph, t);
+  for (usize r = 0; r < w.rows; ++r) {
+    for (usize s = 0; s < n; ++s) {
+      f64 sum = b.values[r];
+      for (usize i = 0; i < w.cols; ++i)
+        sum += (f64)w.values[r * w.cols + i] * x[i * n + s];
+      out[r * n + s] = sum;
+    }
+  }
+}
+
+/// Branches, additions on either side, concatenation and a residual connection, so that the planner shares buffers
+/// between tensors and runs elementwise ops in place, checked against computing every tensor on its own.
+static void test_graph() {
+  for (usize round = 0; round < 20; ++round) {
+    const usize inputs = rand_usize(1, 9);
+    const usize hidden = rand_usize(1, 9);
+    const usize batch = rand_usize(2, 8);
+    Graph graph = graph_new();
+    GraphTensor x = graph_input(&graph, inputs);
+    GraphTensor dense_a = graph_dense(&graph, x, hidden);
+    GraphTensor a = graph_activation(&graph, dense_a, ACTIVATION_SIGMOID);
+    GraphTensor dense_b = graph_dense(&graph, x, hidden);
+    GraphTensor b = graph_activation(&graph, dense_b, ACTIVATION_SIGMOID);
+    // `a` is read again by the concatenation, `b` isn't: in place on the second operand.
+    GraphTensor sum = graph_add(&graph, a, b);
+    GraphTensor concat = graph_concat(&graph, sum, a);
+    GraphTensor dense_c = graph_dense(&graph, concat, hidden);
+    GraphTensor residual = graph_add(&graph, graph_dropout(&graph, dense_c, 0.5f), sum);
+    GraphTensor out = graph_activation(&graph, residual, ACTIVATION_SIGMOID);
+    // Not needed for `out`, so left out of the plan.
+    graph_dense(&graph, concat, 3);
+    graph_init_weights(&graph, WEIGHT_INIT_XAVIER_NORMAL, round);
+    GraphTensor biased[] = {dense_a, dense_b, dense_c};
+    for (usize i = 0; i < ARR_LEN(biased); ++i) {
+      Mat bias = graph_dense_b(&graph, biased[i]);
+      rand_fill(bias.values, bias.rows, -1, 1);
+    }
+    graph_plan(&graph, out, batch);
+    TEST_CHECK(graph.plan.activation_floats < graph.plan.unplanned_floats, "no memory shared: %zu floats of %zu",
+               graph.plan.activation_floats, graph.plan.unplanned_floats);
+
+    f32 *input = xalloc(f32, inputs * batch);
+    f64 *x64 = xalloc(f64, inputs * batch);
+    f64 *ra = xalloc(f64, hidden * batch);
+    f64 *rb = xalloc(f64, hidden * batch);
+    f64 *rcat = xalloc(f64, 2 * hidden * batch);
+    f64 *rout = xalloc(f64, hidden * batch);
+    // Smaller batches than planned for reuse the same plan.
+    for (usize n = batch; n >= batch - 1; --n) {
+      rand_fill(input, inputs * n, -1, 1);
+      for (usize i = 0; i < inputs * n; ++i)
+        x64[i] = input[i];
+      ref_graph_dense(&graph, dense_a, x64, n, ra);
+      ref_graph_dense(&graph, dense_b, x64, n, rb);
+      for (usize i = 0; i < hidden * n; ++i) {
+        ra[i] = ref_sigmoid(ra[i]);
+        rcat[i] = ra[i] + ref_sigmoid(rb[i]);
+        rcat[hidden * n + i] = ra[i];
+      }
+      ref_graph_dense(&graph, dense_c, rcat, n, rout);
+      for (usize i = 0; i < hidden * n; ++i)
+        rout[i] = ref_sigmoid(rout[i] + rcat[i]);
+
+      const f32 *const graph_inputs[] = {input};
+      const f32 *got = graph_forward(&graph, graph_inputs, n);
+      for (usize i = 0; i < hidden * n; ++i)
+        TEST_CHECK(fabs(got[i] - rout[i]) <= 1e-5, "round %zu, n %zu, [%zu]: %.8g, want %.8g", round, n, i, got[i],
+                   rout[i]);
+    }
+    xfree(rout);
+    xfree(rcat);
+    xfree(rb);
+    xfree(ra);
+    xfree(x64);
+    xfree(input);
+    graph_free(graph);
+  }
+}
+
+/// Gradients of a branched graph with both activations, dropout, a residual add and a concatenation against central
+/// differences, the dropout masks held fixed by replaying the same forward pass. Then training it must fit a batch.
+static void test_graph_backward() {
+  for (usize round = 0; round < 10; ++round) {
+    const usize inputs = rand_usize(1, 6);
+    const usize hidden = rand_usize(2, 6);
+    const usize outputs = rand_usize(1, 4);
+    const usize batch = rand_usize(1, 6);
+    const usize n = rand_usize(1, batch);
+    Graph graph = graph_new();
+    GraphTensor x = graph_input(&graph, inputs);
+    GraphTensor a = graph_activation(&graph, graph_dense(&graph, x, hidden), ACTIVATION_SIGMOID);
+    GraphTensor b = graph_activation(&graph, graph_dense(&graph, x, hidden), ACTIVATION_SOFTMAX);
+    GraphTensor sum = graph_add(&graph, a, b);
+    GraphTensor concat = graph_concat(&graph, graph_dropout(&graph, sum, 0.25f), a);
+    GraphTensor residual = graph_add(&graph, graph_dense(&graph, concat, hidden), sum);
+    GraphTensor out = graph_dense(&graph, residual, outputs);
+    graph_init_weights(&graph, WEIGHT_INIT_XAVIER_UNIFORM, round);
+    for (usize t = 0; t < graph.ops.da_len; ++t)
+      if (da_get(&graph.ops, t)->kind == GRAPH_OP_DENSE)
+        rand_fill(graph_dense_b(&graph, t).values, hidden, -0.5f, 0.5f);
+    graph_plan_training(&graph, out, batch, round);
+
+    f32 *input = xalloc(f32, inputs * n);
+    rand_fill(input, inputs * n, -1, 1);
+    const f32 *const graph_inputs[] = {input};
+    // The loss is `sum(out * output_grad)`.
+    f32 *output_grad = xalloc(f32, outputs * n);
+    rand_fill(output_grad, outputs * n, -1, 1);
+    graph_zero_grads(&graph);
+    graph_forward(&graph, graph_inputs, n);
+    graph_backward(&graph, output_grad, n);
+    const usize len = graph.params.da_len;
+    f32 *grads = xalloc(f32, len);
+    memcpy(grads, graph.grads.da_items, len * sizeof(f32));
+
+    const f32 h = 1e-2f;
+    for (usize i = 0; i < len; ++i) {
+      f64 loss[2];
+      for (usize side = 0; side < 2; ++side) {
+        const f32 p = graph.params.da_items[i];
+        graph.params.da_items[i] = side == 0 ? p + h : p - h;
+        graph.plan.forward_count = 0;
+        const f32 *got = graph_forward(&graph, graph_inputs, n);
+        graph.params.da_items[i] = p;
+        loss[side] = 0;
+        for (usize j = 0; j < outputs * n; ++j)
+          loss[side] += (f64)got[j] * output_grad[j];
+      }
+      f64 numeric = (loss[0] - loss[1]) / (2 * (f64)h);
+      TEST_CHECK(fabs(numeric - grads[i]) <= 5e-3 * fmax(1, fabs(numeric)),
+                 "round %zu, parameter %zu: backprop %.6g, central difference %.6g", round, i, grads[i], numeric);
+    }
+
+    // Every forward pass draws new masks, with few elements they can come out the same by chance.
+    f32 *first = xalloc(f32, outputs * n);
+    memcpy(first, graph_forward(&graph, graph_inputs, n), outputs * n * sizeof(f32));
+    bool differ = false;
+    for (usize i = 0; i < 16 && !differ; ++i)
+      differ = memcmp(first, graph_forward(&graph, graph_inputs, n), outputs * n * sizeof(f32)) != 0;
+    TEST_CHECK(differ, "round %zu: the same dropout masks every time", round);
+
+    // MSE on the linear output through `loss_fused`, without dropout once trained.
+    f32 *target = xalloc(f32, outputs * n);
+    f32 *z = xalloc(f32, outputs * n);
+    f32 *delta = xalloc(f32, outputs * n);
+    f32 *scratch = xalloc(f32, 2 * n);
+    // Something the inputs determine, so that it fits whatever the shapes.
+    for (usize j = 0; j < outputs; ++j)
+      for (usize c = 0; c < n; ++c)
+        target[j * n + c] = 0.5f + 0.3f * input[(j % inputs) * n + c];
+    f32 before = 0, after = 0;
+    for (usize step = 0; step <= 500; ++step) {
+      graph_zero_grads(&graph);
+      memcpy(z, graph_forward(&graph, graph_inputs, n), outputs * n * sizeof(f32));
+      f32 loss = loss_fused(LOSS_MSE, z, target, delta, outputs, n, scratch, 1 / (f32)n);
+      before = step == 0 ? loss : before;
+      graph_backward(&graph, delta, n);
+      graph_apply_grads(&graph, 1);
+    }
+    graph_plan(&graph, out, batch);
+    memcpy(z, graph_forward(&graph, graph_inputs, n), outputs * n * sizeof(f32));
+    after = loss_fused(LOSS_MSE, z, target, delta, outputs, n, scratch, 0);
+    TEST_CHECK(after < 0.5f * before, "round %zu: loss %g after training, %g before", round, after, before);
+
+    xfree(scratch);
+    xfree(delta);
+    xfree(z);
+    xfree(target);
+    xfree(first);
+    xfree(grads);
+    xfree(output_grad);
+    xfree(input);
+    graph_free(graph);
+  }
+}
+
+// Gradient checks.
+
+static f32 batch_loss(NN nn, TrainingContext *ctx, usize n) {
+  return nn_backprop_batch(nn, ctx, n, 1);
+}
+
+/// Analytic gradients w.r.t. the parameters and inputs against central differences, on random topologies, for every
+/// loss, a few checkpoint intervals and every normalization. f32 central differences are only good to about 1e-3, so
+/// this catches wrong gradients, not rounding.
+static void test_gradients() {
+  for (usize round = 0; round < 36; ++round) {
+    Loss loss = (Loss)(round % 3);
+    usize checkpoint_every = (round / 3) % 4;
+    NNNorm norm = (NNNorm)(round / 12);
+    usize layers_count;
+    usize *layers = rand_topology(&layers_count);
+    if (loss == LOSS_SOFTMAX_CROSS_ENTROPY)
+      layers[layers_count - 1] = max(layers[layers_count - 1], (usize)2);
+    NN nn = nn_new_with(layers, layers_count, &DA_CONFIG_CACHE_ALIGNED, (NNOptions){.norm = norm});
+    nn.output_activation = loss_output_activation(loss);
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, round, 1);
+    for (usize l = 0; l < nn_layer_count(nn); ++l)
+      rand_fill(da_get(&nn.bs, l)->values, da_get(&nn.bs, l)->rows, -0.5f, 0.5f);
+    for (usize l = 0; l < nn.gammas.da_len; ++l) {
+      rand_fill(da_get(&nn.gammas, l)->values, da_get(&nn.gammas, l)->rows, 0.5f, 1.5f);
+      rand_fill(da_get(&nn.betas, l)->values, da_get(&nn.betas, l)->rows, -0.5f, 0.5f);
+    }
+
+    const usize n = rand_usize(1, 5);
+    TrainingContext ctx = training_context_new(nn, loss, n, checkpoint_every);
+    rand_fill(ctx.x.values, ctx.x.rows * n, -1, 1);
+    rand_fill(ctx.y.values, ctx.y.rows * n, 0, 1);
+    if (loss == LOSS_SOFTMAX_CROSS_ENTROPY) {
+      for (usize s = 0; s < n; ++s) {
+        f32 sum = 0;
+        for (usize r = 0; r < ctx.y.rows; ++r)
+          sum += ctx.y.values[r * n + s];
+        for (usize r = 0; r < ctx.y.rows; ++r)
+          ctx.y.values[r * n + s] /= sum;
+      }
+    }
+
+    training_context_zero_grads(&ctx);
+    ctx.input_grad = true;
+    batch_loss(nn, &ctx, n);
+    // Snapshot the gradients, evaluating the loss below accumulates into them again.
+    usize grad_len = ctx.x.rows * n;
+    for (usize l = 0; l < nn_layer_count(nn); ++l)
+      grad_len += da_get(&ctx.dws, l)->rows * da_get(&ctx.dws, l)->cols + da_get(&ctx.dbs, l)->rows;
+    for (usize l = 0; l < ctx.dgammas.da_len; ++l)
+      grad_len += 2 * da_get(&ctx.dgammas, l)->rows;
+    f32 *grads = xalloc(f32, grad_len);
+    f32 **params = xalloc(f32 *, grad_len);
+    usize j = 0;
+    for (usize i = 0; i < ctx.x.rows * n; ++i, ++j) {
+      grads[j] = ctx.dx.values[i];
+      params[j] = &ctx.x.values[i];
+    }
+    for (usize l = 0; l < nn_layer_count(nn); ++l) {
+      Mat w = *da_get(&nn.ws, l);
+      Mat b = *da_get(&nn.bs, l);
+      for (usize i = 0; i < w.rows * w.cols; ++i, ++j) {
+        grads[j] = da_get(&ctx.dws, l)->values[i];
+        params[j] = &w.values[i];
+      }
+      for (usize i = 0; i < b.rows; ++i, ++j) {
+        grads[j] = da_get(&ctx.dbs, l)->values[i];
+        params[j] = &b.values[i];
+      }
+    }
+    for (usize l = 0; l < ctx.dgammas.da_len; ++l) {
+      Mat gamma = *da_get(&nn.gammas, l);
+      Mat beta = *da_get(&nn.betas, l);
+      for (usize i = 0; i < gamma.rows; ++i, ++j) {
+        grads[j] = da_get(&ctx.dgammas, l)->values[i];
+        params[j] = &gamma.values[i];
+      }
+      for (usize i = 0; i < beta.rows; ++i, ++j) {
+        grads[j] = da_get(&ctx.dbetas, l)->values[i];
+        params[j] = &beta.values[i];
+      }
+    }
+
+    // Normalizing over a few samples or features divides by small standard deviations, which curves the loss
+    // a lot more sharply, so the differences need a smaller step and looser bounds there.
+    const f32 h = norm == NN_NORM_NONE ? 1e-2f : 1e-3f;
+    const f64 tolerance = norm == NN_NORM_NONE ? 5e-3 : 2e-2;
+    for (usize i = 0; i < grad_len; ++i) {
+      f32 p = *params[i];
+      *params[i] = p + h;
+      f64 plus = batch_loss(nn, &ctx, n);
+      *params[i] = p - h;
+      f64 minus = batch_loss(nn, &ctx, n);
+      *params[i] = p;
+      f64 numeric = (plus - minus) / (2 * (f64)h);
+      TEST_CHECK(fabs(numeric - grads[i]) <= tolerance * fmax(1, fabs(numeric)),
+                 "%s, norm %d, checkpoint_every %zu, %zu layers, parameter %zu: backprop %.6g, central difference "
+                 "%.6g",
+                 loss_name(loss), (int)norm, checkpoint_every, layers_count, i, grads[i], numeric);
+    }
+    xfree(grads);
+    xfree(params);
+    training_context_free(ctx);
+    nn_free(nn);
+    xfree(layers);
+  }
+}
+
+/// A batch norm network folded with `nn_fold_batch_norm` must compute what it computes at inference, after some
+/// training moved its running statistics, gammas and betas away from the identity.
+static void test_fold_batch_norm() {
+  for (usize round = 0; round < 20; ++round) {
+    usize layers_count;
+    usize *layers = rand_topology(&layers_count);
+    NN nn = nn_new_with(layers, layers_count, &DA_CONFIG_CACHE_ALIGNED, (NNOptions){.norm = NN_NORM_BATCH});
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, round, 1);
+    const usize stride = layers[0] + layers[layers_count - 1];
+    const usize n = rand_usize(2, 9);
+    f32 *data = xalloc(f32, n * stride);
+    rand_fill(data, n * stride, 0, 1);
+    TrainingContext ctx = training_context_new(nn, LOSS_MSE, rand_usize(1, n), 0);
+    for (usize i = 0; i < 10; ++i)
+      nn_train(&nn, &ctx, data, n * stride, 1);
+
+    NN folded = nn_fold_batch_norm(nn, &DA_CONFIG_CACHE_ALIGNED);
+    const usize outputs = nn_output_count(nn);
+    f32 *want = xalloc(f32, outputs);
+    for (usize s = 0; s < n; ++s) {
+      memcpy(want, nn_forward(nn, &data[s * stride]), outputs * sizeof(f32));
+      const f32 *got = nn_forward(folded, &data[s * stride]);
+      for (usize o = 0; o < outputs; ++o)
+        TEST_CHECK(fabsf(got[o] - want[o]) <= 1e-5f, "sample %zu output %zu: folded %.8g, batch norm %.8g", s, o,
+                   got[o], want[o]);
+    }
+    xfree(want);
+    xfree(data);
+    training_context_free(ctx);
+    nn_free(folded);
+    nn_free(nn);
+    xfree(layers);
+  }
+}
+
+/// A burst of snapshots through a `CheckpointWriter` must leave the last one on disk, loadable bit for bit.
+static void test_checkpoint() {
+  char path[] = "/tmp/ml-test-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT(fd >= 0);
+  close(fd);
+  for (usize round = 0; round < 8; ++round) {
+    usize layers_count;
+    usize *layers = rand_topology(&layers_count);
+    NNOptions options = {
+        .activations = (NNActivations)(round % 2),
+        .pool_layout = round < 4 ? NN_POOL_SEPARATE_PADDED : (NNPoolLayout)(round % 3),
+        .norm = (NNNorm)(round % 3),
+    };
+    if (round < 2)
+      options.norm = NN_NORM_BATCH;
+    NN nn = nn_new_with(layers, layers_count, &DA_CONFIG_CACHE_ALIGNED, options);
+    nn.output_activation = round % 2 == 0 ? ACTIVATION_SOFTMAX : ACTIVATION_SIGMOID;
+    CheckpointWriter *writer = checkpoint_writer_new(nn, path);
+    const u64 steps = rand_usize(1, 20);
+    for (u64 step = 1; step <= steps; ++step) {
+      rand_fill(nn.pool.da_items, nn.pool.da_len, -1, 1);
+      checkpoint_writer_submit(writer, nn, step);
+    }
+    TEST_CHECK(checkpoint_writer_free(writer), "round %zu: write failed", round);
+
+    u64 step = 0;
+    NN loaded = checkpoint_load(path, &DA_CONFIG_CACHE_ALIGNED, &step);
+    NNOptions got = nn_options(loaded);
+    TEST_CHECK(step == steps, "round %zu: step %" PRIu64 ", want %" PRIu64, round, step, steps);
+    TEST_CHECK(got.activations == options.activations && got.pool_layout == options.pool_layout &&
+                   got.norm == options.norm,
+               "round %zu: options {%d, %d, %d}, want {%d, %d, %d}", round, got.activations, got.pool_layout,
+               got.norm, options.activations, options.pool_layout, options.norm);
+    TEST_CHECK(loaded.output_activation == nn.output_activation, "round %zu: output activation %d, want %d", round,
+               loaded.output_activation, nn.output_activation);
+    TEST_CHECK(loaded.pool.da_len == nn.pool.da_len &&
+                   memcmp(loaded.pool.da_items, nn.pool.da_items, nn.pool.da_len * sizeof(f32)) == 0,
+               "round %zu: pool differs from the last snapshot", round);
+    nn_free(loaded);
+    nn_free(nn);
+    xfree(layers);
+  }
+  remove(path);
+}
+
+static void test_lr_schedule() {
+  for (usize round = 0; round < 20; ++round) {
+    const f32 rate = (f32)rand_usize(1, 100) / 10;
+    const usize warmup = rand_usize(0, 5);
+    const usize rounds = warmup + rand_usize(2, 50);
+    LrSchedule schedule = {
+        .kind = (LrScheduleKind)(round % 3),
+        .rate = rate,
+        .warmup_rounds = warmup,
+        .step_rounds = rand_usize(1, 6),
+        .step_gamma = 0.5f,
+        .min_rate = rate / 10,
+    };
+    if (warmup > 0) {
+      f32 first = lr_schedule_rate(schedule, 0, rounds);
+      f32 last = lr_schedule_rate(schedule, warmup - 1, rounds);
+      TEST_CHECK(fabsf(first - rate / (f32)warmup) <= 1e-6f * rate, "warmup starts at %g, want %g", first,
+                 rate / (f32)warmup);
+      TEST_CHECK(fabsf(last - rate) <= 1e-6f * rate, "warmup ends at %g, want %g", last, rate);
+    }
+    TEST_CHECK(fabsf(lr_schedule_rate(schedule, warmup, rounds) - rate) <= 1e-6f * rate,
+               "%d: first round after warmup at %g, want %g", schedule.kind, lr_schedule_rate(schedule, warmup, rounds),
+               rate);
+    for (usize t = 0; t + warmup < rounds; ++t) {
+      f32 got = lr_schedule_rate(schedule, warmup + t, rounds);
+      if (schedule.kind == LR_SCHEDULE_CONSTANT)
+        TEST_CHECK(got == rate, "constant: round %zu at %g", t, got);
+      else if (schedule.kind == LR_SCHEDULE_STEP)
+        TEST_CHECK(fabsf(got - rate * powf(0.5f, (f32)(t / schedule.step_rounds))) <= 1e-6f * rate,
+                   "step: round %zu at %g", t, got);
+      else
+        TEST_CHECK(got <= rate * (1 + 1e-6f) && got >= schedule.min_rate * (1 - 1e-6f), "cosine: round %zu at %g",
+                   t, got);
+    }
+    if (schedule.kind == LR_SCHEDULE_COSINE)
+      TEST_CHECK(fabsf(lr_schedule_rate(schedule, rounds - 1, rounds) - schedule.min_rate) <= 1e-6f * rate,
+                 "cosine ends at %g, want %g", lr_schedule_rate(schedule, rounds - 1, rounds), schedule.min_rate);
+  }
+
+  const usize stride = 3;
+  f32 data[20 * 3];
+  for (usize n = 1; n <= 20; ++n) {
+    const f32 fraction = (f32)rand_usize(1, 90) / 100;
+    TrainSplit split = train_split(data, n * stride, stride, fraction);
+    TEST_CHECK(split.train == data && split.validation == &data[split.train_len] &&
+                   split.train_len + split.validation_len == n * stride,
+               "n %zu: split doesn't cover the data", n);
+    TEST_CHECK(n < 2 || split.validation_len >= stride, "n %zu, fraction %g: nothing held out", n, fraction);
+    TEST_CHECK(split.train_len >= stride, "n %zu, fraction %g: nothing left to train on", n, fraction);
+  }
+}
+
+/// Early stopping, the evaluation after the last round, and restoring the best parameters of `nn_fit`.
+static void test_fit() {
+  for (usize round = 0; round < 6; ++round) {
+    usize layers[] = {rand_usize(1, 4), rand_usize(1, 6), 1};
+    const usize stride = layers[0] + 1;
+    const usize n = 2 * rand_usize(2, 8);
+    // The second half is the first half with flipped targets, so that fitting one half overfits the other. Targets are
+    // above 0.5 in the first half and the outputs start out near 0, so the outputs pass the second half's targets on
+    // the way, whatever the weights.
+    f32 *data = xalloc(f32, n * stride);
+    for (usize s = 0; s < n / 2; ++s) {
+      rand_fill(&data[s * stride], stride, 0, 1);
+      data[s * stride + layers[0]] = 0.6f + 0.3f * data[s * stride + layers[0]];
+      memcpy(&data[(n / 2 + s) * stride], &data[s * stride], stride * sizeof(f32));
+      data[(n / 2 + s) * stride + layers[0]] = 1 - data[s * stride + layers[0]];
+    }
+    TrainSplit split = train_split(data, n * stride, stride, 0.5f);
+    TEST_CHECK(split.validation_len == n / 2 * stride, "n %zu: uneven split", n);
+    NN initial = nn_new(layers, ARR_LEN(layers));
+    nn_init_weights(&initial, WEIGHT_INIT_XAVIER_UNIFORM, round, 1);
+    da_get(&initial.bs, 1)->values[0] = -3;
+    TrainingContext ctx = training_context_new(initial, LOSS_MSE, rand_usize(1, n), 0);
+
+    // Nothing changes at a rate of 0: the first evaluation is the best, then `patience` more run out of it.
+    const usize eval_every = rand_usize(1, 4);
+    const usize patience = rand_usize(1, 4);
+    NN nn = nn_clone_in(initial, &DA_CONFIG_CACHE_ALIGNED);
+    TrainConfig config = {
+        .schedule = {.kind = LR_SCHEDULE_CONSTANT, .rate = 0},
+        .max_rounds = 1000,
+        .eval_every = eval_every,
+        .patience = patience,
+        .min_delta = 1e-6f,
+    };
+    TrainResult result = nn_fit(&nn, &ctx, split, config);
+    TEST_CHECK(result.stopped_early && result.rounds == eval_every * (patience + 1) && result.best_round == eval_every,
+               "plateau: %zu rounds (early %d), best at %zu, want %zu and %zu", result.rounds, result.stopped_early,
+               result.best_round, eval_every * (patience + 1), eval_every);
+    nn_free(nn);
+
+    // Fitting the training set, which is also the validation set: the last round is evaluated and the best, even
+    // off the `eval_every` grid.
+    nn = nn_clone_in(initial, &DA_CONFIG_CACHE_ALIGNED);
+    config = (TrainConfig){
+        .schedule = {.kind = LR_SCHEDULE_CONSTANT, .rate = 0.5f},
+        .max_rounds = 7,
+        .eval_every = 5,
+    };
+    result = nn_fit(&nn, &ctx, (TrainSplit){.train = split.train, .train_len = split.train_len}, config);
+    TEST_CHECK(!result.stopped_early && result.rounds == 7 && result.best_round == 7,
+               "fitting: %zu rounds (early %d), best at %zu, want 7 and 7", result.rounds, result.stopped_early,
+               result.best_round);
+    nn_free(nn);
+
+    // Overfitting the validation set: the parameters of the best round are put back, and are those of training
+    // for that many rounds.
+    nn = nn_clone_in(initial, &DA_CONFIG_CACHE_ALIGNED);
+    config = (TrainConfig){
+        .schedule = {.kind = LR_SCHEDULE_CONSTANT, .rate = 2},
+        .max_rounds = 200,
+        .eval_every = 1,
+        .restore_best = true,
+    };
+    result = nn_fit(&nn, &ctx, split, config);
+    TEST_CHECK(result.best_round > 0 && result.best_round < result.rounds, "overfitting: best at %zu of %zu rounds",
+               result.best_round, result.rounds);
+    NN want = nn_clone_in(initial, &DA_CONFIG_CACHE_ALIGNED);
+    for (usize r = 0; r < result.best_round; ++r)
+      nn_train(&want, &ctx, split.train, split.train_len, 2);
+    TEST_CHECK(memcmp(nn.pool.da_items, want.pool.da_items, nn.pool.da_len * sizeof(f32)) == 0,
+               "overfitting: parameters of round %zu not restored", result.best_round);
+    TEST_CHECK(nn_evaluate(nn, &ctx, split.validation, split.validation_len) == result.best_validation_loss,
+               "overfitting: restored parameters don't have the best validation loss");
+    nn_free(want);
+    nn_free(nn);
+
+    training_context_free(ctx);
+    nn_free(initial);
+    xfree(data);
+  }
+}
+
+/// Single-threaded Hogwild must be minibatch SGD over the same shuffled order, skipping the inputs a minibatch doesn't
+/// use changing nothing; threads racing on a sparse problem must still make progress.
+static void test_hogwild() {
+  for (usize round = 0; round < 8; ++round) {
+    usize layers[] = {rand_usize(2, 12), rand_usize(1, 6), rand_usize(1, 3)};
+    const usize inputs = layers[0];
+    const usize stride = inputs + layers[2];
+    const usize n = rand_usize(1, 30);
+    f32 *data = xalloc(f32, n * stride);
+    rand_fill(data, n * stride, 0, 1);
+    // Sparse inputs, so that most minibatches leave some inputs untouched.
+    for (usize s = 0; s < n; ++s)
+      for (usize j = 0; j < inputs; ++j)
+        if (rand_usize(0, 3) != 0)
+          data[s * stride + j] = 0;
+    HogwildConfig config = {
+        .n_threads = 1,
+        .batch = rand_usize(1, 8),
+        .rate = 0.5f,
+        .epochs = rand_usize(1, 3),
+        .seed = round,
+    };
+    NN nn = nn_new(layers, ARR_LEN(layers));
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, round, 1);
+    NN want = nn_clone_in(nn, &DA_CONFIG_CACHE_ALIGNED);
+    f32 loss = nn_train_hogwild(&nn, LOSS_MSE, data, n * stride, config);
+
+    TrainingContext ctx = training_context_new(want, LOSS_MSE, config.batch, 0);
+    usize *order = xalloc(usize, n);
+    f32 *shuffled = xalloc(f32, n * stride);
+    for (usize i = 0; i < n; ++i)
+      order[i] = i;
+    Rng rng = {.seed = config.seed, .stream = 0};
+    f32 want_loss = 0;
+    for (usize epoch = 0; epoch < config.epochs; ++epoch) {
+      for (usize i = n - 1; i > 0; --i) {
+        usize j = min((usize)(rng_f32_at(rng, epoch * n + i) * (f32)(i + 1)), i);
+        usize tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+      }
+      for (usize i = 0; i < n; ++i)
+        memcpy(&shuffled[i * stride], &data[order[i] * stride], stride * sizeof(f32));
+      want_loss = 0;
+      for (usize begin = 0; begin < n; begin += config.batch) {
+        usize batch = min(config.batch, n - begin);
+        training_context_load_batch(&ctx, want, shuffled, NULL, begin, batch);
+        training_context_zero_grads(&ctx);
+        want_loss += nn_backprop_batch(want, &ctx, batch, 1 / (f32)batch);
+        nn_apply_grads(&want, &ctx, config.rate);
+      }
+    }
+    TEST_CHECK(memcmp(nn.pool.da_items, want.pool.da_items, nn.pool.da_len * sizeof(f32)) == 0,
+               "round %zu: 1 thread trained differently than minibatch SGD", round);
+    TEST_CHECK(loss == want_loss / (f32)n, "round %zu: loss %.8g, want %.8g", round, loss, want_loss / (f32)n);
+    xfree(shuffled);
+    xfree(order);
+    training_context_free(ctx);
+    nn_free(want);
+    nn_free(nn);
+    xfree(data);
+  }
+
+  // Targets from a linear teacher over a few active inputs per sample.
+  const usize inputs = 64, nonzero = 4, n = 512, stride = inputs + 1;
+  usize layers[] = {inputs, 8, 1};
+  f32 teacher[64];
+  rand_fill(teacher, inputs, -1, 1);
+  f32 *data = xalloc(f32, n * stride);
+  memset(data, 0, n * stride * sizeof(f32));
+  for (usize s = 0; s < n; ++s) {
+    f32 z = 0;
+    for (usize k = 0; k < nonzero; ++k) {
+      usize j = rand_usize(0, inputs - 1);
+      data[s * stride + j] = 1;
+      z += teacher[j];
+    }
+    data[s * stride + inputs] = 1 / (1 + expf(-z));
+  }
+  NN nn = nn_new(layers, ARR_LEN(layers));
+  nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, 1, 1);
+  TrainingContext ctx = training_context_new(nn, LOSS_MSE, n, 0);
+  const f32 before = nn_evaluate(nn, &ctx, data, n * stride);
+  nn_train_hogwild(&nn, LOSS_MSE, data, n * stride,
+                   (HogwildConfig){.n_threads = 4, .batch = 4, .rate = 0.5f, .epochs = 8, .seed = 1});
+  const f32 after = nn_evaluate(nn, &ctx, data, n * stride);
+  TEST_CHECK(after < 0.5f * before, "4 threads: loss %.6g, down from %.6g", after, before);
+  training_context_free(ctx);
+  nn_free(nn);
+  xfree(data);
+}
+
+/// Every model of a `Sweep` must train like its own `nn_train`, up to summation order.
+static void test_sweep() {
+  for (usize round = 0; round < 12; ++round) {
+    Loss loss = (Loss)(round % 3);
+    usize layers_count;
+    usize *layers = rand_topology(&layers_count);
+    if (loss == LOSS_SOFTMAX_CROSS_ENTROPY)
+      layers[layers_count - 1] = max(layers[layers_count - 1], (usize)2);
+    const usize inputs = layers[0];
+    const usize outputs = layers[layers_count - 1];
+    const usize n = rand_usize(1, 9);
+    f32 *data = xalloc(f32, n * (inputs + outputs));
+    for (usize s = 0; s < n; ++s) {
+      f32 *sample = &data[s * (inputs + outputs)];
+      rand_fill(sample, inputs, -1, 1);
+      rand_fill(&sample[inputs], outputs, 0, 1);
+      f32 sum = 0;
+      for (usize o = 0; o < outputs; ++o)
+        sum += sample[inputs + o];
+      if (loss == LOSS_SOFTMAX_CROSS_ENTROPY)
+        for (usize o = 0; o < outputs; ++o)
+          sample[inputs + o] /= sum;
+    }
+
+    const usize models = rand_usize(1, 40);
+    Sweep sweep = sweep_new(layers, layers_count, models, loss);
+    u64 *seeds = xalloc(u64, models);
+    for (usize k = 0; k < models; ++k) {
+      seeds[k] = round * 100 + k;
+      sweep.rates[k] = (f32)(k + 1) / (f32)models;
+    }
+    sweep_init_weights(&sweep, WEIGHT_INIT_XAVIER_UNIFORM, seeds);
+    f32 *losses = xalloc(f32, models);
+    const usize rounds = 3;
+    for (usize r = 0; r < rounds; ++r)
+      sweep_train(&sweep, data, n * (inputs + outputs), losses);
+
+    NN got = nn_new(layers, layers_count);
+    for (usize k = 0; k < models; ++k) {
+      NN nn = nn_new(layers, layers_count);
+      nn.output_activation = loss_output_activation(loss);
+      nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, seeds[k], 1);
+      TrainingContext ctx = training_context_new(nn, loss, n, 0);
+      f32 want_loss = 0;
+      for (usize r = 0; r < rounds; ++r)
+        want_loss = nn_train(&nn, &ctx, data, n * (inputs + outputs), sweep.rates[k]);
+      TEST_CHECK(fabsf(losses[k] - want_loss) <= 1e-4f * fmaxf(1, fabsf(want_loss)),
+                 "%s, model %zu: loss %.8g, want %.8g", loss_name(loss), k, losses[k], want_loss);
+      sweep_get_model(sweep, k, &got);
+      for (usize l = 0; l < nn_layer_count(nn); ++l) {
+        Mat params[] = {*da_get(&got.ws, l), *da_get(&got.bs, l)};
+        Mat want_params[] = {*da_get(&nn.ws, l), *da_get(&nn.bs, l)};
+        for (usize p = 0; p < 2; ++p)
+          for (usize i = 0; i < params[p].rows * params[p].cols; ++i)
+            TEST_CHECK(fabsf(params[p].values[i] - want_params[p].values[i]) <=
+                           1e-4f * fmaxf(1, fabsf(want_params[p].values[i])),
+                       "%s, model %zu, layer %zu, %s[%zu]: %.8g, want %.8g", loss_name(loss), k, l, p == 0 ? "w" : "b",
+                       i, params[p].values[i], want_params[p].values[i]);
+      }
+      training_context_free(ctx);
+      nn_free(nn);
+    }
+    nn_free(got);
+    xfree(losses);
+    xfree(seeds);
+    sweep_free(sweep);
+    xfree(data);
+    xfree(layers);
+  }
+}
+
+/// Recurrent layers: gradients of a truncated BPTT chunk against central differences from the same starting state, and
+/// `rnn_forward` giving the same outputs however the sequence is cut into chunks.
+static void test_rnn() {
+  for (usize round = 0; round < 12; ++round) {
+    RnnCell cell = (RnnCell)(round % 2);
+    Loss loss = (Loss)(round / 2 % 3);
+    const usize outputs = rand_usize(loss == LOSS_SOFTMAX_CROSS_ENTROPY ? 2 : 1, 4);
+    Rnn rnn = rnn_new(cell, rand_usize(1, 4), rand_usize(1, 5), outputs, loss);
+    rnn_init_weights(&rnn, round);
+    rand_fill(rnn.b.values, rnn.b.rows, -0.5f, 0.5f);
+    rand_fill(rnn.b_out.values, rnn.b_out.rows, -0.5f, 0.5f);
+    const usize n = rand_usize(1, 4);
+    const usize steps = rand_usize(1, 6);
+    RnnContext ctx = rnn_context_new(rnn, n, steps);
+    f32 *x = xalloc(f32, steps * rnn.inputs * n);
+    f32 *y = xalloc(f32, steps * outputs * n);
+    rand_fill(x, steps * rnn.inputs * n, -1, 1);
+    rand_fill(y, steps * outputs * n, 0, 1);
+    if (loss == LOSS_SOFTMAX_CROSS_ENTROPY) {
+      for (usize t = 0; t < steps; ++t) {
+        f32 *y_t = &y[t * outputs * n];
+        for (usize s = 0; s < n; ++s) {
+          f32 sum = 0;
+          for (usize r = 0; r < outputs; ++r)
+            sum += y_t[r * n + s];
+          for (usize r = 0; r < outputs; ++r)
+            y_t[r * n + s] /= sum;
+        }
+      }
+    }
+    // A chunk in the middle of a sequence starts from some state, which the gradients must not flow into.
+    f32 *h0 = xalloc(f32, 2 * rnn.hidden * n);
+    f32 *c0 = &h0[rnn.hidden * n];
+    rand_fill(h0, 2 * rnn.hidden * n, -0.9f, 0.9f);
+#define CHUNK_LOSS()                                                                                                   \
+  ({                                                                                                                   \
+    memcpy(ctx.h.values, h0, rnn.hidden * n * sizeof(f32));                                                           \
+    memcpy(ctx.c.values, c0, rnn.hidden * n * sizeof(f32));                                                           \
+    rnn_backprop_chunk(rnn, &ctx, x, y, steps, 1);                                                                     \
+  })
+
+    Mat grads[] = {ctx.dw, ctx.db, ctx.dw_out, ctx.db_out};
+    Mat params[] = {rnn.w, rnn.b, rnn.w_out, rnn.b_out};
+    for (usize i = 0; i < ARR_LEN(grads); ++i)
+      memset(grads[i].values, 0, grads[i].rows * grads[i].cols * sizeof(f32));
+    CHUNK_LOSS();
+    usize grad_len = rnn.pool.da_len;
+    f32 *want = xalloc(f32, grad_len);
+    for (usize i = 0, j = 0; i < ARR_LEN(grads); ++i)
+      for (usize k = 0; k < grads[i].rows * grads[i].cols; ++k, ++j)
+        want[j] = grads[i].values[k];
+    const f32 h = 1e-2f;
+    for (usize i = 0, j = 0; i < ARR_LEN(params); ++i) {
+      for (usize k = 0; k < params[i].rows * params[i].cols; ++k, ++j) {
+        f32 p = params[i].values[k];
+        params[i].values[k] = p + h;
+        f64 plus = CHUNK_LOSS();
+        params[i].values[k] = p - h;
+        f64 minus = CHUNK_LOSS();
+        params[i].values[k] = p;
+        f64 numeric = (plus - minus) / (2 * (f64)h);
+        TEST_CHECK(fabs(numeric - want[j]) <= 5e-3 * fmax(1, fabs(numeric)),
+                   "%s %s, %zu steps, parameter %zu: backprop %.6g, central difference %.6g",
+                   cell == RNN_LSTM ? "lstm" : "gru", loss_name(loss), steps, j, want[j], numeric);
+      }
+    }
+#undef CHUNK_LOSS
+
+    f32 *whole = xalloc(f32, steps * outputs * n);
+    f32 *chunked = xalloc(f32, steps * outputs * n);
+    RnnContext short_ctx = rnn_context_new(rnn, n, rand_usize(1, steps));
+    rnn_context_reset(&ctx);
+    rnn_forward(rnn, &ctx, x, whole, steps);
+    rnn_forward(rnn, &short_ctx, x, chunked, steps);
+    TEST_CHECK(memcmp(whole, chunked, steps * outputs * n * sizeof(f32)) == 0, "%zu steps in chunks of %zu differ",
+               steps, short_ctx.bptt);
+    TEST_CHECK(memcmp(ctx.h.values, short_ctx.h.values, rnn.hidden * n * sizeof(f32)) == 0, "final states differ");
+    rnn_context_free(short_ctx);
+    xfree(whole);
+    xfree(chunked);
+    xfree(want);
+    xfree(h0);
+    xfree(x);
+    xfree(y);
+    rnn_context_free(ctx);
+    rnn_free(rnn);
+  }
+}
+
+/// `embedding_gather` must copy the right rows, and a training step must move exactly the rows it touched, by the
+/// central differences of the step's loss w.r.t. them, and the network like the same step on the gathered inputs.
+static void test_embedding() {
+  for (usize round = 0; round < 12; ++round) {
+    Embedding emb = embedding_new_in(rand_usize(1, 40), rand_usize(1, 20), &DA_CONFIG_CACHE_ALIGNED);
+    embedding_init_weights(&emb, round);
+    const usize dim = emb.dim;
+    const usize fields = rand_usize(1, 3);
+    const usize dense = rand_usize(0, 3);
+    usize layers[] = {fields * dim + dense, rand_usize(1, 6), rand_usize(1, 3)};
+    NN nn = nn_new(layers, ARR_LEN(layers));
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, round, 1);
+    const usize outputs = layers[2];
+    const usize n = rand_usize(1, 10);
+    u32 *ids = xalloc(u32, n * fields);
+    for (usize i = 0; i < n * fields; ++i)
+      ids[i] = (u32)rand_usize(0, emb.rows - 1);
+    f32 *data = xalloc(f32, n * (dense + outputs));
+    rand_fill(data, n * (dense + outputs), 0, 1);
+
+    // The whole batch as plain `nn_train` data.
+    const usize stride = layers[0] + outputs;
+    f32 *gathered = xalloc(f32, n * stride);
+    embedding_gather(emb, ids, n, fields, gathered, stride);
+    for (usize s = 0; s < n; ++s) {
+      for (usize f = 0; f < fields; ++f)
+        TEST_CHECK(memcmp(&gathered[s * stride + f * dim], &emb.table.da_items[ids[s * fields + f] * dim],
+                          dim * sizeof(f32)) == 0,
+                   "sample %zu field %zu gathered the wrong row", s, f);
+      memcpy(&gathered[s * stride + fields * dim], &data[s * (dense + outputs)], (dense + outputs) * sizeof(f32));
+    }
+
+    TrainingContext ctx = training_context_new(nn, LOSS_MSE, n, 0);
+    const f32 h = 1e-2f;
+    f32 *want = xalloc(f32, emb.rows * dim);
+    memcpy(want, emb.table.da_items, emb.rows * dim * sizeof(f32));
+    const f32 rate = 0.5f;
+    for (usize i = 0; i < emb.rows * dim; ++i) {
+      f32 p = emb.table.da_items[i];
+      emb.table.da_items[i] = p + h;
+      embedding_gather(emb, ids, n, fields, gathered, stride);
+      f64 plus = nn_evaluate(nn, &ctx, gathered, n * stride);
+      emb.table.da_items[i] = p - h;
+      embedding_gather(emb, ids, n, fields, gathered, stride);
+      f64 minus = nn_evaluate(nn, &ctx, gathered, n * stride);
+      emb.table.da_items[i] = p;
+      want[i] -= rate * (f32)((plus - minus) / (2 * (f64)h));
+    }
+    embedding_gather(emb, ids, n, fields, gathered, stride);
+    NN want_nn = nn_clone_in(nn, &DA_CONFIG_CACHE_ALIGNED);
+    nn_train(&want_nn, &ctx, gathered, n * stride, rate);
+
+    EmbeddingGrad grad = embedding_grad_new(emb, n * fields);
+    f32 *before = xalloc(f32, emb.rows * dim);
+    memcpy(before, emb.table.da_items, emb.rows * dim * sizeof(f32));
+    embedding_nn_train(&emb, &grad, &nn, &ctx, ids, fields, data, n, rate);
+    for (usize r = 0; r < emb.rows; ++r) {
+      bool touched = false;
+      for (usize i = 0; i < n * fields; ++i)
+        touched |= ids[i] == r;
+      for (usize i = r * dim; i < (r + 1) * dim; ++i) {
+        if (!touched)
+          TEST_CHECK(emb.table.da_items[i] == before[i], "untouched row %zu changed", r);
+        else
+          TEST_CHECK(fabsf(emb.table.da_items[i] - want[i]) <= 5e-3f * fmaxf(1, fabsf(want[i] - before[i])),
+                     "row %zu [%zu]: %.6g, central difference %.6g", r, i % dim, emb.table.da_items[i], want[i]);
+      }
+      TEST_CHECK(grad.slots[r] == EMBEDDING_NO_SLOT, "slot of row %zu not cleared", r);
+    }
+    TEST_CHECK(grad.touched_len == 0, "touched rows not cleared");
+    TEST_CHECK(memcmp(nn.pool.da_items, want_nn.pool.da_items, nn.pool.da_len * sizeof(f32)) == 0,
+               "network trained differently than nn_train");
+
+    xfree(before);
+    embedding_grad_free(grad);
+    nn_free(want_nn);
+    xfree(want);
+    training_context_free(ctx);
+    xfree(gathered);
+    xfree(data);
+    xfree(ids);
+    nn_free(nn);
+    embedding_free(emb);
+  }
+}
+
+static void test_alloc_track() {
+  // Explicit calls are counted in every build.
+  const i32 line = __LINE__;
+  const AllocStats before = alloc_track_stats();
+  const AllocSiteStats site_before = alloc_track_site_stats(__FILE__, line);
+  const usize len = rand_usize(1, 1 << 16);
+  void *p = alloc_track_malloc(len, __FILE__, line);
+  AllocStats stats = alloc_track_stats();
+  TEST_CHECK(stats.live_bytes - before.live_bytes >= (i64)len, "%" PRIi64 " live bytes after allocating %zu",
+             stats.live_bytes - before.live_bytes, len);
+  TEST_CHECK(stats.peak_bytes >= stats.live_bytes, "peak %" PRIi64 " under live %" PRIi64, stats.peak_bytes,
+             stats.live_bytes);
+  p = alloc_track_realloc(p, 4 * len, __FILE__, line);
+  stats = alloc_track_stats();
+  TEST_CHECK(stats.live_bytes - before.live_bytes >= 4 * (i64)len, "%" PRIi64 " live bytes after growing to %zu",
+             stats.live_bytes - before.live_bytes, 4 * len);
+
+  // Nested steps count once.
+  alloc_track_step_begin();
+  alloc_track_step_begin();
+  alloc_track_free(alloc_track_malloc(1, __FILE__, line));
+  alloc_track_step_end();
+  alloc_track_step_end();
+  alloc_track_free(p);
+  stats = alloc_track_stats();
+  AllocSiteStats site = alloc_track_site_stats(__FILE__, line);
+  TEST_CHECK(stats.live_bytes == before.live_bytes, "%" PRIi64 " bytes leaked",
+             stats.live_bytes - before.live_bytes);
+  TEST_CHECK(stats.allocs - before.allocs == 3 && stats.frees - before.frees == 2,
+             "%" PRIu64 " allocations and %" PRIu64 " frees, want 3 and 2", stats.allocs - before.allocs,
+             stats.frees - before.frees);
+  TEST_CHECK(stats.steps - before.steps == 1 && stats.step_allocs - before.step_allocs == 1 &&
+                 stats.allocating_steps - before.allocating_steps == 1,
+             "%" PRIu64 " steps with %" PRIu64 " allocations, want 1 and 1", stats.steps - before.steps,
+             stats.step_allocs - before.step_allocs);
+  TEST_CHECK(site.allocs - site_before.allocs == 3 && site.step_allocs - site_before.step_allocs == 1 &&
+                 site.bytes - site_before.bytes >= 5 * len + 1,
+             "site has %" PRIu64 " allocations (%" PRIu64 " in steps) of %" PRIu64 " bytes",
+             site.allocs - site_before.allocs, site.step_allocs - site_before.step_allocs,
+             site.bytes - site_before.bytes);
+
+#ifdef ALLOC_TRACKING
+  // Once set up, training steps don't allocate.
+  for (NNNorm norm = NN_NORM_NONE; norm <= NN_NORM_LAYER; ++norm) {
+    usize layers[] = {rand_usize(1, 8), rand_usize(1, 8), rand_usize(1, 8), rand_usize(1, 4)};
+    NNOptions options = {.activations = NN_ACTIVATIONS_PER_LAYER, .pool_layout = NN_POOL_INTERLEAVED, .norm = norm};
+    NN nn = nn_new_with(layers, ARR_LEN(layers), &DA_CONFIG_CACHE_ALIGNED, options);
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, norm, 1);
+    const usize n = rand_usize(2, 20);
+    const usize stride = layers[0] + layers[3];
+    f32 *data = xalloc(f32, n * stride);
+    rand_fill(data, n * stride, 0, 1);
+    TrainingContext ctx = training_context_new(nn, LOSS_MSE, rand_usize(1, n), rand_usize(0, 2));
+    const AllocStats train_before = alloc_track_stats();
+    for (usize round = 0; round < 3; ++round)
+      nn_train(&nn, &ctx, data, n * stride, 0.1f);
+    stats = alloc_track_stats();
+    TEST_CHECK(stats.steps - train_before.steps == 3, "%" PRIu64 " steps, want 3", stats.steps - train_before.steps);
+    TEST_CHECK(stats.step_allocs == train_before.step_allocs, "norm %d: %" PRIu64 " allocations in training steps",
+               norm, stats.step_allocs - train_before.step_allocs);
+    training_context_free(ctx);
+    xfree(data);
+    nn_free(nn);
+  }
+#endif
+}
+
+static void test_infer_cache() {
+  for (usize round = 0; round < 20; ++round) {
+    const usize len = rand_usize(1, 40);
+    f32 *x = xalloc(f32, len);
+    rand_fill(x, len, -1, 1);
+    const u64 hash = infer_cache_hash(x, len);
+    TEST_CHECK(hash != INFER_CACHE_EMPTY && hash == infer_cache_hash(x, len), "len %zu: unstable hash", len);
+    TEST_CHECK(len == 1 || infer_cache_hash(x, len - 1) != hash, "len %zu: prefix hashes the same", len);
+    for (usize i = 0; i < len; ++i) {
+      f32 v = x[i];
+      x[i] = nextafterf(v, INFINITY);
+      TEST_CHECK(infer_cache_hash(x, len) != hash, "len %zu: flipping [%zu] keeps the hash", len, i);
+      x[i] = v;
+    }
+    xfree(x);
+  }
+
+  // CLOCK within one bucket: hits get a second chance, the first entry never hit is evicted.
+  {
+    InferCache cache = infer_cache_new(1, 1, 2 * INFER_CACHE_WAYS);
+    const u64 hash = cache.buckets;
+    for (usize i = 0; i < INFER_CACHE_WAYS; ++i) {
+      f32 key = (f32)i;
+      infer_cache_insert(&cache, &key, hash, &key);
+    }
+    for (usize i = 0; i < INFER_CACHE_WAYS / 2; ++i)
+      infer_cache_lookup(&cache, &(f32){(f32)i}, hash);
+    for (usize k = 0; k < 2; ++k) {
+      f32 key = (f32)(INFER_CACHE_WAYS + k);
+      infer_cache_insert(&cache, &key, hash, &key);
+      const f32 *got = infer_cache_lookup(&cache, &key, hash);
+      TEST_CHECK(got != NULL && *got == key, "inserted entry %zu missing", k);
+      for (usize i = 0; i < INFER_CACHE_WAYS; ++i) {
+        bool evicted = i >= INFER_CACHE_WAYS / 2 && i <= INFER_CACHE_WAYS / 2 + k;
+        TEST_CHECK((infer_cache_lookup(&cache, &(f32){(f32)i}, hash) == NULL) == evicted,
+                   "after %zu evictions, entry %zu %s", k + 1, i, evicted ? "still cached" : "evicted");
+      }
+    }
+    TEST_CHECK(cache.stats.evictions == 2, "%" PRIu64 " evictions, want 2", cache.stats.evictions);
+    infer_cache_clear(&cache);
+    TEST_CHECK(infer_cache_lookup(&cache, &(f32){0}, hash) == NULL, "entry left after clear");
+    infer_cache_free(cache);
+  }
+
+  // Cached outputs are the network's, through hits, misses and evictions.
+  for (usize round = 0; round < 8; ++round) {
+    usize layers[] = {rand_usize(1, 12), rand_usize(1, 8), rand_usize(1, 4)};
+    NN nn = nn_new(layers, ARR_LEN(layers));
+    nn_init_weights(&nn, WEIGHT_INIT_XAVIER_UNIFORM, round, 1);
+    const usize distinct = rand_usize(1, 64);
+    f32 *inputs = xalloc(f32, distinct * layers[0]);
+    rand_fill(inputs, distinct * layers[0], -1, 1);
+    InferCache cache = infer_cache_new(layers[0], layers[2], rand_usize(1, 32));
+    const usize queries = 200;
+    for (usize q = 0; q < queries; ++q) {
+      const f32 *input = &inputs[rand_usize(0, distinct - 1) * layers[0]];
+      const f32 *got = nn_forward_cached(nn, &cache, input);
+      const f32 *want = nn_forward(nn, input);
+      TEST_CHECK(memcmp(got, want, layers[2] * sizeof(f32)) == 0, "query %zu: cached outputs differ", q);
+      const u64 hits = cache.stats.hits;
+      nn_forward_cached(nn, &cache, input);
+      TEST_CHECK(cache.stats.hits == hits + 1, "query %zu: repeat missed", q);
+    }
+    InferCacheStats stats = cache.stats;
+    TEST_CHECK(stats.lookups == 2 * queries && stats.hits >= queries, "%" PRIu64 " hits of %" PRIu64 " lookups",
+               stats.hits, stats.lookups);
+    TEST_CHECK(stats.evictions <= stats.lookups - stats.hits, "%" PRIu64 " evictions for %" PRIu64 " misses",
+               stats.evictions, stats.lookups - stats.hits);
+    xfree(inputs);
+    infer_cache_free(cache);
+    nn_free(nn);
+  }
+}
+
+typedef struct Test {
+  const char *name;
+  void (*f)();
+} Test;
+
+#define TEST(F) {.name = #F, .f = F}
+
+static const Test tests[] = {
+    TEST(test_mat_mul),
+    TEST(test_mat_mul_add_rhs_t),
+    TEST(test_mat_mul_lhs_t),
+    TEST(test_mat_add_col_and_row_sums),
+    TEST(test_sigmoid_mat),
+    TEST(test_exp_log_lanes),
+    TEST(test_softmax_mat),
+    TEST(test_loss_fused),
+    TEST(test_conv2d),
+    TEST(test_rng_chunking),
+    TEST(test_forward_paths),
+    TEST(test_graph),
+    TEST(test_graph_backward),
+    TEST(test_gradients),
+    TEST(test_fold_batch_norm),
+    TEST(test_checkpoint),
+    TEST(test_lr_schedule),
+    TEST(test_fit),
+    TEST(test_hogwild),
+    TEST(test_sweep),
+    TEST(test_rnn),
+    TEST(test_embedding),
+    TEST(test_alloc_track),
+    TEST(test_infer_cache),
+};
+
+int main(int argc, char **argv) {
+  const char *filter = argc > 1 ? argv[1] : "";
+  test_rng.seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+  usize failed_tests = 0;
+  usize ran = 0;
+  for (usize i = 0; i < ARR_LEN(tests); ++i) {
+    if (strstr(tests[i].name, filter) == NULL)
+      continue;
+    usize failures_before = failures;
+    usize checks_before = checks;
+    tests[i].f();
+    ++ran;
+    bool ok = failures == failures_before;
+    failed_tests += !ok;
+    printf("%s %s (%zu checks)\n", ok ? "ok  " : "FAIL", tests[i].name, checks - checks_before);
+  }
+  printf("%zu/%zu tests passed, seed %llu\n", ran - failed_tests, ran, (unsigned long long)test_rng.seed);
+  return failed_tests == 0 ? 0 : 1;
+}
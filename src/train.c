@@ -0,0 +1,216 @@
+#include "train.h"
+#include "parallel.h"
+#include "alloc_track.h"
+
+f32 lr_schedule_rate(LrSchedule schedule, usize round, usize rounds) {
+  if (round < schedule.warmup_rounds)
+    return schedule.rate * (f32)(round + 1) / (f32)schedule.warmup_rounds;
+  usize t = round - schedule.warmup_rounds;
+  switch (schedule.kind) {
+  case LR_SCHEDULE_CONSTANT:
+    return schedule.rate;
+  case LR_SCHEDULE_STEP:
+    ASSERT(schedule.step_rounds > 0);
+    return schedule.rate * powf(schedule.step_gamma, (f32)(t / schedule.step_rounds));
+  case LR_SCHEDULE_COSINE: {
+    usize span = rounds > schedule.warmup_rounds + 1 ? rounds - schedule.warmup_rounds - 1 : 1;
+    f32 progress = min((f32)t / (f32)span, 1.0f);
+    return schedule.min_rate + (schedule.rate - schedule.min_rate) * 0.5f * (1 + cosf((f32)M_PI * progress));
+  }
+  }
+  __builtin_unreachable();
+}
+
+TrainSplit train_split(const f32 *data, usize data_len, usize stride, f32 validation_fraction) {
+  ASSERT(data_len % stride == 0);
+  ASSERT(validation_fraction >= 0 && validation_fraction < 1);
+  usize n = data_len / stride;
+  usize validation = (usize)((f32)n * validation_fraction);
+  if (validation == 0 && validation_fraction > 0 && n >= 2)
+    validation = 1;
+  usize train = n - validation;
+  return (TrainSplit){
+      .train = data,
+      .train_len = train * stride,
+      .validation = &data[train * stride],
+      .validation_len = validation * stride,
+  };
+}
+
+TrainResult nn_fit(NN *nn, TrainingContext *ctx, TrainSplit split, TrainConfig config) {
+  ASSERT(config.max_rounds > 0);
+  ASSERT(config.eval_every > 0);
+  const f32 *validation = split.validation_len > 0 ? split.validation : split.train;
+  usize validation_len = split.validation_len > 0 ? split.validation_len : split.train_len;
+  f32 *best = config.restore_best ? xalloc(f32, nn->pool.da_len) : NULL;
+
+  TrainResult result = {.best_validation_loss = INFINITY};
+  f32 patience_loss = INFINITY;
+  usize stale_evals = 0;
+  for (usize round = 0; round < config.max_rounds; ++round) {
+    f32 rate = lr_schedule_rate(config.schedule, round, config.max_rounds);
+    result.train_loss = nn_train(nn, ctx, split.train, split.train_len, rate);
+    result.rounds = round + 1;
+    if (config.checkpoints != NULL && config.checkpoint_every > 0 && result.rounds % config.checkpoint_every == 0)
+      checkpoint_writer_submit(config.checkpoints, *nn, result.rounds);
+    if (result.rounds % config.eval_every != 0 && result.rounds != config.max_rounds)
+      continue;
+
+    f32 validation_loss = nn_evaluate(*nn, ctx, validation, validation_len);
+    if (config.verbose)
+      printf("%zu\tlr: %.06f\ttrain loss: %.08f\tvalidation loss: %.08f\n", result.rounds, rate, result.train_loss,
+             validation_loss);
+    if (validation_loss < result.best_validation_loss) {
+      result.best_validation_loss = validation_loss;
+      result.best_round = result.rounds;
+      if (best != NULL)
+        memcpy(best, nn->pool.da_items, nn->pool.da_len * sizeof(f32));
+    }
+    // Improvements are measured against the loss when the patience was last reset, so that a slow crawl of steps
+    // smaller than `min_delta` still runs out of patience.
+    if (validation_loss < patience_loss - config.min_delta) {
+      patience_loss = validation_loss;
+      stale_evals = 0;
+    } else if (config.patience > 0 && ++stale_evals >= config.patience) {
+      result.stopped_early = true;
+      break;
+    }
+  }
+
+  if (best != NULL) {
+    if (result.best_round > 0)
+      memcpy(nn->pool.da_items, best, nn->pool.da_len * sizeof(f32));
+    xfree(best);
+  }
+  if (config.verbose && result.stopped_early)
+    printf("stopped early after %zu rounds, best validation loss %.08f at round %zu\n", result.rounds,
+           result.best_validation_loss, result.best_round);
+  return result;
+}
+
+typedef struct HogwildWorker {
+  /// Shares the matrices of the caller's network.
+  NN nn;
+  TrainingContext ctx;
+  const f32 *data;
+  /// Samples `begin..end` of `data`.
+  usize begin;
+  usize end;
+  usize *order;
+  /// The epoch's uniforms for shuffling `order`.
+  f32 *uniforms;
+  /// Inputs that are non-zero somewhere in the current minibatch.
+  usize *active;
+  HogwildConfig config;
+  usize index;
+  f32 loss;
+} HogwildWorker;
+
+static void hogwild_apply(HogwildWorker *worker, usize n) {
+  NN nn = worker->nn;
+  TrainingContext *ctx = &worker->ctx;
+  const f32 rate = worker->config.rate;
+  const usize inputs = nn_input_count(nn);
+  usize active = 0;
+  for (usize j = 0; j < inputs; ++j) {
+    const f32 *row = &ctx->x.values[j * n];
+    bool any = false;
+    for (usize s = 0; s < n; ++s)
+      any |= row[s] != 0;
+    if (any)
+      worker->active[active++] = j;
+  }
+  for (usize l = 0; l < nn_layer_count(nn); ++l) {
+    Mat w = *da_get(&nn.ws, l);
+    Mat b = *da_get(&nn.bs, l);
+    Mat dw = *da_get(&ctx->dws, l);
+    Mat db = *da_get(&ctx->dbs, l);
+    if (l == 0 && active < inputs) {
+      for (usize r = 0; r < w.rows; ++r)
+        for (usize i = 0; i < active; ++i)
+          w.values[r * w.cols + worker->active[i]] -= rate * dw.values[r * w.cols + worker->active[i]];
+    } else {
+      for (usize j = 0; j < w.rows * w.cols; ++j)
+        w.values[j] -= rate * dw.values[j];
+    }
+    for (usize j = 0; j < b.rows; ++j)
+      b.values[j] -= rate * db.values[j];
+  }
+}
+
+static void *hogwild_worker_main(void *worker_) {
+  HogwildWorker *worker = worker_;
+  NN nn = worker->nn;
+  TrainingContext *ctx = &worker->ctx;
+  const usize len = worker->end - worker->begin;
+  for (usize i = 0; i < len; ++i)
+    worker->order[i] = worker->begin + i;
+  Rng rng = {.seed = worker->config.seed, .stream = worker->index};
+  for (usize epoch = 0; epoch < worker->config.epochs; ++epoch) {
+    // Fisher-Yates, with the epoch's own range of the thread's stream.
+    rng_fill_uniform(rng, worker->uniforms, epoch * len, (epoch + 1) * len, 0, 1);
+    for (usize i = len - 1; i > 0; --i) {
+      usize j = min((usize)(worker->uniforms[i] * (f32)(i + 1)), i);
+      usize tmp = worker->order[i];
+      worker->order[i] = worker->order[j];
+      worker->order[j] = tmp;
+    }
+    worker->loss = 0;
+    for (usize begin = 0; begin < len; begin += ctx->batch) {
+      ALLOC_TRACK_STEP_BEGIN();
+      usize n = min(ctx->batch, len - begin);
+      training_context_load_batch(ctx, nn, worker->data, worker->order, begin, n);
+      training_context_zero_grads(ctx);
+      worker->loss += nn_backprop_batch(nn, ctx, n, 1 / (f32)n);
+      hogwild_apply(worker, n);
+      ALLOC_TRACK_STEP_END();
+    }
+  }
+  return NULL;
+}
+
+f32 nn_train_hogwild(NN *nn, Loss loss, const f32 *data, usize data_len, HogwildConfig config) {
+  const usize stride = nn_input_count(*nn) + nn_output_count(*nn);
+  const usize n = data_len / stride;
+  ASSERT(data_len % stride == 0);
+  ASSERT_PRINTF(nn->norm == NN_NORM_NONE, "hogwild doesn't train normalization parameters\n");
+  ASSERT(config.batch > 0);
+  // Every thread needs at least one sample.
+  const usize n_threads = min(max(config.n_threads, (usize)1), n);
+  ASSERT(n_threads > 0);
+  HogwildWorker *workers = xalloc(HogwildWorker, n_threads);
+  pthread_t *threads = xalloc(pthread_t, n_threads);
+  for (usize t = 0; t < n_threads; ++t) {
+    usize begin = n * t / n_threads;
+    usize end = n * (t + 1) / n_threads;
+    workers[t] = (HogwildWorker){
+        .nn = *nn,
+        .ctx = training_context_new(*nn, loss, config.batch, 0),
+        .data = data,
+        .begin = begin,
+        .end = end,
+        .order = xalloc(usize, end - begin),
+        .uniforms = xalloc(f32, end - begin),
+        .active = xalloc(usize, nn_input_count(*nn)),
+        .config = config,
+        .index = t,
+    };
+  }
+  for (usize t = 1; t < n_threads; ++t)
+    ASSERT(pthread_create(&threads[t], NULL, hogwild_worker_main, &workers[t]) == 0);
+  hogwild_worker_main(&workers[0]);
+  f32 total = workers[0].loss;
+  for (usize t = 1; t < n_threads; ++t) {
+    pthread_join(threads[t], NULL);
+    total += workers[t].loss;
+  }
+  for (usize t = 0; t < n_threads; ++t) {
+    training_context_free(workers[t].ctx);
+    xfree(workers[t].order);
+    xfree(workers[t].uniforms);
+    xfree(workers[t].active);
+  }
+  xfree(workers);
+  xfree(threads);
+  return total / (f32)n;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common.h"
+#include "nn.h"
+#include "checkpoint.h"
+
+typedef enum LrScheduleKind {
+  /// `rate` throughout.
+  LR_SCHEDULE_CONSTANT,
+  /// `rate * step_gamma^(t / step_rounds)`.
+  LR_SCHEDULE_STEP,
+  /// Half a cosine from `rate` down to `min_rate` at the last round.
+  LR_SCHEDULE_COSINE,
+} LrScheduleKind;
+
+/// Learning rate per round. `t` above counts rounds after the warmup.
+typedef struct LrSchedule {
+  LrScheduleKind kind;
+  f32 rate;
+  /// The rate ramps up linearly from `rate / warmup_rounds` to `rate` over the first `warmup_rounds` rounds.
+  usize warmup_rounds;
+  /// LR_SCHEDULE_STEP.
+  usize step_rounds;
+  f32 step_gamma;
+  /// LR_SCHEDULE_COSINE.
+  f32 min_rate;
+} LrSchedule;
+
+/// Learning rate of round `round` (from 0) out of `rounds`.
+f32 lr_schedule_rate(LrSchedule schedule, usize round, usize rounds);
+
+typedef struct TrainConfig {
+  LrSchedule schedule;
+  usize max_rounds;
+  /// Validation loss is computed every `eval_every` rounds, and after the last one.
+  usize eval_every;
+  /// Stop once `patience` evaluations in a row didn't improve on the best validation loss by more than `min_delta`.
+  /// 0 never stops early.
+  usize patience;
+  f32 min_delta;
+  /// Put the parameters with the best validation loss back into the network at the end.
+  bool restore_best;
+  /// Print the losses at every evaluation.
+  bool verbose;
+  /// Nullable, snapshot the network every `checkpoint_every` rounds.
+  CheckpointWriter *checkpoints;
+  usize checkpoint_every;
+} TrainConfig;
+
+typedef struct TrainResult {
+  /// Rounds actually run.
+  usize rounds;
+  bool stopped_early;
+  /// Mean training loss of the last round, before its update.
+  f32 train_loss;
+  f32 best_validation_loss;
+  /// Number of rounds run when the best validation loss was measured.
+  usize best_round;
+} TrainResult;
+
+/// Samples `[0, split)` for training and `[split, n)` for validation.
+typedef struct TrainSplit {
+  const f32 *train;
+  usize train_len;
+  const f32 *validation;
+  usize validation_len;
+} TrainSplit;
+
+/// Hold out the last `validation_fraction` of the samples in `data` (at least one, if there are two or more), without
+/// copying. `data` should already be shuffled.
+TrainSplit train_split(const f32 *data, usize data_len, usize stride, f32 validation_fraction);
+
+/// Full-batch gradient descent with `config.schedule`, evaluating on `split.validation` (batched through `ctx`) and
+/// stopping early as configured. An empty validation set falls back to evaluating on the training set.
+TrainResult nn_fit(NN *nn, TrainingContext *ctx, TrainSplit split, TrainConfig config);
+
+typedef struct HogwildConfig {
+  usize n_threads;
+  /// Samples per update, per thread.
+  usize batch;
+  f32 rate;
+  usize epochs;
+  /// Every thread shuffles its shard with its own stream of `seed` every epoch.
+  u64 seed;
+} HogwildConfig;
+
+/// Asynchronous minibatch SGD (Hogwild!): every thread trains on its own shard of `data` with its own
+/// `TrainingContext` for activations and gradients, and subtracts its updates straight from the shared `NN.pool` with
+/// plain unsynchronized writes, without locks or waiting for the other threads. Updates racing on the same weight may
+/// lose one another, which SGD tolerates, and which is rare when the inputs are sparse: the first layer only updates
+/// the weights of inputs that are non-zero somewhere in the minibatch.
+/// `data` is laid out like for `nn_train`. Not deterministic with more than one thread.
+/// Returns the mean loss per sample over the last epoch, every sample measured before its own update.
+f32 nn_train_hogwild(NN *nn, Loss loss, const f32 *data, usize data_len, HogwildConfig config);
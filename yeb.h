@@ -201,6 +201,35 @@ typedef struct cmd {
 
 void execute(Cmd cmd);
 
+/// Commands running in the background, at most `max` at a time.
+typedef struct Jobs {
+  /// 0 means one per CPU.
+  size_t max;
+  size_t running;
+  /// Exit code of the first job that failed, 0 if none did.
+  int failed;
+} Jobs;
+
+/// Run `cmd` in the background, first waiting for a job to finish if `max`
+/// jobs are already running.
+void jobs_spawn(Jobs *jobs, Cmd cmd);
+
+/// Wait for every job, exit if any of them failed.
+void jobs_wait_all(Jobs *jobs);
+
+/// Whether `target` is missing or older than any of `deps`.
+/// Missing dependencies count as newer.
+bool needs_rebuild(const char *target, ConstStrings deps);
+
+/// Whether `target` is missing or older than any of the dependencies listed in
+/// `depfile`, a Makefile rule as written by `cc -MMD`.
+/// A missing depfile counts as out of date.
+bool needs_rebuild_depfile(const char *target, const char *depfile);
+
+/// Whether `cmd` differs from the command saved in `cmdfile`, then saves `cmd`
+/// into it. For rebuilding when flags change but no file did.
+bool cmd_changed(Cmd cmd, const char *cmdfile);
+
 /// Null means absent of value.
 typedef union MaybeDynString {
   DynString ds;
@@ -309,6 +338,151 @@ void execute(Cmd cmd) {
   }
 }
 
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/// Wait for one job, returns false if there was none.
+static inline bool jobs_wait_one(Jobs *jobs) {
+  if (jobs->running == 0)
+    return false;
+  int status;
+  pid_t pid = wait(&status);
+  if (pid < 0)
+    return false;
+  --jobs->running;
+  int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  if (exit_code != 0 && jobs->failed == 0)
+    jobs->failed = exit_code;
+  return true;
+}
+
+void jobs_spawn(Jobs *jobs, Cmd cmd) {
+  if (jobs->max == 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs->max = n > 0 ? (size_t)n : 1;
+  }
+  while (jobs->running >= jobs->max)
+    jobs_wait_one(jobs);
+  // Don't start anything new once something failed.
+  if (jobs->failed != 0)
+    return;
+  char *s = concat_strings_with_space(cmd.args).cstr;
+  printf("$ %s\n", s);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    printf("YEB: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    execl("/bin/sh", "sh", "-c", s, (char *)NULL);
+    _exit(127);
+  }
+  // The child has its own copy.
+  free(s);
+  ++jobs->running;
+}
+
+void jobs_wait_all(Jobs *jobs) {
+  while (jobs_wait_one(jobs))
+    ;
+  if (jobs->failed != 0) {
+    printf("YEB: command finished with non-zero exit code\n");
+    exit(jobs->failed);
+  }
+}
+
+/// Modification time in nanoseconds, or -1 if the file is missing.
+static inline int64_t mtime_ns(const char *path) {
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return -1;
+#ifdef __APPLE__
+  return (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+         st.st_mtimespec.tv_nsec;
+#else
+  return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+bool needs_rebuild(const char *target, ConstStrings deps) {
+  int64_t target_mtime = mtime_ns(target);
+  if (target_mtime < 0)
+    return true;
+  for (size_t i = 0; i < deps.da_len; ++i) {
+    int64_t dep_mtime = mtime_ns(*da_get(&deps, i));
+    if (dep_mtime < 0 || dep_mtime > target_mtime)
+      return true;
+  }
+  return false;
+}
+
+bool needs_rebuild_depfile(const char *target, const char *depfile) {
+  FILE *f = fopen(depfile, "r");
+  if (f == NULL)
+    return true;
+  DynString contents = dynstring_new();
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) != 0)
+    dynstring_append(&contents, buf, n);
+  fclose(f);
+
+  // "target: dep dep \<newline> dep", spaces in paths are escaped with "\".
+  ConstStrings deps = {0};
+  char *colon = strchr(contents.cstr, ':');
+  if (colon == NULL) {
+    free(contents.cstr);
+    return true;
+  }
+  for (char *p = colon + 1; *p != '\0';) {
+    if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ||
+        (*p == '\\' && (p[1] == '\n' || p[1] == '\r'))) {
+      ++p;
+      continue;
+    }
+    DynString dep = dynstring_new();
+    for (; *p != '\0' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r';
+         ++p) {
+      if (*p == '\\' && p[1] == ' ')
+        ++p;
+      dynstring_push(&dep, *p);
+    }
+    da_push(&deps, dep.cstr);
+  }
+  bool result = needs_rebuild(target, deps);
+  for (size_t i = 0; i < deps.da_len; ++i)
+    free((char *)*da_get(&deps, i));
+  free(deps.da_items);
+  free(contents.cstr);
+  return result;
+}
+
+bool cmd_changed(Cmd cmd, const char *cmdfile) {
+  DynString s = concat_strings_with_space(cmd.args);
+  bool changed = true;
+  FILE *f = fopen(cmdfile, "r");
+  if (f != NULL) {
+    DynString old = dynstring_new();
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) != 0)
+      dynstring_append(&old, buf, n);
+    fclose(f);
+    changed = strcmp(old.cstr, s.cstr) != 0;
+    free(old.cstr);
+  }
+  if (changed) {
+    f = fopen(cmdfile, "w");
+    assert(f != NULL);
+    fputs(s.cstr, f);
+    fclose(f);
+  }
+  free(s.cstr);
+  return changed;
+}
+
 #else
 #ifdef YEB_MAIN
 
@@ -338,6 +512,20 @@ int main(int argc, char **argv) {
    exit(1))
 
 void execute(Cmd cmd) { YEB_ERROR_NOT_BOOTSTRAPPED(); }
+void jobs_spawn(Jobs *jobs, Cmd cmd) { YEB_ERROR_NOT_BOOTSTRAPPED(); }
+void jobs_wait_all(Jobs *jobs) { YEB_ERROR_NOT_BOOTSTRAPPED(); }
+bool needs_rebuild(const char *target, ConstStrings deps) {
+  YEB_ERROR_NOT_BOOTSTRAPPED();
+  return true;
+}
+bool needs_rebuild_depfile(const char *target, const char *depfile) {
+  YEB_ERROR_NOT_BOOTSTRAPPED();
+  return true;
+}
+bool cmd_changed(Cmd cmd, const char *cmdfile) {
+  YEB_ERROR_NOT_BOOTSTRAPPED();
+  return true;
+}
 
 void yeb_bootstrap() {
   FILE *yeb_is_bootstrapped_txt = fopen("yeb/yeb_is_bootstrapped.txt", "r");